@@ -78,11 +78,13 @@ class NetworkReader:
 import os
 
 class LocalReader:
-    def __init__(self, data_folder, zero_point=142, scale=0.146175):
+    def __init__(self, data_folder, zero_point=142, scale=0.146175, subpixel_bits=8):
         self.data_folder = data_folder
+        self.subpixel_bits = subpixel_bits
         self.zero_point = zero_point
         self.scale = scale
         self.frame_idx = 0
+        self.budget = None
         
         if not os.path.exists(data_folder):
             raise ValueError(f"Data folder does not exist: {data_folder}")
@@ -90,6 +92,10 @@ class LocalReader:
     def get_next_frame(self):
         ktps_file = os.path.join(self.data_folder, f'keypoints_{self.frame_idx}.bin')
         desc_file = os.path.join(self.data_folder, f'descriptors_{self.frame_idx}.bin')
+        # slam_service -b sends the signs of the descriptors instead, 1 bit a value
+        binary = not os.path.exists(desc_file)
+        if binary:
+            desc_file = os.path.join(self.data_folder, f'signatures_{self.frame_idx}.bin')
 
         if not os.path.exists(ktps_file) or not os.path.exists(desc_file):
             return False, None, None
@@ -97,14 +103,28 @@ class LocalReader:
         with open(ktps_file, 'rb') as file:
             kpt_data = file.read()
         kpts = np.frombuffer(kpt_data, dtype=np.int32)
-        kpts = kpts.reshape(2, 200)
+        # The keypoint budget changes from frame to frame, the file holds top_k of them
+        top_k = kpts.size // 2
+        kpts = kpts.reshape(2, top_k)
+        # Keypoints come in fixed point with subpixel_bits fractional bits
+        kpts = kpts.astype(np.float32) / (1 << self.subpixel_bits)
 
         with open(desc_file, 'rb') as file:
                 desc_data = file.read()
         desc = np.frombuffer(desc_data, dtype=np.uint8)
-        desc = desc.reshape(200, 96) 
-        desc = self._dequantize(desc, self.zero_point, self.scale)  
-        desc = self._normalize_rows(desc)
+        desc = desc.reshape(top_k, -1)
+        if binary:
+            desc = self._unpack_signatures(desc)
+        else:
+            desc = self._dequantize(desc, self.zero_point, self.scale)  
+            desc = self._normalize_rows(desc)
+
+        # top_k, quantized threshold and the number of valid keypoints of the frame
+        budget_file = os.path.join(self.data_folder, f'budget_{self.frame_idx}.bin')
+        self.budget = None
+        if os.path.exists(budget_file):
+            with open(budget_file, 'rb') as file:
+                self.budget = tuple(np.frombuffer(file.read(), dtype=np.int32))
 
         self.frame_idx+=1
 
@@ -116,6 +136,12 @@ class LocalReader:
     def _dequantize(x, zero_point, scale):
         return (x.astype(np.float32) - zero_point) * scale
 
+    @staticmethod
+    def _unpack_signatures(signatures):
+        # +-1 per bit over the norm, the dot product of two rows is then 1 - 2 * hamming / bits
+        bits = np.unpackbits(signatures, axis=1, bitorder='little').astype(np.float32)
+        return (2.0 * bits - 1.0) / np.sqrt(bits.shape[1])
+
     @staticmethod
     def _normalize_rows(arr):
         arr = arr - np.min(arr, axis=1).reshape(-1, 1)
@@ -125,3 +151,33 @@ class LocalReader:
         normalized = arr / row_norms
         
         return normalized
+
+
+import struct
+import binascii
+
+# slam_service -v: A5 5A, frame id, flags, inliers, quaternion (w, x, y, z), position,
+# 6 variances, CRC-16/CCITT of everything between the sync word and the CRC
+POSE_PACKET = struct.Struct('<IBB4f3f6f')
+POSE_KEYFRAME, POSE_LOST, POSE_SCALE_RESET = 1, 2, 4
+
+
+def read_pose_packets(path):
+    """Pose packets of data/poses.bin as (frame_id, flags, inliers, q, t, covariance)"""
+    with open(path, 'rb') as file:
+        data = file.read()
+    poses = []
+    size = 2 + POSE_PACKET.size + 2
+    offset = 0
+    while offset + size <= len(data):
+        body = data[offset + 2:offset + size - 2]
+        crc, = struct.unpack_from('<H', data, offset + size - 2)
+        if data[offset:offset + 2] != b'\xa5\x5a' or binascii.crc_hqx(body, 0xFFFF) != crc:
+            # Resynchronize on the next sync word
+            offset += 1
+            continue
+        fields = POSE_PACKET.unpack(body)
+        poses.append((fields[0], fields[1], fields[2], np.array(fields[3:7]), np.array(fields[7:10]),
+                      np.array(fields[10:16])))
+        offset += size
+    return poses
@@ -0,0 +1,94 @@
+#ifndef SLAM_BUDGET_CONTROLLER_H
+#define SLAM_BUDGET_CONTROLLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+
+
+/// @brief Keypoint budget of a frame: how many keypoints DKD keeps and the quantized
+/// score they must beat
+struct KeypointBudget {
+    int top_k;
+    uint8_t threshold;
+};
+
+/// @brief Measurements of a single frame, reported once it leaves the pipeline
+struct FrameStats {
+    // Capture to written/sent, the latency the controller holds under the target
+    double latency_ms = 0.0;
+    // Inference plus keypoint extraction
+    double extract_ms = 0.0;
+    // Serialization and writing/sending
+    double send_ms = 0.0;
+    // Frames waiting for the sender when this one was taken
+    size_t queue_depth = 0;
+    // Bytes this frame took on the link
+    size_t bytes_sent = 0;
+    // Time since the previous frame was reported
+    double interval_ms = 0.0;
+};
+
+/// @brief Limits and gains of the BudgetController
+struct BudgetSettings {
+    int min_top_k = 50;
+    int max_top_k = 200;
+    // The configured detection threshold is the lower bound, the controller only raises it
+    uint8_t min_threshold = 127;
+    uint8_t max_threshold = 200;
+
+    // Capture to sent latency to stay under
+    double target_latency_ms = 150.0;
+    // Usable bandwidth of the link, 921600 baud 8N1 by default
+    double link_bytes_per_second = 92160.0;
+    // Frames allowed to wait for the sender before the pipeline counts as congested
+    size_t max_queue_depth = 1;
+
+    // Load below this fraction of every limit lets the budget grow again
+    double headroom = 0.8;
+    // top_k is multiplied by this when over a limit...
+    double decrease = 0.75;
+    // ...and grows by this many keypoints per frame when under all of them
+    int increase = 10;
+    // Threshold step, used once top_k is down to min_top_k and on the way back
+    int threshold_step = 8;
+    // Weight of the newest frame in the smoothed latency and bandwidth
+    double smoothing = 0.25;
+};
+
+/// @brief Feedback controller of the keypoint budget, additive increase and
+/// multiplicative decrease like TCP congestion control.
+/// The sender reports every frame, the load is the worst of the smoothed latency, the
+/// link bandwidth and the queue depth relative to their limits. Over a limit top_k is
+/// cut multiplicatively, then the threshold goes up. With headroom below all of them the
+/// threshold comes back down first, then top_k grows additively.
+/// Thread-safe: frames are reported by the sender and the budget is read by the detector
+class BudgetController {
+public:
+    explicit BudgetController(const BudgetSettings& settings = BudgetSettings());
+
+    /// @brief Feeds back the measurements of a frame and retunes the budget
+    void report(const FrameStats& stats);
+
+    /// @brief Budget for the next frame
+    KeypointBudget budget() const;
+
+    /// @brief Load of the last report, the worst ratio of a measurement to its limit
+    double load() const;
+
+    const BudgetSettings& settings() const { return m_settings; }
+
+private:
+    BudgetSettings m_settings;
+
+    mutable std::mutex m_mutex;
+    KeypointBudget m_budget;
+    double m_latency_ms = 0.0;
+    double m_bytes_per_second = 0.0;
+    double m_load = 0.0;
+    // Reports to wait after a cut for the smoothed measurements to show its effect
+    int m_cooldown = 0;
+    bool m_first_report = true;
+};
+
+#endif // SLAM_BUDGET_CONTROLLER_H
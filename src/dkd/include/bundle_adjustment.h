@@ -0,0 +1,149 @@
+#ifndef SLAM_DKD_BUNDLE_ADJUSTMENT_H
+#define SLAM_DKD_BUNDLE_ADJUSTMENT_H
+
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+// Local bundle adjustment over a window of keyframes, on the drone instead of g2o in the
+// Python prototype. Double precision, the normal equations of a window are small but
+// badly conditioned.
+
+namespace dkd {
+
+/// @brief Pinhole camera with the radial part of the OpenCV distortion model, in the pixels
+/// of the keypoints. The tangential terms of the calibration are ~1e-3 and left out
+struct CameraModel {
+    double fx, fy, cx, cy;
+    double k1 = 0.0, k2 = 0.0, k3 = 0.0;
+};
+
+/// @brief Settings of LocalBundleAdjuster
+struct BundleSettings {
+    // Levenberg-Marquardt iterations, rejected steps included: the cost is bounded, not
+    // the convergence
+    int iterations = 5;
+    // Residuals over this many pixels weigh in linearly (Huber)
+    double huber_px = 2.0;
+    // Oldest keyframes of the window held fixed, two fix the gauge and the scale
+    int fixed_keyframes = 2;
+    double initial_lambda = 1e-3;
+};
+
+/// @brief A keypoint of a keyframe that sees a point of the window
+struct Observation {
+    int keyframe;
+    int point;
+    // Distorted pixels, as DKD finds them
+    double x, y;
+};
+
+/// @brief Keyframes and points of a window, adjusted in place
+struct BundleWindow {
+    // World to camera poses: a world point X is at R X + t in the keyframe, oldest first
+    std::vector<Eigen::Matrix3d> rotations;
+    std::vector<Eigen::Vector3d> translations;
+    std::vector<Eigen::Vector3d> points;
+    std::vector<Observation> observations;
+};
+
+/// @brief What an adjustment did
+struct BundleReport {
+    int iterations = 0;
+    int accepted = 0;
+    // Robust costs, half the sum of the Huber losses in px^2
+    double initial_cost = 0.0;
+    double final_cost = 0.0;
+    // Observations over the Huber threshold after the adjustment
+    int outliers = 0;
+    double milliseconds = 0.0;
+};
+
+/// @brief Levenberg-Marquardt on the keyframe poses and the points of a window. The points
+/// are eliminated with the Schur complement, which leaves a 6x6 block a pair of keyframes
+/// that share points: a sparse reduced camera system solved by sparse LDLT, its pattern
+/// analysed once a window. The points then follow by back substitution, 3x3 blocks each.
+/// Jacobians are analytic, poses move by a rotation and a translation in the camera frame.
+/// The buffers are kept from one window to the next
+class LocalBundleAdjuster {
+public:
+    explicit LocalBundleAdjuster(const CameraModel& camera, const BundleSettings& settings = BundleSettings());
+
+    /// @brief Adjusts the poses after the fixed ones and all the points of the window. A window
+    /// of no more keyframes than the fixed ones is left as it is
+    BundleReport optimize(BundleWindow& window);
+
+    /// @brief Distorted pixel of a point in the camera frame, false behind the camera
+    bool project(const Eigen::Vector3d& point, Eigen::Vector2d& pixel) const;
+
+    const CameraModel& camera() const { return m_camera; }
+    const BundleSettings& settings() const { return m_settings; }
+
+private:
+    typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+    typedef Eigen::Matrix<double, 6, 1> Vector6d;
+    typedef Eigen::Matrix<double, 6, 3> Matrix63d;
+    // Vectorizable fixed size Eigen types need aligned storage in C++11 containers
+    template<typename T>
+    using AlignedVector = std::vector<T, Eigen::aligned_allocator<T>>;
+
+    // Points closer to a camera than this don't count
+    static constexpr double MIN_DEPTH = 1e-3;
+
+    /// @brief Robust cost of the window, with the Huber weights of the observations when given
+    double cost(const BundleWindow& window, std::vector<double>* weights) const;
+
+    /// @brief Groups the observations by point and lays out the reduced camera system
+    void prepare(const BundleWindow& window);
+
+    /// @brief Fills the blocks of the normal equations at the current estimate
+    void linearize(const BundleWindow& window);
+
+    /// @brief Moves the free keyframes and the points by the last solve()
+    void update(BundleWindow& window) const;
+
+    /// @brief Solves the damped system for the steps, false when it is singular
+    bool solve(double lambda);
+
+    CameraModel m_camera;
+    BundleSettings m_settings;
+
+    int m_fixed = 0;
+    int m_free = 0;
+    // Observations grouped by point, the first of each point, and the free keyframe of each
+    // observation, -1 for the fixed ones
+    std::vector<int> m_by_point;
+    std::vector<int> m_point_start;
+    std::vector<int> m_free_index;
+    // Slot of the reduced camera system block of a pair of free keyframes, -1 when they
+    // share no point, and the pairs of the slots
+    std::vector<int> m_slots;
+    std::vector<std::pair<int, int>> m_pairs;
+
+    // Normal equations: keyframe blocks U, point blocks V, one W an observation
+    std::vector<double> m_weights, m_trial_weights;
+    AlignedVector<Matrix6d> m_U;
+    AlignedVector<Vector6d> m_bp;
+    std::vector<Eigen::Matrix3d> m_V;
+    std::vector<Eigen::Vector3d> m_bx;
+    AlignedVector<Matrix63d> m_W;
+
+    // Reduced camera system and its solution
+    AlignedVector<Matrix6d> m_blocks;
+    std::vector<Eigen::Triplet<double>> m_triplets;
+    Eigen::SparseMatrix<double> m_S;
+    Eigen::VectorXd m_rhs;
+    Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> m_solver;
+    bool m_analyzed = false;
+    AlignedVector<Vector6d> m_dp;
+    std::vector<Eigen::Vector3d> m_dx;
+    std::vector<Eigen::Matrix3d> m_V_inverse;
+
+    // Estimate before a step, to go back to when it doesn't lower the cost
+    BundleWindow m_backup;
+};
+
+} // namespace dkd
+
+#endif // SLAM_DKD_BUNDLE_ADJUSTMENT_H
@@ -0,0 +1,208 @@
+#ifndef ML_TOOLS_ALIKE_DKD_H
+#define ML_TOOLS_ALIKE_DKD_H
+
+#include <Eigen/Dense>
+#include <vector>
+#include <algorithm>
+#include <memory>
+
+#include "dkd_kernels.h"
+#include "thread_pool.h"
+
+
+class DKD {
+public:
+    /// @brief Scratch memory of the detection and the descriptor sampling, kept between
+    /// frames. Once sized by DKD::reserve() a frame does no heap allocations
+    struct Workspace {
+        // Rolling window of the candidate detector
+        dkd::LocalMaxStream local_max;
+
+        // Top k keypoint selectors
+        dkd::HistogramTopK selector;
+        dkd::GridTopK grid_selector;
+
+        // Tiled execution, one band of rows per thread
+        struct Band {
+            dkd::LocalMaxStream stream;
+            // Packed (y << 16 | x) candidates in raster order
+            std::vector<uint32_t> candidates;
+        };
+        std::vector<Band> bands;
+
+        // Descriptor sampling engines and their inputs
+        dkd::DescriptorGather gather;
+        dkd::BilinearSampler bilinear_sampler;
+        std::vector<int32_t> pixels;
+        std::vector<int32_t> sample_points;
+
+        // Interleaved (x, y) keypoints of the Eigen versions of run()
+        std::vector<int32_t> keypoints;
+        // uint8 descriptors of the float version of run()
+        std::vector<uint8_t> descriptors;
+    };
+
+    DKD(int top_k = 500, int radius = 4, int padding = 2)
+        : m_top_k(top_k), m_radius(radius), m_padding(padding) {
+        m_sigmoid.configure(m_quantization);
+    }
+    
+    /// @brief Keypoints (top_k x 2) and their descriptors (top_k x D). Outputs of the
+    /// right size are reused, so passing the same matrices every frame doesn't allocate
+    void run(const uint8_t* scores_map, const uint8_t* descriptor_map,
+        Eigen::MatrixXi& keypoints, Eigen::Matrix<uint8_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>& descriptors, 
+        // Eigen::MatrixXi& keypoints, Eigen::MatrixXf& descriptors, 
+        size_t D, size_t H, size_t W);
+
+    /// @brief Same as above with bilinearly sampled descriptors in the uint8 quantization
+    /// of the map with 4 more fractional bits, see dkd::BilinearSampler
+    void run(const uint8_t* scores_map, const uint8_t* descriptor_map,
+        Eigen::MatrixXi& keypoints, Eigen::Matrix<int16_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>& descriptors, 
+        size_t D, size_t H, size_t W);
+
+    /// @brief Same as above with float descriptors: the uint8 values L2 normalized per row,
+    /// as the ml_tools tools use them
+    void run(const uint8_t* scores_map, const uint8_t* descriptor_map,
+        Eigen::MatrixXi& keypoints, Eigen::MatrixXf& descriptors,
+        size_t D, size_t H, size_t W);
+
+    /// @brief Allocation free version of run() writing into caller owned buffers.
+    /// Valid keypoints come first, the remaining rows are padded with -1 keypoints and zero descriptors
+    /// @param keypoints top_k x 2 row-major (x, y)
+    /// @param descriptors top_k x D row-major
+    /// @return Number of valid keypoints
+    int run_into(const uint8_t* scores_map, const uint8_t* descriptor_map,
+        int32_t* keypoints, uint8_t* descriptors, size_t D, size_t H, size_t W);
+
+    /// @brief Sizes the workspace for D x H x W maps up front, so even the first frame
+    /// and frames full of candidates don't allocate. Call it after changing the settings
+    void reserve(size_t D, size_t H, size_t W);
+
+    int top_k() const { return m_top_k; }
+
+    /// @brief Changes the number of keypoints kept per frame, e.g. every frame by a budget
+    /// controller. Stays allocation free up to the top k the workspace was reserved for
+    void set_top_k(int top_k) { m_top_k = std::max(top_k, 1); }
+
+    /// @brief Spreads the top k keypoints over a cells_x x cells_y grid laid over the
+    /// detection window, every cell gets an equal share of top k. 1x1 is the plain global selection
+    void set_grid_cells(int cells_x, int cells_y) {
+        m_grid_cells_x = std::max(cells_x, 1);
+        m_grid_cells_y = std::max(cells_y, 1);
+    }
+
+    /// @brief Refines keypoints to sub-pixel accuracy with a soft-argmax over the NMS window.
+    /// Keypoints then come out in Q8 fixed point (dkd::SUBPIXEL_BITS fractional bits)
+    /// @param temperature Softness of the soft-argmax in score quantization steps. Clamped to
+    /// dkd::MIN_SOFT_ARGMAX_TEMPERATURE, so 0 and below, or NaN, give the plain argmax
+    void set_subpixel_refinement(bool enable, float temperature = 3.0f) {
+        m_subpixel = enable;
+        m_subpixel_temperature = temperature > dkd::MIN_SOFT_ARGMAX_TEMPERATURE ? temperature
+                                                                                 : dkd::MIN_SOFT_ARGMAX_TEMPERATURE;
+    }
+
+    /// @brief Quantization of the score map, zp and scale of the output tensor of the model.
+    /// A threshold set in score or probability units is converted again with it
+    void set_score_quantization(const dkd::Quantization& quantization);
+
+    /// @brief Keypoints must score above this, in dequantized score units (logits)
+    void set_score_threshold(float score);
+
+    /// @brief Keypoints must score above this, as sigmoid of the dequantized score
+    void set_probability_threshold(float probability);
+
+    /// @brief Keypoints must score above this, straight in the uint8 domain of the map. 127 by default
+    void set_quantized_threshold(uint8_t threshold);
+
+    /// @brief Threshold the detector actually compares the uint8 scores against
+    uint8_t quantized_threshold() const { return m_threshold; }
+
+    /// @brief Probability of a uint8 score, sigmoid of its dequantized value
+    float score_probability(uint8_t score) const { return m_sigmoid.probability(score); }
+
+    /// @brief Layout of the descriptor map given to run(), CHW by default
+    void set_descriptor_layout(dkd::DescriptorLayout layout) { m_descriptor_layout = layout; }
+
+    /// @brief Samples uint8 descriptors bilinearly at the sub-pixel keypoints instead
+    /// of taking the nearest pixel, like the ALIKE reference does
+    void set_bilinear_sampling(bool enable) { m_bilinear = enable; }
+
+    /// @brief Splits the candidate detection into horizontal bands run on a pool of
+    /// threads, the calling one included. The output is the same as with a single thread
+    void set_threads(int threads);
+
+    /// @brief Runs the kernels specialized for the radius at compile time when there are
+    /// ones for it (up to dkd::MAX_SPECIALIZED_RADIUS), on by default. Off is for comparison
+    void set_specialized_kernels(bool enable);
+
+private:
+    // From a pretty random number of detected keypoints only top k
+    // with the most intensity will be selected
+    int m_top_k;
+
+    // Radius of the local region in which we seek for the maximum intensity
+    // points on the score map
+    int m_radius;
+
+    // ALike tends to give false postives close to borders. Thus we skip
+    // several rows in the score map during keypoint detection
+    int m_padding;
+
+    // Keypoint selection grid, global top k when it's a single cell
+    int m_grid_cells_x = 1;
+    int m_grid_cells_y = 1;
+
+    bool m_specialized = true;
+
+    // Soft-argmax refinement, Q8 keypoints when enabled
+    bool m_subpixel = false;
+    float m_subpixel_temperature = 3.0f;
+
+    dkd::DescriptorLayout m_descriptor_layout = dkd::DescriptorLayout::CHW;
+    bool m_bilinear = false;
+
+    // Detection threshold in the units it was given, converted to m_threshold once
+    // when it or the quantization changes, so the detector only compares uint8 scores
+    enum class ThresholdUnits { Quantized, Score, Probability };
+    ThresholdUnits m_threshold_units = ThresholdUnits::Quantized;
+    float m_threshold_value = 127.0f;
+    uint8_t m_threshold = 127;
+    dkd::Quantization m_quantization;
+    dkd::SigmoidLut m_sigmoid;
+    
+private:
+    /// @brief Extract keypoints from the the score map using simple nms via single maxpool run
+    /// @param keypoints top_k x 2 row-major (x, y), padded with -1
+    /// @return Number of extracted keypoints
+    int maxpool_detect_keypoints(const uint8_t* scores_map, int H, int W, int32_t* keypoints);
+
+    /// @brief Using keypoints' UVs sample descriptor vectors from the descriptor map.
+    /// Q8 keypoints are rounded to the nearest pixel
+    /// @param descriptors top_k x D row-major
+    // Eigen::MatrixXf sample_descriptors(const uint8_t* descriptor_map, const Eigen::MatrixXi& kpts, int D, int H, int W);
+    void sample_descriptors(const uint8_t* descriptor_map, const int32_t* keypoints, int D, int H, int W,
+                            uint8_t* descriptors);
+
+    /// @brief Fills the sample points (Q8) and the nearest pixels of the keypoints,
+    /// -1 for the padding and the ones out of bounds
+    void prepare_sample_points(const int32_t* keypoints, int H, int W);
+
+    /// @brief Converts the threshold to the uint8 domain of the score map
+    void update_threshold();
+
+    /// @brief Copies the interleaved workspace keypoints into the Eigen output
+    void export_keypoints(Eigen::MatrixXi& keypoints) const;
+    
+
+private:
+    Workspace m_workspace;
+
+    // Refinement LUT, rebuilt only when the parameters change
+    dkd::SoftArgmax m_soft_argmax;
+    float m_soft_argmax_temperature = 0.0f;
+
+    // Workers of the tiled execution
+    std::unique_ptr<ThreadPool> m_pool;
+};
+
+#endif // ML_TOOLS_ALIKE_DKD_H
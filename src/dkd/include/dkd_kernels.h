@@ -0,0 +1,359 @@
+#ifndef SLAM_DKD_KERNELS_H
+#define SLAM_DKD_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+// Low level kernels used by DKD. They work on raw row-major uint8 buffers
+// straight from the NPU output, so nothing here depends on Eigen.
+//
+// The hot loops use NEON on ARM and SSE2 on x86 with a scalar fallback for
+// everything else. Define DKD_DISABLE_SIMD to force the scalar fallback.
+
+namespace dkd {
+
+/// @brief Affine uint8 quantization of a tensor, real = (q - zero_point) * scale.
+/// The defaults are the ones of the current ALIKE export.
+struct Quantization {
+    Quantization(int32_t zero_point = 142, float scale = 0.146175f)
+        : zero_point(zero_point), scale(scale) {}
+
+    int32_t zero_point;
+    float scale;
+};
+
+/// @brief Quantized threshold t of the detector test q > t matching real(q) > score.
+/// Scores below the representable range give 0, above it 255 (nothing passes).
+uint8_t quantize_score_threshold(float score, const Quantization& quantization);
+
+/// @brief sigmoid(real(q)) for all 256 quantized scores, to work with thresholds
+/// in probability units while the detector keeps comparing raw uint8 scores.
+class SigmoidLut {
+public:
+    void configure(const Quantization& quantization);
+
+    float probability(uint8_t q) const { return m_lut[q]; }
+
+    /// @brief Quantized threshold t of the detector test q > t matching
+    /// sigmoid(real(q)) > probability
+    uint8_t threshold(float probability) const;
+
+private:
+    float m_lut[256] = {};
+};
+
+/// @brief Largest NMS radius with kernels specialized at compile time. Larger ones
+/// run the generic kernels with the radius as a runtime loop bound
+const int MAX_SPECIALIZED_RADIUS = 4;
+
+/// @brief Sliding window maximum of a 1D sequence (van Herk/Gil-Werman).
+/// Computes dst[i] = max(src[i], ..., src[i + 2 * radius]) for i in [0, n),
+/// so src must hold n + 2 * radius elements. Costs ~3 comparisons per element
+/// regardless of the radius.
+/// @param scratch At least 2 * (n + 2 * radius) bytes
+void running_max_1d(const uint8_t* src, uint8_t* dst, int n, int radius, uint8_t* scratch);
+
+/// @brief Bytes per row of a packed local maximum mask of a W pixels wide map.
+/// Rows are padded to whole 16 pixel chunks.
+inline int nms_mask_stride(int W) { return (W + 15) / 16 * 2; }
+
+/// @brief Streaming keypoint candidate detector.
+/// Walks the scoremap one row at a time keeping only a rolling window of 2r+1
+/// horizontally dilated rows, so the working set is O(W * r) instead of O(H * W).
+/// For every row the vertical dilation, the comparison against the source and the
+/// threshold test are fused into a single pass that yields a packed mask of the
+/// local maxima above the threshold.
+class LocalMaxStream {
+public:
+    /// @brief Starts a new pass over the [h_start, h_stop) x [w_start, w_stop) window
+    /// of a row-major scoremap W pixels wide. The window must be at least radius pixels
+    /// away from the borders. Buffers grow on the first call only.
+    void reset(const uint8_t* scores, int W,
+               int h_start, int w_start, int h_stop, int w_stop,
+               int radius, uint8_t threshold);
+
+    /// @brief Preallocates the buffers for maps up to W pixels wide
+    void reserve(int W, int radius);
+
+    /// @brief Produces the candidates of the next row of the window.
+    /// Bit j of row_mask (LSB first) is set when scores(y, j) is the maximum of its
+    /// (2r+1)x(2r+1) neighbourhood and is greater than the threshold. Bits outside of
+    /// [w_start, w_stop) are cleared. The mask is valid until the next call.
+    /// @return false once all the rows of the window have been produced
+    bool next_row(int& y, const uint8_t*& row_mask);
+
+    /// @brief Bytes of working memory held by the stream
+    size_t working_set() const { return m_buffer.size(); }
+
+    /// @brief Use the kernels specialized for the radius when there are ones for it,
+    /// on by default. Off runs the generic ones, for comparison. Applies from the next reset()
+    void set_specialized(bool enable) { m_specialized = enable; }
+
+private:
+    // Horizontally dilates map row y into its slot of the rolling window
+    void dilate_row(int y);
+
+    typedef void (*DilateRow)(const uint8_t* src, uint8_t* dst, int cols, int radius, uint8_t* scratch);
+    typedef void (*PoolRow)(const uint8_t* ring, size_t row_size, int radius, const uint8_t* center,
+                            int w_start, int w_stop, uint8_t threshold, uint8_t* row_mask);
+
+private:
+    const uint8_t* m_scores = nullptr;
+    int m_W = 0;
+    int m_h_start = 0;
+    int m_w_start = 0;
+    int m_h_stop = 0;
+    int m_w_stop = 0;
+    int m_radius = 0;
+    uint8_t m_threshold = 0;
+    int m_next_y = 0;
+
+    int m_row_size = 0;
+    int m_mask_stride = 0;
+    std::vector<uint8_t> m_buffer;
+    uint8_t* m_ring = nullptr;
+    uint8_t* m_center = nullptr;
+    uint8_t* m_row_mask = nullptr;
+    uint8_t* m_line_scratch = nullptr;
+
+    // Row kernels for the current radius, picked by reset()
+    bool m_specialized = true;
+    DilateRow m_dilate_row = nullptr;
+    PoolRow m_pool_row = nullptr;
+};
+
+/// @brief Calls fn(x) for every set bit of a packed mask row, in ascending order.
+template <typename Fn>
+inline void for_each_row_bit(const uint8_t* row_mask, int stride, Fn fn) {
+    for (int byte = 0; byte < stride; ++byte) {
+        unsigned bits = row_mask[byte];
+        while (bits) {
+            fn(byte * 8 + __builtin_ctz(bits));
+            bits &= bits - 1;
+        }
+    }
+}
+
+/// @brief Single pass keypoint candidate extraction, no full frame buffers involved.
+/// Calls sink(x, y, score) for every local maximum above the threshold in raster order.
+template <typename Sink>
+inline void detect_local_maxima(LocalMaxStream& stream, const uint8_t* scores, int W,
+                                int h_start, int w_start, int h_stop, int w_stop,
+                                int radius, uint8_t threshold, Sink sink) {
+    stream.reset(scores, W, h_start, w_start, h_stop, w_stop, radius, threshold);
+
+    int stride = nms_mask_stride(W);
+    int y;
+    const uint8_t* row_mask;
+    while (stream.next_row(y, row_mask)) {
+        const uint8_t* row = scores + static_cast<size_t>(y) * W;
+        for_each_row_bit(row_mask, stride, [&](int x) { sink(x, y, row[x]); });
+    }
+}
+
+/// @brief Top-k selection of keypoints with uint8 scores by counting sort.
+/// Candidates are histogrammed while they are pushed, select() finds the cutoff
+/// bucket and scatters the survivors in a single pass: O(N) and no heap.
+/// Ties are resolved deterministically in push order, which for the detector is
+/// raster order: among equal scores the upper-left keypoints win and come first.
+class HistogramTopK {
+public:
+    /// @brief Preallocates room for the given number of candidates
+    void reserve(size_t candidates);
+
+    /// @brief Drops all the candidates. Keeps the capacity
+    void clear();
+
+    void push(int x, int y, uint8_t score) {
+        m_candidates.push_back(static_cast<uint32_t>(y) << 16 | static_cast<uint32_t>(x));
+        m_scores.push_back(score);
+        ++m_histogram[score];
+    }
+
+    size_t size() const { return m_candidates.size(); }
+
+    /// @brief Writes min(k, size()) keypoints with the highest scores in descending
+    /// score order as interleaved (x, y) pairs.
+    /// @param scores Optional, receives the score of every selected keypoint
+    /// @return Number of keypoints written
+    int select(int k, int32_t* xy, uint8_t* scores = nullptr);
+
+private:
+    // Packed (y << 16 | x) coordinates and scores in push order
+    std::vector<uint32_t> m_candidates;
+    std::vector<uint8_t> m_scores;
+    uint32_t m_histogram[256] = {};
+};
+
+/// @brief Spatially bucketed top-k selection of keypoints with uint8 scores.
+/// The detection window is split into cells_x x cells_y cells and each cell gets an
+/// equal share of k. Its best keypoints are selected by a per cell histogram the same
+/// way as in HistogramTopK. Quota a cell cannot fill (too few candidates in it) goes
+/// to the best of the remaining keypoints of the whole frame. Costs O(N) plus
+/// O(cells * 256) per frame.
+/// Selected keypoints come out in descending score order, ties in push order.
+class GridTopK {
+public:
+    /// @brief Preallocates room for the given number of candidates
+    void reserve(size_t candidates);
+
+    /// @brief Drops all the candidates and sets up the grid over the
+    /// [h_start, h_stop) x [w_start, w_stop) window. Keeps the capacity
+    void reset(int cells_x, int cells_y, int h_start, int w_start, int h_stop, int w_stop);
+
+    /// @brief Adds a keypoint, (x, y) must be inside the window
+    void push(int x, int y, uint8_t score) {
+        int cell = m_cell_of_row[y - m_h_start] + m_cell_of_col[x - m_w_start];
+        m_candidates.push_back(static_cast<uint32_t>(y) << 16 | static_cast<uint32_t>(x));
+        m_scores.push_back(score);
+        m_cells.push_back(static_cast<uint16_t>(cell));
+        ++m_histograms[cell * 256 + score];
+        ++m_histogram[score];
+        m_min_score = std::min<int>(m_min_score, score);
+        m_max_score = std::max<int>(m_max_score, score);
+    }
+
+    size_t size() const { return m_candidates.size(); }
+
+    int cells() const { return m_cells_x * m_cells_y; }
+
+    /// @brief Writes min(k, size()) keypoints as interleaved (x, y) pairs, see the class description
+    /// @param scores Optional, receives the score of every selected keypoint
+    /// @return Number of keypoints written
+    int select(int k, int32_t* xy, uint8_t* scores = nullptr);
+
+private:
+    int m_cells_x = 0;
+    int m_cells_y = 0;
+    int m_h_start = 0;
+    int m_w_start = 0;
+
+    // Cell index lookup, the row table is premultiplied by cells_x
+    std::vector<uint16_t> m_cell_of_row;
+    std::vector<uint16_t> m_cell_of_col;
+
+    // Packed (y << 16 | x) coordinates, scores and cells in push order
+    std::vector<uint32_t> m_candidates;
+    std::vector<uint8_t> m_scores;
+    std::vector<uint16_t> m_cells;
+
+    // 256 bins per cell and the one of the whole window
+    std::vector<uint32_t> m_histograms;
+    uint32_t m_histogram[256] = {};
+
+    // Range of the pushed scores, bounds the histogram walks
+    int m_min_score = 255;
+    int m_max_score = 0;
+
+    // Per cell cutoff score and how many keypoints with exactly that score are taken
+    std::vector<int> m_cell_cutoffs;
+    std::vector<uint32_t> m_cell_cutoff_quotas;
+};
+
+/// @brief Fractional bits of the refined keypoint coordinates (Q8)
+static const int SUBPIXEL_BITS = 8;
+
+/// @brief Lowest soft-argmax temperature DKD configures. exp(-1 / t) already rounds to 0 in
+/// the Q8 LUT there, so it is the plain argmax, the limit of the lower ones
+static const float MIN_SOFT_ARGMAX_TEMPERATURE = 0.01f;
+
+/// @brief Sub-pixel keypoint refinement by soft-argmax over the (2r+1)x(2r+1)
+/// neighbourhood, as in the original ALIKE DKD. Every pixel is weighted by
+/// exp(-(center - score) / temperature) and the keypoint moves to the weighted
+/// mean of the offsets. The exponent comes from a LUT indexed by the score
+/// difference, so there is no floating point in the hot loop.
+class SoftArgmax {
+public:
+    /// @param temperature Softness of the weights in score quantization steps, must be positive
+    void configure(int radius, float temperature);
+
+    /// @brief Refines count keypoints given as interleaved (x, y) pairs into Q8 coordinates.
+    /// Keypoints must be at least radius pixels away from the borders. xy_q8 may alias xy.
+    void refine(const uint8_t* scores, int W, const int32_t* xy, int count, int32_t* xy_q8) const;
+
+    int radius() const { return m_radius; }
+
+    /// @brief Same as LocalMaxStream::set_specialized()
+    void set_specialized(bool enable) { m_specialized = enable; }
+
+private:
+    int m_radius = 0;
+    bool m_specialized = true;
+    // exp(-d / temperature) in Q16 for every score difference d
+    uint16_t m_weights[256] = {};
+};
+
+/// @brief Memory layout of the descriptor tensor
+enum class DescriptorLayout {
+    // D planes of H x W, the layout of the NPU output
+    CHW,
+    // H x W pixels of D channels, a descriptor is a single contiguous read
+    HWC,
+};
+
+/// @brief Gathers the descriptors of a set of pixels into a row-major count x D matrix.
+/// In CHW the pixels are sorted by their linear index and every channel plane is
+/// walked once front to back, prefetching the same pixels of the next plane, instead
+/// of D reads one plane apart per keypoint.
+class DescriptorGather {
+public:
+    /// @brief Preallocates the buffers for up to count keypoints
+    void reserve(int count);
+
+    /// @param pixels Linear index y * W + x of every output row, negative for the rows to zero
+    void gather(const uint8_t* descriptor_map, DescriptorLayout layout, int D, int H, int W,
+                const int32_t* pixels, int count, uint8_t* descriptors);
+
+private:
+    // Sorted (pixel << 32 | row) keys
+    std::vector<uint64_t> m_order;
+    // Sorted pixels and their output rows
+    std::vector<int32_t> m_pixels;
+    std::vector<int32_t> m_rows;
+};
+
+/// @brief Bilinear descriptor sampling at Q8 keypoints straight on the quantized
+/// uint8 planes. The fractions are rounded to WEIGHT_BITS bits, so the four weights
+/// of a keypoint are uint8 summing up to 256 and the interpolation is a widening
+/// multiply-accumulate into uint16 (NEON vmull/vmlal, SSE2 unpack + mullo).
+/// The weights sum up to one, so the result keeps the zero point and scale of the map.
+/// Keypoints right on a pixel get the exact value of that pixel.
+class BilinearSampler {
+public:
+    /// @brief Fractional bits of the interpolation weights
+    static const int WEIGHT_BITS = 4;
+
+    /// @brief Preallocates the buffers for up to count keypoints
+    void reserve(int count);
+
+    /// @brief Requantized uint8 descriptors, rounded to the nearest step.
+    /// @param xy_q8 Interleaved Q8 (x, y) of every output row, negative for the rows to zero
+    void sample(const uint8_t* descriptor_map, DescriptorLayout layout, int D, int H, int W,
+                const int32_t* xy_q8, int count, uint8_t* descriptors);
+
+    /// @brief Descriptors in the uint8 quantization with 4 more fractional bits (value * 16)
+    void sample(const uint8_t* descriptor_map, DescriptorLayout layout, int D, int H, int W,
+                const int32_t* xy_q8, int count, int16_t* descriptors);
+
+private:
+    template <typename T>
+    void sample_impl(const uint8_t* descriptor_map, DescriptorLayout layout, int D, int H, int W,
+                     const int32_t* xy_q8, int count, T* descriptors);
+
+private:
+    // Sorted (pixel << 32 | row) keys
+    std::vector<uint64_t> m_order;
+    // Per keypoint top left pixel, output row and neighbour offsets, in processing order
+    std::vector<int32_t> m_pixels;
+    std::vector<int32_t> m_rows;
+    std::vector<int32_t> m_right;
+    std::vector<int32_t> m_down;
+    // w00, w01, w10 and w11 planes, padded to blocks of 16 keypoints
+    std::vector<uint8_t> m_weights;
+};
+
+} // namespace dkd
+
+#endif // SLAM_DKD_KERNELS_H
@@ -0,0 +1,173 @@
+#ifndef SLAM_DKD_ESSENTIAL_RANSAC_H
+#define SLAM_DKD_ESSENTIAL_RANSAC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <Eigen/Dense>
+
+// Relative pose of two frames from matched keypoints, on the drone instead of in the
+// Python prototype. Fixed size Eigen for the small linear algebra and NEON or SSE2 for
+// scoring the hypotheses, DKD_DISABLE_SIMD forces scalar scoring.
+
+namespace dkd {
+
+/// @brief Pinhole intrinsics of the camera, in the pixels of the keypoints
+struct Intrinsics {
+    float fx;
+    float fy;
+    float cx;
+    float cy;
+};
+
+/// @brief Settings of EssentialRansac
+struct RansacSettings {
+    // Sampson distance of an inlier, in pixels
+    float threshold_px = 1.0f;
+    // Probability of having drawn an all inlier sample when the iterations stop early
+    float confidence = 0.999f;
+    int max_iterations = 1000;
+    uint32_t seed = 1;
+};
+
+/// @brief Relative pose of the second camera: X2 = R * X1 + t
+struct RelativePose {
+    Eigen::Matrix3f E;
+    Eigen::Matrix3f R;
+    // Unit length, the scale isn't observable from two views
+    Eigen::Vector3f t;
+    // Matches consistent with E and in front of both cameras
+    int inliers;
+    int iterations;
+    // Iteration that drew the sample of the returned hypothesis, 1 based
+    int solution_iteration;
+    // Covariance of the rotation as R exp(w), of w in radians, and of t, which only moves
+    // orthogonal to itself. From the final refinement, identity when there was none, and
+    // kept when the refined pose lost inliers and the hypothesis is returned instead
+    Eigen::Matrix3f rotation_covariance;
+    Eigen::Matrix3f translation_covariance;
+};
+
+/// @brief Essential matrix RANSAC with recoverPose() style cheirality.
+/// Hypotheses come from the normalized 8 point algorithm on fixed size matrices, with the
+/// null vector by Gauss-Jordan elimination instead of an SVD. The iteration count adapts to
+/// the best inlier ratio so far and stops once the confidence is reached. Hypotheses are
+/// scored 4 matches at a time by their Sampson distance, comparing num^2 < t^2 den to stay
+/// clear of divisions. Each sample with more inliers than the samples before is refit on its
+/// inliers (local optimization), the inliers of the best refit are triangulated under the four
+/// decompositions of E to pick R and t, and R, t are polished by Levenberg-Marquardt on the
+/// Sampson distances.
+/// 8 point samples need many more iterations than 5 point ones at low inlier ratios,
+/// filter the matches first (MutualMatcher's ratio test) or give them a quality for PROSAC.
+/// With qualities the samples come from the best matches first (PROSAC, Chum and Matas 2005):
+/// the set samples are drawn from grows from the top 8 to all of them over PROSAC_GROWTH
+/// samples, and the iterations stop once the top n matches for any n from 16 and a quarter of
+/// the matches on have seen enough samples for their own inlier ratio
+class EssentialRansac {
+public:
+    explicit EssentialRansac(const Intrinsics& intrinsics, const RansacSettings& settings = RansacSettings());
+
+    /// @brief Preallocates the buffers for up to count matches
+    void reserve(int count);
+
+    /// @brief Estimates the pose from count matches
+    /// @param points1 Interleaved (x, y) pixels in the first frame
+    /// @param points2 Interleaved (x, y) pixels of the same keypoints in the second frame
+    /// @return false when there are fewer than 8 matches or the pose has fewer than 8 inliers
+    bool estimate(const float* points1, const float* points2, int count, RelativePose& pose);
+
+    /// @brief Same as above with PROSAC sampling
+    /// @param quality Per match, higher for the matches more likely right, e.g. the keypoint
+    /// scores times the descriptor similarity. Only the order matters
+    bool estimate(const float* points1, const float* points2, const float* quality, int count,
+                  RelativePose& pose);
+
+    /// @brief 1 for the inliers of the last estimate, 0 for the others
+    const std::vector<uint8_t>& inlier_mask() const { return m_mask; }
+
+    const RansacSettings& settings() const { return m_settings; }
+
+private:
+    typedef Eigen::Matrix<float, 9, 1> Vector9f;
+
+    // Least squares refits of the best hypothesis on its inliers
+    static const int REFIT_ROUNDS = 3;
+    // Levenberg-Marquardt on R, t over the matches within a wider threshold
+    static const int REFINE_ITERATIONS = 5;
+    static constexpr float REFINE_WIDENING = 2.0f;
+    // Samples after which PROSAC draws from all the matches like RANSAC, T_N of the paper
+    static const int PROSAC_GROWTH = 20000;
+    // Chance that a wrong hypothesis has a given match as an inlier, for the non-randomness
+    // test of the top n
+    static constexpr double PROSAC_BETA = 0.05;
+    // Chance of taking a wrong hypothesis for a right one in the non-randomness test
+    static constexpr double PROSAC_PSI = 1e-3;
+    // Smallest top n the stopping rule considers, twice the sample and a fraction of the matches
+    static const int PROSAC_MIN_TOP = 16;
+    static const int PROSAC_MIN_TOP_DIVISOR = 4;
+
+    /// @brief Progressive sampling state, see draw_sample()
+    struct Prosac {
+        // Size of the top set the samples come from
+        int n;
+        // Expected number of samples drawn from the top n, and the sample at which n grows
+        double T_n;
+        int T_n_prime;
+    };
+
+    /// @brief Fills m_sample with 8 distinct matches, uniformly or progressively from the
+    /// matches sorted by quality when prosac is given
+    void draw_sample(int iteration, Prosac* prosac);
+
+    /// @brief Iterations the top n matches need by the inlier ratio of m_mask among them,
+    /// smallest over the n >= drawn the samples so far were all drawn from
+    int progressive_iterations(int drawn) const;
+
+    /// @brief Essential matrix of the 8 matches of m_sample, false on a degenerate sample
+    bool solve_minimal(Eigen::Matrix3f& E) const;
+
+    /// @brief Least squares essential matrix of all the matches in m_mask, weighted by the
+    /// Sampson denominators of weighting when given
+    bool solve_inliers(Eigen::Matrix3f& E, const Eigen::Matrix3f* weighting);
+
+    /// @brief Refits E on its inliers while the inlier count doesn't drop
+    /// @return Inliers of the refit E
+    int optimize(Eigen::Matrix3f& E, int inliers);
+
+    /// @brief Minimizes the Sampson distances of the matches in m_mask over R and t
+    void refine(Eigen::Matrix3f& R, Eigen::Vector3f& t, Eigen::Matrix3f& rotation_covariance,
+                Eigen::Matrix3f& translation_covariance);
+
+    /// @brief Matches within the squared normalized threshold2 of E, written to mask when given
+    int count_inliers(const Eigen::Matrix3f& E, float threshold2, uint8_t* mask) const;
+
+    /// @brief Decomposes E and keeps the R, t with the most inliers in front of both
+    /// cameras, clearing the mask of the others
+    int recover_pose(const Eigen::Matrix3f& E, Eigen::Matrix3f& R, Eigen::Vector3f& t);
+
+    uint32_t random();
+
+    Intrinsics m_intrinsics;
+    RansacSettings m_settings;
+    // Squared threshold in normalized coordinates
+    float m_threshold2;
+    uint32_t m_state;
+
+    int m_count = 0;
+    int m_sample[8];
+
+    // Normalized camera coordinates, structure of arrays for the scoring
+    std::vector<float> m_x1, m_y1, m_x2, m_y2;
+    std::vector<uint8_t> m_mask;
+    // Inliers of the refit
+    std::vector<int> m_indices;
+    // Matches by decreasing quality for PROSAC, and the inliers the top n need to not be
+    // explained by chance
+    std::vector<int> m_order;
+    std::vector<int> m_min_inliers;
+};
+
+} // namespace dkd
+
+#endif // SLAM_DKD_ESSENTIAL_RANSAC_H
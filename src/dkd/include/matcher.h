@@ -0,0 +1,259 @@
+#ifndef SLAM_DKD_MATCHER_H
+#define SLAM_DKD_MATCHER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <utility>
+
+#include <Eigen/Dense>
+
+#include "dkd_kernels.h"
+
+// Descriptor matching straight on the quantized uint8 descriptors of DKD.
+// Same backends as the kernels: NEON, SSE2 and scalar, DKD_DISABLE_SIMD forces the latter.
+
+namespace dkd {
+
+/// @brief A match with its score and the runner-up of its row, for filtering before RANSAC
+struct Match {
+    int32_t index1;
+    int32_t index2;
+    // Second best candidate of index1, -1 when there is a single one
+    int32_t second_index2;
+    // Dequantized similarities of the two
+    float similarity;
+    float second_similarity;
+};
+
+/// @brief Mutual nearest neighbour matching of quantized descriptors by their dot product.
+/// Descriptors are centered on the zero point once per call and the similarities are
+/// exact int32 dot products, so the result is the one of the float matcher on the
+/// dequantized descriptors without its rounding. Nothing is stored per pair: a single
+/// pass over all the pairs tracks the best and second best of every row and every column,
+/// for the mutual check and the ratio test both ways.
+/// Ties go to the lowest index, like Eigen's maxCoeff().
+class MutualMatcher {
+public:
+    /// @param threshold Minimum similarity of a match, in units of the dot product of
+    /// the dequantized descriptors. Must be positive
+    /// @param ratio Lowe's ratio test on the L2 distances of the dequantized descriptors:
+    /// a match must be closer than ratio times the second best of its row and of its
+    /// column. 1 or more disables it
+    void configure(const Quantization& quantization, float threshold, float ratio = 1.0f);
+
+    /// @brief Preallocates the buffers for up to count descriptors of depth D per side
+    void reserve(int count, int D);
+
+    /// @brief Matches count1 descriptors against count2 ones, both count x D row-major.
+    /// Only pass the valid descriptors, the zero padding rows of DKD would match each other
+    /// @param matches Cleared, then filled with (index1, index2) pairs in index1 order
+    void match(const uint8_t* descriptors1, int count1, const uint8_t* descriptors2, int count2, int D,
+               std::vector<std::pair<int, int>>& matches);
+
+    /// @brief Same as above with the scores and the second best of every match, from the
+    /// same single pass
+    void match(const uint8_t* descriptors1, int count1, const uint8_t* descriptors2, int count2, int D,
+               std::vector<Match>& matches);
+
+    /// @brief Integer threshold the dot products are compared against
+    int32_t quantized_threshold() const { return m_threshold; }
+
+private:
+    // Running best and second best similarity of a row or a column and their indices
+    struct Best {
+        int32_t best;
+        int32_t second;
+        int32_t index;
+        int32_t second_index;
+    };
+
+    /// @brief The pass over all the pairs, false when there is nothing to match
+    bool sweep(const uint8_t* descriptors1, int count1, const uint8_t* descriptors2, int count2, int D);
+
+    /// @brief Whether row i has a match passing all the tests
+    bool accepted(int i) const;
+
+    /// @brief Ratio test of row or column index, norms holds the squared norms of its
+    /// frame and other_norms the ones of the other frame
+    bool distinct(const Best& best, int index, const std::vector<int32_t>& norms,
+                  const std::vector<int32_t>& other_norms) const;
+
+    Quantization m_quantization;
+    int32_t m_threshold = 1;
+    float m_ratio = 1.0f;
+
+    // Centered int16 descriptors, rows padded to a multiple of 8 with zeros
+    std::vector<int16_t> m_centered1;
+    std::vector<int16_t> m_centered2;
+
+    // Squared norms of the centered rows, only filled for the ratio test
+    std::vector<int32_t> m_norms1;
+    std::vector<int32_t> m_norms2;
+
+    std::vector<Best> m_rows;
+    std::vector<Best> m_columns;
+};
+
+/// @brief Mutual nearest neighbour matching of float descriptors, the perform_matching() of
+/// the tools without its N1 x N2 similarity matrix. Similarities are computed a tile at a
+/// time, small enough for L1 with the rows they come from, and folded into the running best
+/// and second best of every row and column. Memory is O(N1 + N2), a map of thousands of
+/// points against a frame no longer streams tens of MB. Ties go to the lowest index
+class BlockedMatcher {
+public:
+    /// @param threshold Minimum similarity of a match, must be positive
+    /// @param ratio Lowe's ratio test on the L2 distances of unit rows, applied both ways:
+    /// the best of a match must be closer than ratio times the second best of its row and
+    /// of its column. 1 or more disables it
+    void configure(float threshold, float ratio = 1.0f);
+
+    /// @brief Matches the rows of desc1 against the rows of desc2, both count x D
+    /// @param matches Cleared, then filled with (index1, index2) pairs in index1 order
+    void match(const Eigen::MatrixXf& desc1, const Eigen::MatrixXf& desc2,
+               std::vector<std::pair<int, int>>& matches);
+
+    // 32 x 64 similarities are 8 KB, with the 32 + 64 rows of D = 96 floats they take ~44 KB,
+    // the 64 rows of desc2 stay in L1 across the row tiles of the 32 KB of a Cortex-A7
+    static const int TILE_ROWS = 32;
+    static const int TILE_COLS = 64;
+
+private:
+    // Running best and second best similarity, and the index of the best
+    struct Best {
+        float best;
+        float second;
+        int32_t index;
+    };
+
+    bool distinct(const Best& best) const;
+
+    float m_threshold = 0.0f;
+    float m_ratio = 1.0f;
+
+    Eigen::MatrixXf m_tile;
+    std::vector<Best> m_rows;
+    std::vector<Best> m_columns;
+};
+
+/// @brief Bytes of the binary signature of a D dimensional descriptor, 12 for 96
+inline int signature_size(int D) { return (D + 7) / 8; }
+
+/// @brief Keeps the sign of every descriptor value minus the zero point, for links too slow
+/// for the full descriptors. Bit k is set when value k is above the zero point, it is bit
+/// k % 8 of byte k / 8 (numpy's unpackbits(bitorder='little'))
+/// @param signatures count x signature_size(D) bytes
+void binarize(const uint8_t* descriptors, int count, int D, int32_t zero_point, uint8_t* signatures);
+
+/// @brief Mutual nearest neighbour matching of binary signatures by their Hamming distance,
+/// with Lowe's ratio test on top. Popcounts with vcnt on NEON, popcnt when the target has it
+/// and a bit twiddling popcount with psadbw on plain SSE2. Ties go to the lowest index,
+/// like MutualMatcher
+class HammingMatcher {
+public:
+    /// @param max_distance Largest Hamming distance of a match, in bits
+    /// @param ratio The best distance of a row must be below ratio times its second best,
+    /// 1 or more disables the test
+    void configure(int max_distance, float ratio);
+
+    /// @brief Preallocates the buffers for up to count signatures of D bits per side
+    void reserve(int count, int D);
+
+    /// @brief Matches count1 signatures of D bits against count2 ones, as binarize() packs them
+    /// @param matches Cleared, then filled with (index1, index2) pairs in index1 order
+    void match(const uint8_t* signatures1, int count1, const uint8_t* signatures2, int count2, int D,
+               std::vector<std::pair<int, int>>& matches);
+
+private:
+    int m_max_distance = 0;
+    float m_ratio = 1.0f;
+
+    // Signatures with rows padded to 16 bytes with zeros, a whole NEON or SSE2 vector
+    std::vector<uint8_t> m_padded1;
+    std::vector<uint8_t> m_padded2;
+
+    // Closest row and its distance of every column
+    std::vector<int32_t> m_column_best;
+    std::vector<int32_t> m_column_index;
+    // Closest column of every row, -1 when it fails the thresholds
+    std::vector<int32_t> m_row_index;
+};
+
+/// @brief Where the keypoints of a frame are expected in the next one, as a homography
+/// acting on (x, y, 1). Pure camera rotations and small translations over a distant scene
+/// are both homographies, so one type covers the constant velocity and the IMU predictions
+struct MotionModel {
+    float h[9];
+
+    /// @brief No motion
+    static MotionModel identity();
+
+    /// @brief Constant velocity in the image: the median flow of the last matches carried
+    /// over to the next frame. No matches give identity
+    static MotionModel constant_velocity(const float* points1, const float* points2,
+                                         const std::vector<std::pair<int, int>>& matches);
+
+    /// @brief Pure rotation R of the camera between the frames, from the IMU: K R K^-1
+    /// @param rotation Row-major, rotates the rays of the first frame into the second
+    static MotionModel rotation(float fx, float fy, float cx, float cy, const float* rotation);
+
+    /// @brief Predicted positions of count interleaved (x, y) points
+    void predict(const float* points, int count, float* predicted) const;
+};
+
+/// @brief Mutual nearest neighbour matching restricted to pairs close to where the motion
+/// model puts them. The keypoints of the second frame are bucketed in a grid of radius
+/// sized cells and stored in cell order, so every keypoint of the first frame compares
+/// against the few cell runs around its prediction with the same int16 kernels as
+/// MutualMatcher. The result is the one of MutualMatcher over the pairs within radius,
+/// O(N k) instead of O(N^2). When fewer than min_matches come out, typically because the
+/// prediction was off, it falls back to MutualMatcher over all the pairs
+class GuidedMatcher {
+public:
+    /// @brief Most grid cells along a side. Points spread over more than that many radii
+    /// get cells larger than the radius, so the grid stays small whatever the points are
+    static const int MAX_GRID_SIDE = 256;
+
+    /// @param threshold As MutualMatcher::configure()
+    /// @param radius Search radius around the predicted positions, in the units of the points.
+    /// Must be positive and finite, otherwise every match() falls back to brute force
+    /// @param min_matches Fewer guided matches fall back to brute force
+    void configure(const Quantization& quantization, float threshold, float radius, int min_matches);
+
+    /// @brief Preallocates the buffers for up to count descriptors of depth D per side
+    void reserve(int count, int D);
+
+    /// @brief Matches the keypoints of the first frame against the ones of the second.
+    /// @param predicted1 Interleaved (x, y) of the first frame moved by MotionModel::predict().
+    /// Keypoints predicted at NaN or infinity, e.g. by a degenerate model, are left unmatched
+    /// @param points2 Interleaved (x, y) of the second frame, all finite
+    /// @param matches Cleared, then filled with (index1, index2) pairs in index1 order
+    /// @return false when it fell back to brute force
+    bool match(const uint8_t* descriptors1, const float* predicted1, int count1,
+               const uint8_t* descriptors2, const float* points2, int count2, int D,
+               std::vector<std::pair<int, int>>& matches);
+
+private:
+    Quantization m_quantization;
+    int32_t m_threshold = 1;
+    float m_radius = 16.0f;
+    int m_min_matches = 0;
+
+    MutualMatcher m_brute_force;
+
+    // Second frame in cell order: cell c holds the entries m_cell_start[c] to m_cell_start[c + 1]
+    std::vector<int32_t> m_cell_start;
+    std::vector<int32_t> m_cell_of;
+    std::vector<int32_t> m_sorted_index;
+    std::vector<float> m_sorted_points;
+    std::vector<int16_t> m_centered1;
+    std::vector<int16_t> m_sorted2;
+
+    std::vector<int32_t> m_column_best;
+    std::vector<int32_t> m_column_index;
+    std::vector<int32_t> m_row_index;
+};
+
+} // namespace dkd
+
+#endif // SLAM_DKD_MATCHER_H
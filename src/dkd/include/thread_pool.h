@@ -0,0 +1,120 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <stdint.h>
+
+
+// Small fork-join pool for splitting per frame work across the cores.
+// Workers are started once and sleep between the jobs, the calling thread
+// takes part in every job, so a pool of N threads spawns N - 1 workers.
+
+class ThreadPool {
+public:
+    explicit ThreadPool(int threads) {
+        for (int i = 1; i < threads; ++i) {
+            m_workers.emplace_back(&ThreadPool::worker_loop, this);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_start.notify_all();
+        for (std::thread& worker : m_workers) {
+            worker.join();
+        }
+    }
+
+    // Prevent copying
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of threads working on a job, the caller included
+    int size() const { return static_cast<int>(m_workers.size()) + 1; }
+
+    // Calls fn(task) for every task in [0, tasks) and blocks until all of them are done.
+    // Tasks are handed out dynamically, so their order and thread are not defined.
+    // The callable is used in place, a job does not allocate
+    template <typename Fn>
+    void parallel_for(int tasks, const Fn& fn) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_fn = &fn;
+            m_invoke = &invoke<Fn>;
+            m_tasks = tasks;
+            m_next.store(0);
+            m_active = static_cast<int>(m_workers.size());
+            ++m_generation;
+        }
+        m_start.notify_all();
+
+        run_tasks(&invoke<Fn>, &fn);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this]{ return m_active == 0; });
+        m_fn = nullptr;
+    }
+
+private:
+    typedef void (*Invoke)(const void* fn, int task);
+
+    template <typename Fn>
+    static void invoke(const void* fn, int task) {
+        (*static_cast<const Fn*>(fn))(task);
+    }
+
+    void run_tasks(Invoke invoke, const void* fn) {
+        for (int task = m_next.fetch_add(1); task < m_tasks; task = m_next.fetch_add(1)) {
+            invoke(fn, task);
+        }
+    }
+
+    void worker_loop() {
+        uint64_t generation = 0;
+        while (true) {
+            Invoke invoke;
+            const void* fn;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_start.wait(lock, [&]{ return m_stop || m_generation != generation; });
+                if (m_stop) {
+                    return;
+                }
+                generation = m_generation;
+                invoke = m_invoke;
+                fn = m_fn;
+            }
+
+            run_tasks(invoke, fn);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_active == 0) {
+                m_done.notify_one();
+            }
+        }
+    }
+
+private:
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+
+    // Current job
+    Invoke m_invoke = nullptr;
+    const void* m_fn = nullptr;
+    int m_tasks = 0;
+    std::atomic<int> m_next{0};
+    int m_active = 0;
+    uint64_t m_generation = 0;
+    bool m_stop = false;
+};
+
+#endif // THREAD_POOL_H
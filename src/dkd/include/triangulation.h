@@ -0,0 +1,44 @@
+#ifndef SLAM_DKD_TRIANGULATION_H
+#define SLAM_DKD_TRIANGULATION_H
+
+#include <vector>
+
+#include <Eigen/Dense>
+
+// Two view triangulation of a batch of matches, 4 at a time with NEON or SSE2,
+// DKD_DISABLE_SIMD forces scalar.
+
+namespace dkd {
+
+/// @brief World to camera pose [R | t], a world point X is at R X + t in the camera
+typedef Eigen::Matrix<float, 3, 4> CameraPose;
+
+/// @brief Triangulated matches, structure of arrays with an entry a match
+struct Triangulation {
+    // World points
+    std::vector<float> X, Y, Z;
+    // Along the optical axes of the two cameras, <= 0 behind one of them
+    std::vector<float> depth1, depth2;
+    // Angle between the two rays in radians, about 0 when they are too parallel to trust
+    // the depths
+    std::vector<float> parallax;
+    // Squared reprojection error in normalized coordinates, the larger of the two views
+    std::vector<float> error2;
+
+    void reserve(int count);
+    void resize(int count);
+};
+
+/// @brief Midpoint triangulation: the point halfway along the shortest segment between the
+/// two rays. Closed form with a 2x2 solve a match, so unlike the DLT (an SVD of a 4x4 a
+/// match) it runs in lanes across the matches. Parallel rays give non finite or zero
+/// parallax results, reject by parallax, depths and error2 instead of checking the inputs.
+/// Allocation free once points has the capacity
+/// @param x1, y1 Normalized coordinates (K^-1 of the pixels) in the first camera
+/// @param x2, y2 Same in the second camera
+void triangulate(const CameraPose& pose1, const CameraPose& pose2, const float* x1, const float* y1,
+                 const float* x2, const float* y2, int count, Triangulation& points);
+
+} // namespace dkd
+
+#endif // SLAM_DKD_TRIANGULATION_H
@@ -0,0 +1,148 @@
+#ifndef SLAM_DKD_VISUAL_ODOMETRY_H
+#define SLAM_DKD_VISUAL_ODOMETRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "dkd_kernels.h"
+#include "essential_ransac.h"
+#include "matcher.h"
+#include "triangulation.h"
+
+// Frame to frame monocular visual odometry on the DKD keypoints, so the drone sends its
+// pose every frame and the full features only on keyframes.
+
+namespace dkd {
+
+/// @brief Settings of VisualOdometry
+struct OdometrySettings {
+    // Mutual matching of the descriptors, dequantized similarity and ratio test
+    float match_threshold = 0.5f;
+    float match_ratio = 0.9f;
+    // Fewer inliers than this and tracking is lost
+    int min_inliers = 30;
+    // A new keyframe when the inliers drop under keyframe_inliers, every keyframe_interval
+    // frames at the latest, or once the camera turned keyframe_angle_deg since the last one
+    int keyframe_inliers = 60;
+    int keyframe_interval = 15;
+    float keyframe_angle_deg = 10.0f;
+    RansacSettings ransac;
+};
+
+/// @brief PosePacket::flags
+enum PoseFlags : uint8_t {
+    // The full features of the frame should be sent along
+    POSE_KEYFRAME = 1,
+    // No pose for this frame, the packet repeats the last one
+    POSE_LOST = 2,
+    // The scale of the motion is assumed, not measured: the steady speed of the first step, or
+    // of the last one before a loss, until the next keyframe
+    POSE_SCALE_RESET = 4,
+};
+
+/// @brief Pose of a frame as the drone sends it every frame
+struct PosePacket {
+    uint32_t frame_id;
+    uint8_t flags;
+    // Inliers of the pose, saturated at 255
+    uint8_t inliers;
+    // Camera to world rotation (w, x, y, z)
+    float q[4];
+    // Camera position in the world. Monocular, the unit is the length of the first step
+    float t[3];
+    // Variances of the pose in world axes: rotation x, y, z in rad^2, then position x, y, z.
+    // They add up from keyframe to keyframe like the drift, infinite when lost
+    float covariance[6];
+};
+
+/// @brief Bytes of a serialized PosePacket: sync word, the fields little endian and a CRC
+static const size_t POSE_PACKET_SIZE = 62;
+
+/// @brief Writes POSE_PACKET_SIZE bytes. The packet starts with 0xA5 0x5A and ends with the
+/// CRC-16/CCITT of everything in between, so a reader can find the next one in a stream
+void serialize(const PosePacket& packet, uint8_t* buffer);
+
+/// @brief Reads POSE_PACKET_SIZE bytes written by serialize()
+/// @return false on a bad sync word or CRC
+bool deserialize(const uint8_t* buffer, PosePacket& packet);
+
+/// @brief Matches every frame against the last keyframe (MutualMatcher with the ratio test),
+/// estimates the relative pose with EssentialRansac, PROSAC ordered by the keypoint ranks
+/// times the similarities, and triangulates the inliers. The length of the motion comes from
+/// the depths the keyframe got when it was made, so the trajectory keeps the scale of its
+/// first step until tracking is lost. Until the first keyframe after the origin, or after
+/// a loss, the speed is assumed steady. Against the keyframe rather than the previous frame the
+/// baseline grows between keyframes and the errors only add up once a keyframe: a 0.3 m
+/// step at 10 m is too short to pin the direction of the translation down.
+/// Keypoints must come in decreasing score order as DKD writes them, their rank stands in
+/// for the score
+class VisualOdometry {
+public:
+    VisualOdometry(const Intrinsics& intrinsics, const Quantization& quantization,
+                   const OdometrySettings& settings = OdometrySettings());
+
+    /// @brief Preallocates for up to count keypoints of depth D a frame
+    void reserve(int count, int D);
+
+    /// @brief Tracks a frame
+    /// @param points Interleaved (x, y) pixels of the keypoints
+    /// @param descriptors count x D row-major uint8 descriptors
+    /// @return true when the frame is a keyframe, POSE_KEYFRAME is set in the packet too
+    bool track(uint32_t frame_id, const float* points, const uint8_t* descriptors, int count, int D,
+               PosePacket& packet);
+
+    /// @brief Starts over from the identity pose with the next frame
+    void reset();
+
+    /// @brief Camera to world rotation and camera position of the last tracked frame
+    const Eigen::Matrix3f& rotation() const { return m_rotation; }
+    const Eigen::Vector3f& position() const { return m_position; }
+
+    const OdometrySettings& settings() const { return m_settings; }
+
+private:
+    // Fewer depths to compare than this and the scale of the motion is assumed
+    static const int MIN_SCALE_TRACKS = 8;
+
+    /// @brief Makes the frame the keyframe, with m_next_depths as its depths
+    void keep(const float* points, const uint8_t* descriptors, int count, int D);
+
+    /// @brief Fills the pose fields of the packet from the current pose
+    void fill(PosePacket& packet, const float* covariance) const;
+
+    Intrinsics m_intrinsics;
+    OdometrySettings m_settings;
+    MutualMatcher m_matcher;
+    EssentialRansac m_ransac;
+
+    // Keyframe, and the depths of its keypoints in its camera, <= 0 when unknown
+    std::vector<float> m_points;
+    std::vector<uint8_t> m_descriptors;
+    std::vector<float> m_depths;
+    int m_count = 0;
+    bool m_has_keyframe = false;
+    Eigen::Matrix3f m_keyframe_rotation = Eigen::Matrix3f::Identity();
+    Eigen::Vector3f m_keyframe_position = Eigen::Vector3f::Zero();
+    float m_keyframe_covariance[6] = {};
+    int m_since_keyframe = 0;
+
+    // Pose of the last frame and the length of its step
+    Eigen::Matrix3f m_rotation = Eigen::Matrix3f::Identity();
+    Eigen::Vector3f m_position = Eigen::Vector3f::Zero();
+    float m_step = 1.0f;
+
+    // Matches, their pixels, qualities, normalized coordinates and triangulation, one entry a match
+    std::vector<Match> m_matches;
+    std::vector<float> m_points1, m_points2, m_quality;
+    std::vector<float> m_x1, m_y1, m_x2, m_y2;
+    Triangulation m_triangulation;
+    std::vector<float> m_ratios;
+    std::vector<float> m_next_depths;
+};
+
+} // namespace dkd
+
+#endif // SLAM_DKD_VISUAL_ODOMETRY_H
@@ -0,0 +1,74 @@
+#include "budget_controller.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+BudgetController::BudgetController(const BudgetSettings& settings)
+    : m_settings(settings) {
+    m_settings.min_top_k = std::max(m_settings.min_top_k, 1);
+    m_settings.max_top_k = std::max(m_settings.max_top_k, m_settings.min_top_k);
+    m_settings.max_threshold = std::max(m_settings.max_threshold, m_settings.min_threshold);
+    m_settings.smoothing = std::min(std::max(m_settings.smoothing, 0.01), 1.0);
+
+    // Start from the full budget, the first reports cut it if it's too much
+    m_budget.top_k = m_settings.max_top_k;
+    m_budget.threshold = m_settings.min_threshold;
+}
+
+void BudgetController::report(const FrameStats& stats) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const BudgetSettings& s = m_settings;
+
+    double bytes_per_second = stats.interval_ms > 0.0 ? stats.bytes_sent * 1000.0 / stats.interval_ms : 0.0;
+    if (m_first_report) {
+        m_latency_ms = stats.latency_ms;
+        m_bytes_per_second = bytes_per_second;
+        m_first_report = false;
+    } else {
+        m_latency_ms += s.smoothing * (stats.latency_ms - m_latency_ms);
+        m_bytes_per_second += s.smoothing * (bytes_per_second - m_bytes_per_second);
+    }
+
+    // Worst of the limits, above one something falls behind
+    double latency_load = s.target_latency_ms > 0.0 ? m_latency_ms / s.target_latency_ms : 0.0;
+    double link_load = s.link_bytes_per_second > 0.0 ? m_bytes_per_second / s.link_bytes_per_second : 0.0;
+    double queue_load = static_cast<double>(stats.queue_depth) / std::max<size_t>(s.max_queue_depth, 1);
+    m_load = std::max(std::max(latency_load, link_load), queue_load);
+
+    // The smoothed measurements lag the budget by about 1 / smoothing frames. Cutting
+    // again before they catch up would react to the same overload twice
+    if (m_cooldown > 0) {
+        --m_cooldown;
+    }
+
+    if (m_load > 1.0) {
+        if (m_cooldown > 0) {
+            return;
+        }
+        if (m_budget.top_k > s.min_top_k) {
+            // Everything scales with the keypoint count, so cut it down to what fits right away
+            double factor = std::min(s.decrease, 1.0 / m_load);
+            m_budget.top_k = std::max(s.min_top_k, static_cast<int>(m_budget.top_k * factor));
+        } else {
+            m_budget.threshold = static_cast<uint8_t>(std::min<int>(m_budget.threshold + s.threshold_step, s.max_threshold));
+        }
+        m_cooldown = static_cast<int>(std::ceil(1.0 / s.smoothing));
+    } else if (m_load < s.headroom) {
+        if (m_budget.threshold > s.min_threshold) {
+            m_budget.threshold = static_cast<uint8_t>(std::max<int>(m_budget.threshold - s.threshold_step, s.min_threshold));
+        } else {
+            m_budget.top_k = std::min(s.max_top_k, m_budget.top_k + s.increase);
+        }
+    }
+}
+
+KeypointBudget BudgetController::budget() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_budget;
+}
+
+double BudgetController::load() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_load;
+}
@@ -0,0 +1,370 @@
+#include "bundle_adjustment.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace dkd {
+
+namespace {
+
+inline Eigen::Matrix3d skew(const Eigen::Vector3d& v) {
+    Eigen::Matrix3d m;
+    m << 0.0, -v.z(), v.y(),
+         v.z(), 0.0, -v.x(),
+         -v.y(), v.x(), 0.0;
+    return m;
+}
+
+// Rotation of the axis-angle vector w, Rodrigues
+inline Eigen::Matrix3d exp_so3(const Eigen::Vector3d& w) {
+    double angle = w.norm();
+    if (angle < 1e-12) {
+        return Eigen::Matrix3d::Identity() + skew(w);
+    }
+    return Eigen::AngleAxisd(angle, w / angle).toRotationMatrix();
+}
+
+} // namespace
+
+LocalBundleAdjuster::LocalBundleAdjuster(const CameraModel& camera, const BundleSettings& settings)
+    : m_camera(camera), m_settings(settings) {}
+
+bool LocalBundleAdjuster::project(const Eigen::Vector3d& point, Eigen::Vector2d& pixel) const {
+    if (point.z() < MIN_DEPTH) {
+        return false;
+    }
+    double x = point.x() / point.z();
+    double y = point.y() / point.z();
+    double r2 = x * x + y * y;
+    double f = 1.0 + r2 * (m_camera.k1 + r2 * (m_camera.k2 + r2 * m_camera.k3));
+    pixel.x() = m_camera.fx * f * x + m_camera.cx;
+    pixel.y() = m_camera.fy * f * y + m_camera.cy;
+    return true;
+}
+
+double LocalBundleAdjuster::cost(const BundleWindow& window, std::vector<double>* weights) const {
+    const double delta = m_settings.huber_px;
+    // A point behind a camera costs as much as a residual of BEHIND_PX. Far more than any
+    // outlier, or a point with a wrong observation and a short baseline steps through the
+    // camera and stays there, its residuals weighed out. Finite, so the rest of a window with
+    // such a point still improves
+    const double BEHIND_PX = 1e4;
+    double total = 0.0;
+    Eigen::Vector2d pixel;
+    for (size_t i = 0; i < window.observations.size(); i++) {
+        const Observation& o = window.observations[i];
+        Eigen::Vector3d pc = window.rotations[o.keyframe] * window.points[o.point] + window.translations[o.keyframe];
+        double s;
+        double w;
+        if (project(pc, pixel)) {
+            s = std::hypot(pixel.x() - o.x, pixel.y() - o.y);
+            w = s <= delta ? 1.0 : delta / s;
+        } else {
+            s = BEHIND_PX;
+            w = 0.0;
+        }
+        total += s <= delta ? s * s : 2.0 * delta * s - delta * delta;
+        if (weights) {
+            (*weights)[i] = w;
+        }
+    }
+    return 0.5 * total;
+}
+
+void LocalBundleAdjuster::prepare(const BundleWindow& window) {
+    const int keyframes = static_cast<int>(window.rotations.size());
+    const int points = static_cast<int>(window.points.size());
+    const int observations = static_cast<int>(window.observations.size());
+    m_fixed = std::min(std::max(m_settings.fixed_keyframes, 0), keyframes);
+    m_free = keyframes - m_fixed;
+
+    // Counting sort of the observations by point
+    m_point_start.assign(points + 1, 0);
+    for (const Observation& o : window.observations) {
+        m_point_start[o.point + 1]++;
+    }
+    for (int p = 0; p < points; p++) {
+        m_point_start[p + 1] += m_point_start[p];
+    }
+    m_by_point.resize(observations);
+    for (int i = 0; i < observations; i++) {
+        // m_point_start[p] walks to the end of p and is shifted back below
+        m_by_point[m_point_start[window.observations[i].point]++] = i;
+    }
+    for (int p = points; p > 0; p--) {
+        m_point_start[p] = m_point_start[p - 1];
+    }
+    m_point_start[0] = 0;
+
+    // A block for every free keyframe on the diagonal and every pair sharing a point, upper
+    // triangle only
+    m_slots.assign(m_free * m_free, -1);
+    m_pairs.clear();
+    for (int i = 0; i < m_free; i++) {
+        m_slots[i * m_free + i] = static_cast<int>(m_pairs.size());
+        m_pairs.push_back(std::make_pair(i, i));
+    }
+    m_free_index.resize(observations);
+    for (int n = 0; n < observations; n++) {
+        m_free_index[n] = std::max(window.observations[n].keyframe - m_fixed, -1);
+    }
+    for (int p = 0; p < points; p++) {
+        for (int a = m_point_start[p]; a < m_point_start[p + 1]; a++) {
+            int i = m_free_index[m_by_point[a]];
+            for (int b = a + 1; b < m_point_start[p + 1] && i >= 0; b++) {
+                int k = m_free_index[m_by_point[b]];
+                if (k < 0) {
+                    continue;
+                }
+                int lo = std::min(i, k);
+                int hi = std::max(i, k);
+                if (m_slots[lo * m_free + hi] < 0) {
+                    m_slots[lo * m_free + hi] = static_cast<int>(m_pairs.size());
+                    m_pairs.push_back(std::make_pair(lo, hi));
+                }
+            }
+        }
+    }
+
+    m_weights.resize(observations);
+    m_trial_weights.resize(observations);
+    m_U.resize(m_free);
+    m_bp.resize(m_free);
+    m_V.resize(points);
+    m_bx.resize(points);
+    m_W.resize(observations);
+    m_blocks.resize(m_pairs.size());
+    m_dp.resize(m_free);
+    m_dx.resize(points);
+    m_V_inverse.resize(points);
+    m_S.resize(6 * m_free, 6 * m_free);
+    m_rhs.resize(6 * m_free);
+    m_analyzed = false;
+}
+
+void LocalBundleAdjuster::linearize(const BundleWindow& window) {
+    for (int i = 0; i < m_free; i++) {
+        m_U[i].setZero();
+        m_bp[i].setZero();
+    }
+    for (size_t p = 0; p < window.points.size(); p++) {
+        m_V[p].setZero();
+        m_bx[p].setZero();
+    }
+
+    Eigen::Vector2d pixel;
+    for (size_t n = 0; n < window.observations.size(); n++) {
+        const Observation& o = window.observations[n];
+        m_W[n].setZero();
+        const Eigen::Matrix3d& R = window.rotations[o.keyframe];
+        Eigen::Vector3d pc = R * window.points[o.point] + window.translations[o.keyframe];
+        double w = m_weights[n];
+        if (w == 0.0 || !project(pc, pixel)) {
+            continue;
+        }
+        Eigen::Vector2d r(pixel.x() - o.x, pixel.y() - o.y);
+
+        // Pixel by the camera point: focal lengths, radial distortion, perspective division
+        double iz = 1.0 / pc.z();
+        double x = pc.x() * iz;
+        double y = pc.y() * iz;
+        double r2 = x * x + y * y;
+        double f = 1.0 + r2 * (m_camera.k1 + r2 * (m_camera.k2 + r2 * m_camera.k3));
+        double df = 2.0 * (m_camera.k1 + r2 * (2.0 * m_camera.k2 + 3.0 * r2 * m_camera.k3));
+        Eigen::Matrix2d distort;
+        distort << m_camera.fx * (f + df * x * x), m_camera.fx * df * x * y,
+                   m_camera.fy * df * x * y, m_camera.fy * (f + df * y * y);
+        Eigen::Matrix<double, 2, 3> divide;
+        divide << iz, 0.0, -x * iz,
+                  0.0, iz, -y * iz;
+        Eigen::Matrix<double, 2, 3> J = distort * divide;
+
+        // Point: the camera point moves by R dX
+        Eigen::Matrix<double, 2, 3> Jx = J * R;
+        m_V[o.point].noalias() += w * Jx.transpose() * Jx;
+        m_bx[o.point].noalias() -= w * Jx.transpose() * r;
+
+        int i = m_free_index[n];
+        if (i < 0) {
+            continue;
+        }
+        // Pose: exp(dtheta) Pc + dt moves the camera point by -[Pc]x dtheta + dt
+        Eigen::Matrix<double, 2, 6> Jp;
+        Jp.leftCols<3>().noalias() = -J * skew(pc);
+        Jp.rightCols<3>() = J;
+        m_U[i].noalias() += w * Jp.transpose() * Jp;
+        m_bp[i].noalias() -= w * Jp.transpose() * r;
+        m_W[n].noalias() = w * Jp.transpose() * Jx;
+    }
+}
+
+bool LocalBundleAdjuster::solve(double lambda) {
+    const int points = static_cast<int>(m_V.size());
+
+    // Marquardt damping scales the diagonal, with a floor for the blocks nothing constrains
+    for (size_t s = 0; s < m_pairs.size(); s++) {
+        int i = m_pairs[s].first;
+        if (i == m_pairs[s].second) {
+            m_blocks[s] = m_U[i];
+            m_blocks[s].diagonal() += lambda * m_U[i].diagonal().cwiseMax(1e-6);
+        } else {
+            m_blocks[s].setZero();
+        }
+    }
+    for (int i = 0; i < m_free; i++) {
+        m_rhs.segment<6>(6 * i) = m_bp[i];
+    }
+
+    // Schur complement of the points: S = U - W V^-1 W^T, rhs = bp - W V^-1 bx
+    for (int p = 0; p < points; p++) {
+        Eigen::Matrix3d V = m_V[p];
+        V.diagonal() += lambda * m_V[p].diagonal().cwiseMax(1e-6);
+        m_V_inverse[p] = V.inverse();
+        if (!m_V_inverse[p].allFinite()) {
+            return false;
+        }
+        Eigen::Vector3d v = m_V_inverse[p] * m_bx[p];
+        for (int a = m_point_start[p]; a < m_point_start[p + 1]; a++) {
+            int n = m_by_point[a];
+            int i = m_free_index[n];
+            if (i < 0) {
+                continue;
+            }
+            m_rhs.segment<6>(6 * i).noalias() -= m_W[n] * v;
+            Matrix63d WV = m_W[n] * m_V_inverse[p];
+            // Every ordered pair once: the cross terms land in the upper block, the same
+            // keyframe seeing a point twice adds both orders to its diagonal block
+            for (int b = m_point_start[p]; b < m_point_start[p + 1]; b++) {
+                int k = m_free_index[m_by_point[b]];
+                if (k < i) {
+                    continue;
+                }
+                m_blocks[m_slots[i * m_free + k]].noalias() -= WV * m_W[m_by_point[b]].transpose();
+            }
+        }
+    }
+
+    // SimplicialLDLT reads the lower triangle: the upper blocks go in transposed
+    m_triplets.clear();
+    for (size_t s = 0; s < m_pairs.size(); s++) {
+        int row = 6 * m_pairs[s].second;
+        int col = 6 * m_pairs[s].first;
+        bool diagonal = row == col;
+        for (int c = 0; c < 6; c++) {
+            for (int r = diagonal ? c : 0; r < 6; r++) {
+                m_triplets.push_back(Eigen::Triplet<double>(row + r, col + c, m_blocks[s](c, r)));
+            }
+        }
+    }
+    m_S.setFromTriplets(m_triplets.begin(), m_triplets.end());
+    // Same triplets every iteration, so the same pattern and ordering for the whole window
+    if (!m_analyzed) {
+        m_solver.analyzePattern(m_S);
+        m_analyzed = true;
+    }
+    m_solver.factorize(m_S);
+    if (m_solver.info() != Eigen::Success) {
+        return false;
+    }
+    Eigen::VectorXd steps = m_solver.solve(m_rhs);
+    if (m_solver.info() != Eigen::Success || !steps.allFinite()) {
+        return false;
+    }
+    for (int i = 0; i < m_free; i++) {
+        m_dp[i] = steps.segment<6>(6 * i);
+    }
+
+    // Back substitution: dx = V^-1 (bx - W^T dp)
+    for (int p = 0; p < points; p++) {
+        Eigen::Vector3d b = m_bx[p];
+        for (int a = m_point_start[p]; a < m_point_start[p + 1]; a++) {
+            int n = m_by_point[a];
+            int i = m_free_index[n];
+            if (i >= 0) {
+                b.noalias() -= m_W[n].transpose() * m_dp[i];
+            }
+        }
+        m_dx[p] = m_V_inverse[p] * b;
+    }
+    return true;
+}
+
+void LocalBundleAdjuster::update(BundleWindow& window) const {
+    for (int i = 0; i < m_free; i++) {
+        Eigen::Matrix3d dR = exp_so3(m_dp[i].head<3>());
+        window.rotations[m_fixed + i] = dR * window.rotations[m_fixed + i];
+        window.translations[m_fixed + i] = dR * window.translations[m_fixed + i] + m_dp[i].tail<3>();
+    }
+    // Depth is all a short baseline leaves a point, and the linearization says little about
+    // it: a step along it is held to a quarter of the depth, and a point the step still takes
+    // behind a camera that sees it stays where it is, rather than the whole step being
+    // rejected for a few points
+    for (size_t p = 0; p < window.points.size(); p++) {
+        if (m_point_start[p] == m_point_start[p + 1]) {
+            continue;
+        }
+        const Observation& o = window.observations[m_by_point[m_point_start[p]]];
+        double depth = window.rotations[o.keyframe].row(2).dot(window.points[p]) + window.translations[o.keyframe].z();
+        double scale = std::min(1.0, 0.25 * std::fabs(depth) / std::max(m_dx[p].norm(), 1e-12));
+        Eigen::Vector3d point = window.points[p] + scale * m_dx[p];
+        bool visible = true;
+        for (int a = m_point_start[p]; a < m_point_start[p + 1] && visible; a++) {
+            int k = window.observations[m_by_point[a]].keyframe;
+            visible = window.rotations[k].row(2).dot(point) + window.translations[k].z() >= MIN_DEPTH;
+        }
+        if (visible) {
+            window.points[p] = point;
+        }
+    }
+}
+
+BundleReport LocalBundleAdjuster::optimize(BundleWindow& window) {
+    auto start = std::chrono::steady_clock::now();
+    BundleReport report;
+
+    prepare(window);
+    double current = cost(window, &m_weights);
+    report.initial_cost = current;
+
+    double lambda = m_settings.initial_lambda;
+    bool stale = true;
+    for (int it = 0; it < m_settings.iterations && m_free > 0; it++) {
+        report.iterations++;
+        // A rejected step keeps the normal equations, only the damping changes
+        if (stale) {
+            linearize(window);
+            stale = false;
+        }
+        if (!solve(lambda)) {
+            lambda *= 10.0;
+            continue;
+        }
+        m_backup = window;
+        update(window);
+        double trial = cost(window, &m_trial_weights);
+        if (trial < current) {
+            current = trial;
+            m_weights.swap(m_trial_weights);
+            lambda = std::max(lambda * 0.1, 1e-9);
+            stale = true;
+            report.accepted++;
+        } else {
+            std::swap(window, m_backup);
+            lambda *= 10.0;
+        }
+    }
+    report.final_cost = current;
+
+    Eigen::Vector2d pixel;
+    for (const Observation& o : window.observations) {
+        Eigen::Vector3d pc = window.rotations[o.keyframe] * window.points[o.point] + window.translations[o.keyframe];
+        if (!project(pc, pixel) || std::hypot(pixel.x() - o.x, pixel.y() - o.y) > m_settings.huber_px) {
+            report.outliers++;
+        }
+    }
+    report.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return report;
+}
+
+} // namespace dkd
@@ -0,0 +1,291 @@
+#include "dkd.h"
+
+#include <assert.h>
+#include <cmath>
+#include <fstream>
+
+void DKD::set_threads(int threads) {
+    if (threads <= 1) {
+        m_pool.reset();
+        m_workspace.bands.clear();
+        return;
+    }
+    m_pool.reset(new ThreadPool(threads));
+    m_workspace.bands.resize(threads);
+    set_specialized_kernels(m_specialized);
+}
+
+void DKD::set_specialized_kernels(bool enable) {
+    m_specialized = enable;
+    m_workspace.local_max.set_specialized(enable);
+    for (Workspace::Band& band : m_workspace.bands) {
+        band.stream.set_specialized(enable);
+    }
+    m_soft_argmax.set_specialized(enable);
+}
+
+void DKD::set_score_quantization(const dkd::Quantization& quantization) {
+    m_quantization = quantization;
+    m_sigmoid.configure(m_quantization);
+    update_threshold();
+}
+
+void DKD::set_score_threshold(float score) {
+    m_threshold_units = ThresholdUnits::Score;
+    m_threshold_value = score;
+    update_threshold();
+}
+
+void DKD::set_probability_threshold(float probability) {
+    m_threshold_units = ThresholdUnits::Probability;
+    m_threshold_value = probability;
+    update_threshold();
+}
+
+void DKD::set_quantized_threshold(uint8_t threshold) {
+    m_threshold_units = ThresholdUnits::Quantized;
+    m_threshold_value = threshold;
+    update_threshold();
+}
+
+void DKD::update_threshold() {
+    switch (m_threshold_units) {
+    case ThresholdUnits::Quantized:
+        m_threshold = static_cast<uint8_t>(m_threshold_value);
+        break;
+    case ThresholdUnits::Score:
+        m_threshold = dkd::quantize_score_threshold(m_threshold_value, m_quantization);
+        break;
+    case ThresholdUnits::Probability:
+        m_threshold = m_sigmoid.threshold(m_threshold_value);
+        break;
+    }
+}
+
+void DKD::reserve(size_t D, size_t H, size_t W) {
+    int full_padding = m_padding + m_radius;
+    int h_start = full_padding;
+    int w_start = full_padding;
+    int h_stop = H - full_padding;
+    int w_stop = W - full_padding;
+    if (h_stop <= h_start || w_stop <= w_start) {
+        return;
+    }
+
+    // Every pixel of the window may be a candidate on a flat score map
+    size_t window = static_cast<size_t>(h_stop - h_start) * (w_stop - w_start);
+
+    Workspace& ws = m_workspace;
+    ws.local_max.reserve(W, m_radius);
+    ws.selector.reserve(window);
+    ws.grid_selector.reserve(window);
+    ws.grid_selector.reset(m_grid_cells_x, m_grid_cells_y, h_start, w_start, h_stop, w_stop);
+    int bands = static_cast<int>(ws.bands.size());
+    for (Workspace::Band& band : ws.bands) {
+        band.stream.reserve(W, m_radius);
+        band.candidates.reserve(((h_stop - h_start) / bands + 1) * static_cast<size_t>(w_stop - w_start));
+    }
+
+    // The descriptor depth doesn't matter, descriptors go straight into the outputs
+    (void)D;
+    ws.gather.reserve(m_top_k);
+    ws.bilinear_sampler.reserve(m_top_k);
+    ws.pixels.reserve(m_top_k);
+    ws.sample_points.reserve(2 * m_top_k);
+    ws.keypoints.reserve(2 * m_top_k);
+}
+
+int DKD::maxpool_detect_keypoints(const uint8_t* scores_map, int H, int W, int32_t* keypoints){
+    int full_padding = m_padding + m_radius;
+    int h_start = full_padding;
+    int w_start = full_padding;
+    int h_stop = H - full_padding;
+    int w_stop = W - full_padding;
+    // No pixel of the map is far enough from the borders, same check as reserve()
+    if (h_stop <= h_start || w_stop <= w_start) {
+        std::fill(keypoints, keypoints + 2 * m_top_k, -1);
+        return 0;
+    }
+
+    Workspace& ws = m_workspace;
+    bool grid = m_grid_cells_x * m_grid_cells_y > 1;
+    if (grid) {
+        ws.grid_selector.reset(m_grid_cells_x, m_grid_cells_y, h_start, w_start, h_stop, w_stop);
+    } else {
+        ws.selector.clear();
+    }
+    auto select = [&](int x, int y, uint8_t score) {
+        if (grid) {
+            ws.grid_selector.push(x, y, score);
+        } else {
+            ws.selector.push(x, y, score);
+        }
+    };
+
+    if (m_pool) {
+        // Every band runs the NMS over its own rows, reading r rows of halo above and
+        // below straight from the shared map
+        int bands = static_cast<int>(ws.bands.size());
+        m_pool->parallel_for(bands, [&](int index) {
+            Workspace::Band& band = ws.bands[index];
+            band.candidates.clear();
+            int band_start = h_start + (h_stop - h_start) * index / bands;
+            int band_stop = h_start + (h_stop - h_start) * (index + 1) / bands;
+            if (band_start == band_stop) {
+                return;
+            }
+            dkd::detect_local_maxima(
+                band.stream, scores_map, W,
+                band_start, w_start,
+                band_stop, w_stop,
+                m_radius, m_threshold, [&band](int x, int y, uint8_t) {
+                    band.candidates.push_back(static_cast<uint32_t>(y) << 16 | static_cast<uint32_t>(x));
+                }
+            );
+        });
+
+        // Bands are consecutive rows, merged in order they keep the raster order of the
+        // single threaded pass, so the selection is the same
+        for (const Workspace::Band& band : ws.bands) {
+            for (uint32_t packed : band.candidates) {
+                int x = packed & 0xffff;
+                int y = packed >> 16;
+                select(x, y, scores_map[y * W + x]);
+            }
+        }
+    } else {
+        // Local maxima above the threshold go straight into the selector, streamed row by row
+        dkd::detect_local_maxima(
+            ws.local_max, scores_map, W,
+            h_start, w_start,
+            h_stop, w_stop,
+            m_radius, m_threshold, select
+        );
+    }
+
+    // Select top k keypoints by their value in the score map, best first.
+    // Frames with less than k candidates get their tail rows padded with -1
+    int count = grid ? ws.grid_selector.select(m_top_k, keypoints) : ws.selector.select(m_top_k, keypoints);
+    std::fill(keypoints + 2 * count, keypoints + 2 * m_top_k, -1);
+
+    if (m_subpixel) {
+        if (m_soft_argmax.radius() != m_radius || m_soft_argmax_temperature != m_subpixel_temperature) {
+            m_soft_argmax.configure(m_radius, m_subpixel_temperature);
+            m_soft_argmax_temperature = m_subpixel_temperature;
+        }
+        // The neighbourhoods were just streamed through the NMS, so they are still in cache
+        m_soft_argmax.refine(scores_map, W, keypoints, count, keypoints);
+    }
+
+    return count;
+}
+
+void DKD::prepare_sample_points(const int32_t* keypoints, int H, int W) {
+    // Q8 coordinates of every keypoint, -1 gets a zero descriptor
+    // The height only bounds the keypoints in the assert below
+    (void)H;
+    Workspace& ws = m_workspace;
+    ws.sample_points.resize(2 * m_top_k);
+    ws.pixels.resize(m_top_k);
+    for (int i = 0; i < m_top_k; ++i) {
+        int x = keypoints[2 * i];
+        int y = keypoints[2 * i + 1];
+        ws.sample_points[2 * i] = ws.sample_points[2 * i + 1] = -1;
+        ws.pixels[i] = -1;
+
+        // Padding of frames with less than top k keypoints
+        if (x < 0 && y < 0) {
+            continue;
+        }
+
+        if (!m_subpixel) {
+            x <<= dkd::SUBPIXEL_BITS;
+            y <<= dkd::SUBPIXEL_BITS;
+        }
+
+        // Detection keeps the padding plus the radius off the borders and refinement moves a
+        // keypoint by at most the radius, so every keypoint is inside the map
+        assert(x >= 0 && x <= (W - 1) << dkd::SUBPIXEL_BITS && y >= 0 && y <= (H - 1) << dkd::SUBPIXEL_BITS);
+        const int half = 1 << (dkd::SUBPIXEL_BITS - 1);
+        ws.sample_points[2 * i] = x;
+        ws.sample_points[2 * i + 1] = y;
+        ws.pixels[i] = ((y + half) >> dkd::SUBPIXEL_BITS) * W + ((x + half) >> dkd::SUBPIXEL_BITS);
+    }
+}
+
+void DKD::sample_descriptors(const uint8_t* descriptor_map, const int32_t* keypoints, int D, int H, int W,
+                             uint8_t* descriptors) {
+    Workspace& ws = m_workspace;
+    prepare_sample_points(keypoints, H, W);
+    if (m_bilinear) {
+        ws.bilinear_sampler.sample(descriptor_map, m_descriptor_layout, D, H, W,
+                                   ws.sample_points.data(), m_top_k, descriptors);
+    } else {
+        ws.gather.gather(descriptor_map, m_descriptor_layout, D, H, W, ws.pixels.data(), m_top_k, descriptors);
+    }
+}
+
+void DKD::export_keypoints(Eigen::MatrixXi& keypoints) const {
+    // Column-major, as written to the keypoints files
+    keypoints.resize(m_top_k, 2);
+    for (int i = 0; i < m_top_k; ++i) {
+        keypoints(i, 0) = m_workspace.keypoints[2 * i];
+        keypoints(i, 1) = m_workspace.keypoints[2 * i + 1];
+    }
+}
+
+int DKD::run_into(const uint8_t* scores_map, const uint8_t* descriptor_map,
+        int32_t* keypoints, uint8_t* descriptors, size_t D, size_t H, size_t W){
+
+    // Extract keypoints' UVs
+    int count = maxpool_detect_keypoints(scores_map, H, W, keypoints);
+
+    // Sample descriptors using UVs
+    sample_descriptors(descriptor_map, keypoints, D, H, W, descriptors);
+    return count;
+}
+
+void DKD::run(const uint8_t* scores_map, const uint8_t* descriptor_map,
+        Eigen::MatrixXi& keypoints, Eigen::Matrix<uint8_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>& descriptors,
+        // Eigen::MatrixXi& keypoints, Eigen::MatrixXf& descriptors,
+        size_t D, size_t H, size_t W){
+
+    m_workspace.keypoints.resize(2 * m_top_k);
+    descriptors.resize(m_top_k, D);
+    run_into(scores_map, descriptor_map, m_workspace.keypoints.data(), descriptors.data(), D, H, W);
+    export_keypoints(keypoints);
+    //descriptors.rowwise().normalize();
+}
+
+void DKD::run(const uint8_t* scores_map, const uint8_t* descriptor_map,
+        Eigen::MatrixXi& keypoints, Eigen::Matrix<int16_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>& descriptors,
+        size_t D, size_t H, size_t W){
+
+    Workspace& ws = m_workspace;
+    ws.keypoints.resize(2 * m_top_k);
+    maxpool_detect_keypoints(scores_map, H, W, ws.keypoints.data());
+    export_keypoints(keypoints);
+
+    // Always interpolated, right on a pixel it's just the value with the extra bits
+    prepare_sample_points(ws.keypoints.data(), H, W);
+    descriptors.resize(m_top_k, D);
+    ws.bilinear_sampler.sample(descriptor_map, m_descriptor_layout, D, H, W,
+                               ws.sample_points.data(), m_top_k, descriptors.data());
+}
+
+void DKD::run(const uint8_t* scores_map, const uint8_t* descriptor_map,
+        Eigen::MatrixXi& keypoints, Eigen::MatrixXf& descriptors,
+        size_t D, size_t H, size_t W){
+
+    Workspace& ws = m_workspace;
+    ws.keypoints.resize(2 * m_top_k);
+    ws.descriptors.resize(m_top_k * D);
+    run_into(scores_map, descriptor_map, ws.keypoints.data(), ws.descriptors.data(), D, H, W);
+    export_keypoints(keypoints);
+
+    Eigen::Map<const Eigen::Matrix<uint8_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> quantized(
+        ws.descriptors.data(), m_top_k, D);
+    descriptors = quantized.cast<float>();
+    // Zero rows of the padding stay zero
+    descriptors.rowwise().normalize();
+}
@@ -0,0 +1,1468 @@
+// Host side microbenchmarks for the DKD kernels.
+// Every kernel is timed against the implementation it replaces, kept in dkd_reference.cpp.
+// dkd_tests checks they produce the same output, this only reports how long they take.
+//
+// Usage: dkd_bench [section]
+//        dkd_bench replay [-D depth] [-H height] [-W width] dump...
+//        dkd_bench recall [-D depth] [-t threshold] data_folder
+//        dkd_bench sampling [-D depth] [-t threshold] [-s subpixel_bits] data_folder
+//
+// replay runs the deployment DKD over recorded dumps and reports ns/frame and a hash
+// of the output per dump. A dump is either a raw feature map, (D + 1) x H x W uint8 as
+// slam_service -d writes it, or a scoremap alone, H x W uint8 like the .hm files.
+//
+// recall matches consecutive frames of the descriptors_N.bin files slam_service writes,
+// with the float matcher and with the binary signatures of slam_service -b, and reports
+// how many of the float matches the signatures find for a range of Hamming settings.
+//
+// sampling estimates the relative pose of consecutive frames of the keypoints_N.bin and
+// descriptors_N.bin files with uniform and with PROSAC sampling and reports the iterations
+// each takes to the hypothesis it returns. The files keep no scores, keypoints come out
+// of DKD by decreasing score so their rank stands in for it.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <stdlib.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <random>
+
+#include <Eigen/Dense>
+
+#include "dkd_kernels.h"
+#include "dkd.h"
+#include "budget_controller.h"
+#include "matcher.h"
+#include "essential_ransac.h"
+#include "visual_odometry.h"
+#include "triangulation.h"
+#include "bundle_adjustment.h"
+#include "dkd_reference.h"
+
+/*
+* Helpers
+*/
+
+// Average wall time of a single call in microseconds
+static double time_us(const std::function<void()>& fn, int iterations) {
+    fn(); // warm up caches and scratch buffers
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        fn();
+    }
+    auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(stop - start).count() / iterations;
+}
+
+// Evicts the feature map from the caches, like a fresh NPU output
+static void flush_caches() {
+    static std::vector<uint8_t> junk(32 << 20);
+    for (size_t i = 0; i < junk.size(); i += 64) {
+        junk[i]++;
+    }
+}
+
+// Average wall time of a single call with cold caches, the flush is not timed
+static double time_cold_us(const std::function<void()>& fn, int iterations) {
+    double total = 0.0;
+    for (int i = 0; i < iterations; ++i) {
+        flush_caches();
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        auto stop = std::chrono::steady_clock::now();
+        total += std::chrono::duration<double, std::micro>(stop - start).count();
+    }
+    return total / iterations;
+}
+
+static float median(std::vector<float>& values) {
+    if (values.empty()) return 180.0f;
+    std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+    return values[values.size() / 2];
+}
+
+/*
+* Benchmarks
+*/
+
+static void bench_maxpool() {
+    const int padding = 2;
+    std::vector<uint8_t> scores = make_scoremap(MAP_H, MAP_W, 42);
+    Eigen::Map<const MatrixU8> scores_mat(scores.data(), MAP_H, MAP_W);
+
+    printf("maxpool2d, %dx%d scoremap, padding %d\n", MAP_W, MAP_H, padding);
+    printf("%8s %16s %16s %10s\n", "radius", "reference us", "separable us", "speedup");
+
+    for (int radius = 1; radius <= 8; ++radius) {
+        int full_padding = padding + radius;
+        int h_start = full_padding, w_start = full_padding;
+        int h_stop = MAP_H - full_padding, w_stop = MAP_W - full_padding;
+
+        MatrixU8 reference;
+        double reference_us = time_us([&]() {
+            // The old code took an Eigen matrix, so the copy of the map is part of its cost
+            reference = maxpool2d_reference(scores_mat, h_start, w_start, h_stop, w_stop, radius, 1);
+        }, 20);
+
+        std::vector<uint8_t> pooled(MAP_H * MAP_W, 0);
+        std::vector<uint8_t> scratch;
+        double fast_us = time_us([&]() {
+            maxpool2d_separable(scores.data(), pooled.data(), MAP_W,
+                                h_start, w_start, h_stop, w_stop, radius, scratch);
+        }, 200);
+
+        printf("%8d %16.1f %16.1f %9.1fx\n", radius, reference_us, fast_us, reference_us / fast_us);
+    }
+    printf("\n");
+}
+
+static void bench_nms() {
+    const int padding = 4;
+    std::vector<uint8_t> scores = make_scoremap(MAP_H, MAP_W, 7);
+
+#if defined(DKD_DISABLE_SIMD)
+    const char* backend = "scalar";
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    const char* backend = "neon";
+#elif defined(__SSE2__)
+    const char* backend = "sse2";
+#else
+    const char* backend = "scalar";
+#endif
+
+    printf("local maxima mask (%s), %dx%d scoremap, padding %d, threshold 127\n", backend, MAP_W, MAP_H, padding);
+    printf("%8s %16s %16s %10s %12s\n", "radius", "eigen masks us", "packed mask us", "speedup", "candidates");
+
+    const int radii[] = {1, 2, 4, 8};
+    for (int radius : radii) {
+        int full_padding = padding + radius;
+        int h_start = full_padding, w_start = full_padding;
+        int h_stop = MAP_H - full_padding, w_stop = MAP_W - full_padding;
+
+        std::vector<uint8_t> pooled, pool_scratch;
+        std::vector<int> reference;
+        double reference_us = time_us([&]() {
+            local_maxima_reference(scores.data(), MAP_H, MAP_W, radius, padding, pooled, pool_scratch, reference);
+        }, 100);
+
+        std::vector<uint8_t> mask(MAP_H * dkd::nms_mask_stride(MAP_W), 0);
+        dkd::LocalMaxStream stream;
+        std::vector<int> candidates;
+        candidates.reserve(reference.size());
+        double fast_us = time_us([&]() {
+            nms_mask(scores.data(), MAP_W, h_start, w_start, h_stop, w_stop,
+                     radius, 127, mask.data(), stream);
+            candidates.clear();
+            for_each_mask_bit(mask.data(), MAP_W, h_start, h_stop, [&](int x, int y) {
+                candidates.push_back(y * MAP_W + x);
+            });
+        }, 1000);
+
+        printf("%8d %16.1f %16.1f %9.1fx %12zu\n", radius, reference_us, fast_us, reference_us / fast_us,
+               candidates.size());
+    }
+    printf("\n");
+}
+
+static void bench_fused() {
+    const int padding = 4;
+    std::vector<uint8_t> scores = make_scoremap(MAP_H, MAP_W, 11);
+
+    printf("fused candidate extraction, %dx%d scoremap, padding %d, threshold 127\n", MAP_W, MAP_H, padding);
+    printf("%8s %16s %16s %10s %16s %16s\n", "radius", "eigen masks us", "fused us", "speedup",
+           "eigen bytes", "fused bytes");
+
+    const int radii[] = {1, 2, 4, 8};
+    for (int radius : radii) {
+        int full_padding = padding + radius;
+        int h_start = full_padding, w_start = full_padding;
+        int h_stop = MAP_H - full_padding, w_stop = MAP_W - full_padding;
+
+        std::vector<uint8_t> pooled, pool_scratch;
+        std::vector<int> reference;
+        double reference_us = time_us([&]() {
+            local_maxima_reference(scores.data(), MAP_H, MAP_W, radius, padding, pooled, pool_scratch, reference);
+        }, 100);
+        // Pooled map, bool and uint8 masks plus the maxpool scratch
+        size_t reference_bytes = 3 * pooled.size() + pool_scratch.size();
+
+        dkd::LocalMaxStream stream;
+        std::vector<int> candidates;
+        candidates.reserve(reference.size());
+        double fused_us = time_us([&]() {
+            candidates.clear();
+            dkd::detect_local_maxima(stream, scores.data(), MAP_W, h_start, w_start, h_stop, w_stop,
+                                     radius, 127, [&](int x, int y, uint8_t) {
+                candidates.push_back(y * MAP_W + x);
+            });
+        }, 1000);
+
+        printf("%8d %16.1f %16.1f %9.1fx %16zu %16zu\n", radius, reference_us, fused_us, reference_us / fused_us,
+               reference_bytes, stream.working_set());
+    }
+    printf("\n");
+}
+
+static void bench_topk() {
+    // Dense map with radius 1 to get more candidates than the largest k
+    const int padding = 2, radius = 1;
+    const int full_padding = padding + radius;
+    std::vector<uint8_t> scores = make_scoremap(2 * MAP_H, 2 * MAP_W, 23);
+    const int H = 2 * MAP_H, W = 2 * MAP_W;
+
+    std::vector<int> candidates;
+    dkd::LocalMaxStream stream;
+    dkd::detect_local_maxima(stream, scores.data(), W, full_padding, full_padding, H - full_padding, W - full_padding,
+                             radius, 127, [&](int x, int y, uint8_t) { candidates.push_back(y * W + x); });
+
+    printf("top k selection, %zu candidates\n", candidates.size());
+    printf("%8s %16s %16s %10s\n", "k", "heap us", "histogram us", "speedup");
+
+    const int ks[] = {200, 500, 2000};
+    for (int k : ks) {
+        typedef Eigen::Matrix<int, Eigen::Dynamic, 2, Eigen::RowMajor> Keypoints;
+        Keypoints reference(k, 2);
+        double reference_us = time_us([&]() {
+            top_k_reference(scores.data(), H, W, candidates, k, reference);
+        }, 100);
+
+        // Pushing is part of the cost, the heap did its work while the candidates came in
+        dkd::HistogramTopK selector;
+        Keypoints selected(k, 2);
+        double fast_us = time_us([&]() {
+            selector.clear();
+            for (int index : candidates) {
+                selector.push(index % W, index / W, scores[index]);
+            }
+            selector.select(k, selected.data());
+        }, 100);
+
+        printf("%8d %16.1f %16.1f %9.1fx\n", k, reference_us, fast_us, reference_us / fast_us);
+    }
+    printf("\n");
+}
+
+static void bench_grid() {
+    const int padding = 4, radius = 1;
+    const int full_padding = padding + radius;
+    const int h_start = full_padding, w_start = full_padding;
+    const int h_stop = MAP_H - full_padding, w_stop = MAP_W - full_padding;
+    const int cells_x = 8, cells_y = 5;
+
+    // Texture only in the left third of the frame, the case the grid is made for
+    std::vector<uint8_t> scores = make_scoremap(MAP_H, MAP_W, 5);
+    for (int y = 0; y < MAP_H; ++y) {
+        for (int x = 0; x < MAP_W; ++x) {
+            uint8_t& score = scores[y * MAP_W + x];
+            if (x > MAP_W / 3) score = static_cast<uint8_t>(score / 2 + 64);
+        }
+    }
+
+    std::vector<int> candidates;
+    dkd::LocalMaxStream stream;
+    dkd::detect_local_maxima(stream, scores.data(), MAP_W, h_start, w_start, h_stop, w_stop,
+                             radius, 127, [&](int x, int y, uint8_t) { candidates.push_back(y * MAP_W + x); });
+
+    printf("grid top k selection, %dx%d cells, %zu candidates\n", cells_x, cells_y, candidates.size());
+    printf("%8s %16s %16s %14s %14s\n", "k", "global us", "grid us", "global cells", "grid cells");
+
+    // Number of cells with at least one selected keypoint
+    auto occupied = [&](const int32_t* xy, int count) {
+        std::vector<bool> used(cells_x * cells_y, false);
+        for (int i = 0; i < count; ++i) {
+            int cx = (xy[2 * i] - w_start) * cells_x / (w_stop - w_start);
+            int cy = (xy[2 * i + 1] - h_start) * cells_y / (h_stop - h_start);
+            used[cy * cells_x + cx] = true;
+        }
+        return static_cast<int>(std::count(used.begin(), used.end(), true));
+    };
+
+    const int ks[] = {50, 100, 200};
+    for (int k : ks) {
+        std::vector<int32_t> global_xy(2 * k), grid_xy(2 * k);
+        dkd::HistogramTopK global;
+        int global_count = 0;
+        double global_us = time_us([&]() {
+            global.clear();
+            for (int index : candidates) {
+                global.push(index % MAP_W, index / MAP_W, scores[index]);
+            }
+            global_count = global.select(k, global_xy.data());
+        }, 200);
+
+        dkd::GridTopK grid;
+        int grid_count = 0;
+        double grid_us = time_us([&]() {
+            grid.reset(cells_x, cells_y, h_start, w_start, h_stop, w_stop);
+            for (int index : candidates) {
+                grid.push(index % MAP_W, index / MAP_W, scores[index]);
+            }
+            grid_count = grid.select(k, grid_xy.data());
+        }, 200);
+
+        printf("%8d %16.1f %16.1f %14d %14d\n", k, global_us, grid_us,
+               occupied(global_xy.data(), global_count), occupied(grid_xy.data(), grid_count));
+    }
+    printf("\n");
+}
+
+static void bench_subpixel() {
+    const int padding = 4, top_k = 200;
+    const float temperature = 3.0f;
+    std::vector<uint8_t> scores = make_scoremap(MAP_H, MAP_W, 13);
+
+    printf("soft-argmax refinement, %d keypoints, temperature %.1f\n", top_k, temperature);
+    printf("%8s %16s %16s %10s %16s\n", "radius", "expf us", "lut us", "speedup", "max error px");
+
+    const int radii[] = {1, 2, 4};
+    for (int radius : radii) {
+        int full_padding = padding + radius;
+        dkd::LocalMaxStream stream;
+        dkd::HistogramTopK selector;
+        dkd::detect_local_maxima(stream, scores.data(), MAP_W, full_padding, full_padding,
+                                 MAP_H - full_padding, MAP_W - full_padding, radius, 127,
+                                 [&](int x, int y, uint8_t score) { selector.push(x, y, score); });
+        std::vector<int32_t> xy(2 * top_k);
+        int count = selector.select(top_k, xy.data());
+
+        std::vector<float> reference(2 * count);
+        double reference_us = time_us([&]() {
+            soft_argmax_reference(scores.data(), MAP_W, xy.data(), count, radius, temperature, reference.data());
+        }, 200);
+
+        dkd::SoftArgmax soft_argmax;
+        soft_argmax.configure(radius, temperature);
+        std::vector<int32_t> refined(2 * count);
+        double fast_us = time_us([&]() {
+            soft_argmax.refine(scores.data(), MAP_W, xy.data(), count, refined.data());
+        }, 200);
+
+        float max_error = 0.0f;
+        for (int i = 0; i < 2 * count; ++i) {
+            max_error = std::max(max_error, std::fabs(refined[i] / float(1 << dkd::SUBPIXEL_BITS) - reference[i]));
+        }
+        printf("%8d %16.1f %16.1f %9.1fx %16.5f\n", radius, reference_us, fast_us, reference_us / fast_us, max_error);
+    }
+    printf("\n");
+}
+
+static void bench_threads() {
+    const int D = 96;
+    std::vector<uint8_t> feature_map(static_cast<size_t>(D + 1) * MAP_H * MAP_W);
+    std::vector<uint8_t> scores = make_scoremap(MAP_H, MAP_W, 17);
+    for (size_t i = 0; i < static_cast<size_t>(D) * MAP_H * MAP_W; ++i) {
+        feature_map[i] = static_cast<uint8_t>(i * 2654435761u >> 24);
+    }
+    std::copy(scores.begin(), scores.end(), feature_map.begin() + static_cast<size_t>(D) * MAP_H * MAP_W);
+    const uint8_t* scores_map = feature_map.data() + static_cast<size_t>(D) * MAP_H * MAP_W;
+
+    printf("tiled DKD::run, top k 200, radius 1, padding 4, %u hardware threads\n", std::thread::hardware_concurrency());
+    printf("%8s %10s %16s %10s\n", "threads", "grid", "run us", "speedup");
+
+    const bool grids[] = {false, true};
+    for (bool grid : grids) {
+        double single_us = 0.0;
+
+        const int threads[] = {1, 2, 4};
+        for (int thread_count : threads) {
+            DKD dkd(200, 1, 4);
+            if (grid) {
+                dkd.set_grid_cells(8, 5);
+            }
+            dkd.set_subpixel_refinement(true);
+            dkd.set_threads(thread_count);
+
+            Eigen::MatrixXi keypoints;
+            MatrixU8 descriptors;
+            double run_us = time_us([&]() {
+                dkd.run(scores_map, feature_map.data(), keypoints, descriptors, D, MAP_H, MAP_W);
+            }, 200);
+            if (thread_count == 1) {
+                single_us = run_us;
+            }
+            printf("%8d %10s %16.1f %9.2fx\n", thread_count, grid ? "8x5" : "off", run_us, single_us / run_us);
+        }
+    }
+    printf("\n");
+}
+
+static void bench_gather() {
+    const int D = 96, padding = 4, radius = 1;
+    const int full_padding = padding + radius;
+    const size_t plane_size = static_cast<size_t>(MAP_H) * MAP_W;
+    std::vector<uint8_t> chw(D * plane_size), hwc(D * plane_size);
+    for (size_t i = 0; i < chw.size(); ++i) {
+        chw[i] = static_cast<uint8_t>(i * 2654435761u >> 24);
+    }
+    for (int d = 0; d < D; ++d) {
+        for (size_t p = 0; p < plane_size; ++p) {
+            hwc[p * D + d] = chw[d * plane_size + p];
+        }
+    }
+    std::vector<uint8_t> scores = make_scoremap(MAP_H, MAP_W, 19);
+
+    printf("descriptor gather, %dx%dx%d map, caches flushed before every call\n", D, MAP_H, MAP_W);
+    printf("%8s %16s %16s %16s\n", "k", "eigen cols us", "chw gather us", "hwc gather us");
+
+    const int ks[] = {100, 200, 500};
+    for (int k : ks) {
+        dkd::LocalMaxStream stream;
+        dkd::HistogramTopK selector;
+        dkd::detect_local_maxima(stream, scores.data(), MAP_W, full_padding, full_padding,
+                                 MAP_H - full_padding, MAP_W - full_padding, radius, 127,
+                                 [&](int x, int y, uint8_t score) { selector.push(x, y, score); });
+        std::vector<int32_t> xy(2 * k);
+        int count = selector.select(k, xy.data());
+        xy.resize(2 * count);
+        std::vector<int32_t> pixels(count);
+        for (int i = 0; i < count; ++i) {
+            pixels[i] = xy[2 * i + 1] * MAP_W + xy[2 * i];
+        }
+
+        MatrixU8 reference;
+        double reference_us = time_cold_us([&]() {
+            sample_descriptors_reference(chw.data(), xy, D, MAP_H, MAP_W, reference);
+        }, 50);
+
+        dkd::DescriptorGather gather;
+        MatrixU8 chw_out(count, D), hwc_out(count, D);
+        double chw_us = time_cold_us([&]() {
+            gather.gather(chw.data(), dkd::DescriptorLayout::CHW, D, MAP_H, MAP_W, pixels.data(), count, chw_out.data());
+        }, 50);
+        double hwc_us = time_cold_us([&]() {
+            gather.gather(hwc.data(), dkd::DescriptorLayout::HWC, D, MAP_H, MAP_W, pixels.data(), count, hwc_out.data());
+        }, 50);
+
+        printf("%8d %16.1f %16.1f %16.1f\n", count, reference_us, chw_us, hwc_us);
+    }
+    printf("\n");
+}
+
+static void bench_bilinear() {
+    const int D = 96, padding = 4, radius = 1, top_k = 200;
+    const int full_padding = padding + radius;
+    const size_t plane_size = static_cast<size_t>(MAP_H) * MAP_W;
+    std::vector<uint8_t> chw(D * plane_size), hwc(D * plane_size);
+    // Smooth planes, like the real descriptor maps, with a bit of noise
+    for (int d = 0; d < D; ++d) {
+        for (size_t p = 0; p < plane_size; ++p) {
+            int x = p % MAP_W, y = p / MAP_W;
+            float value = 128.0f + 100.0f * std::sin(0.002f * (d + 1) * x + 0.01f * y) + (static_cast<uint32_t>(p) * 2654435761u >> 29);
+            chw[d * plane_size + p] = static_cast<uint8_t>(std::min(255.0f, std::max(0.0f, value)));
+        }
+    }
+    for (int d = 0; d < D; ++d) {
+        for (size_t p = 0; p < plane_size; ++p) {
+            hwc[p * D + d] = chw[d * plane_size + p];
+        }
+    }
+
+    // Refined keypoints of a real detection run
+    std::vector<uint8_t> scores = make_scoremap(MAP_H, MAP_W, 29);
+    dkd::LocalMaxStream stream;
+    dkd::HistogramTopK selector;
+    dkd::detect_local_maxima(stream, scores.data(), MAP_W, full_padding, full_padding,
+                             MAP_H - full_padding, MAP_W - full_padding, radius, 127,
+                             [&](int x, int y, uint8_t score) { selector.push(x, y, score); });
+    std::vector<int32_t> xy_q8(2 * top_k);
+    int count = selector.select(top_k, xy_q8.data());
+    xy_q8.resize(2 * count);
+    // Random sub-pixel offsets within half a pixel, the soft-argmax ones are tiny on this map
+    for (int i = 0; i < 2 * count; ++i) {
+        xy_q8[i] = (xy_q8[i] << dkd::SUBPIXEL_BITS) + static_cast<int>((i * 2654435761u >> 24) % 256) - 128;
+    }
+    std::vector<int32_t> pixels(count);
+    for (int i = 0; i < count; ++i) {
+        pixels[i] = ((xy_q8[2 * i + 1] + 128) >> 8) * MAP_W + ((xy_q8[2 * i] + 128) >> 8);
+    }
+
+    Eigen::MatrixXf reference;
+    sample_bilinear_reference(chw.data(), xy_q8, D, MAP_H, MAP_W, reference);
+
+    printf("bilinear descriptor sampling, %d keypoints, %dx%dx%d map\n", count, D, MAP_H, MAP_W);
+    printf("%8s %8s %16s %16s %16s %16s\n", "layout", "output", "nearest us", "bilinear us", "max error", "mean error");
+
+    const dkd::DescriptorLayout layouts[] = {dkd::DescriptorLayout::CHW, dkd::DescriptorLayout::HWC};
+    for (dkd::DescriptorLayout layout : layouts) {
+        const uint8_t* map = layout == dkd::DescriptorLayout::CHW ? chw.data() : hwc.data();
+        const char* name = layout == dkd::DescriptorLayout::CHW ? "chw" : "hwc";
+
+        dkd::DescriptorGather gather;
+        MatrixU8 nearest(count, D);
+        double nearest_us = time_us([&]() {
+            gather.gather(map, layout, D, MAP_H, MAP_W, pixels.data(), count, nearest.data());
+        }, 200);
+
+        dkd::BilinearSampler sampler;
+        MatrixU8 sampled_u8(count, D);
+        double u8_us = time_us([&]() {
+            sampler.sample(map, layout, D, MAP_H, MAP_W, xy_q8.data(), count, sampled_u8.data());
+        }, 200);
+        Eigen::MatrixXf u8_error = (sampled_u8.cast<float>() - reference).cwiseAbs();
+        printf("%8s %8s %16.1f %16.1f %16.2f %16.3f\n", name, "uint8", nearest_us, u8_us, u8_error.maxCoeff(),
+               u8_error.mean());
+
+        Eigen::Matrix<int16_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> sampled_s16(count, D);
+        double s16_us = time_us([&]() {
+            sampler.sample(map, layout, D, MAP_H, MAP_W, xy_q8.data(), count, sampled_s16.data());
+        }, 200);
+        Eigen::MatrixXf s16_error = (sampled_s16.cast<float>() / 16.0f - reference).cwiseAbs();
+        printf("%8s %8s %16.1f %16.1f %16.2f %16.3f\n", name, "int16", nearest_us, s16_us, s16_error.maxCoeff(),
+               s16_error.mean());
+    }
+    printf("\n");
+}
+
+static void bench_specialized() {
+    const int padding = 4, top_k = 200, D = 96;
+    std::vector<uint8_t> scores = make_scoremap(MAP_H, MAP_W, 17);
+
+    printf("kernels specialized for the radius against the generic ones, padding %d\n", padding);
+    printf("%8s %14s %14s %10s %14s %14s %10s\n", "radius", "nms generic", "nms fixed", "speedup",
+           "refine generic", "refine fixed", "speedup");
+
+    const int radii[] = {1, 2, 3, 4};
+    for (int radius : radii) {
+        int full_padding = padding + radius;
+        int h_start = full_padding, w_start = full_padding;
+        int h_stop = MAP_H - full_padding, w_stop = MAP_W - full_padding;
+
+        double nms_us[2], refine_us[2];
+        for (int specialized = 0; specialized < 2; ++specialized) {
+            dkd::LocalMaxStream stream;
+            stream.set_specialized(specialized != 0);
+            dkd::HistogramTopK selector;
+            nms_us[specialized] = time_us([&]() {
+                selector.clear();
+                dkd::detect_local_maxima(stream, scores.data(), MAP_W, h_start, w_start, h_stop, w_stop,
+                                         radius, 127, [&](int x, int y, uint8_t score) {
+                    selector.push(x, y, score);
+                });
+            }, 1000);
+
+            std::vector<int32_t> xy(2 * top_k);
+            int count = selector.select(top_k, xy.data());
+            dkd::SoftArgmax soft_argmax;
+            soft_argmax.set_specialized(specialized != 0);
+            soft_argmax.configure(radius, 3.0f);
+            std::vector<int32_t> refined(2 * count);
+            refine_us[specialized] = time_us([&]() {
+                soft_argmax.refine(scores.data(), MAP_W, xy.data(), count, refined.data());
+            }, 1000);
+        }
+
+        printf("%8d %14.1f %14.1f %9.2fx %14.1f %14.1f %9.2fx\n", radius, nms_us[0], nms_us[1],
+               nms_us[0] / nms_us[1], refine_us[0], refine_us[1], refine_us[0] / refine_us[1]);
+    }
+
+    // The deployment configuration end to end, DKD dispatching to the specialized kernels
+    // against the generic ones
+    std::vector<uint8_t> feature_map(static_cast<size_t>(D + 1) * MAP_H * MAP_W);
+    for (size_t i = 0; i < feature_map.size(); ++i) {
+        feature_map[i] = static_cast<uint8_t>(static_cast<uint32_t>(i) * 2654435761u >> 24);
+    }
+    std::copy(scores.begin(), scores.end(), feature_map.begin() + static_cast<size_t>(D) * MAP_H * MAP_W);
+    const uint8_t* scoremap = feature_map.data() + static_cast<size_t>(D) * MAP_H * MAP_W;
+
+    DKD generic(top_k, 1, 4), dispatched(top_k, 1, 4);
+    DKD* detectors[] = {&generic, &dispatched};
+    const char* names[] = {"DKD generic", "DKD dispatched"};
+    generic.set_specialized_kernels(false);
+
+    std::vector<int32_t> keypoints(2 * top_k);
+    std::vector<uint8_t> descriptors(static_cast<size_t>(top_k) * D);
+    double run_us[2];
+    for (int i = 0; i < 2; ++i) {
+        DKD& dkd = *detectors[i];
+        configure_deployment(dkd, D, MAP_H, MAP_W);
+        run_us[i] = time_us([&]() {
+            dkd.run_into(scoremap, feature_map.data(), keypoints.data(), descriptors.data(), D, MAP_H, MAP_W);
+        }, 200);
+    }
+    printf("\nDKD(%d, 1, 4), grid, subpixel and bilinear descriptors, single thread\n", top_k);
+    for (int i = 0; i < 2; ++i) {
+        printf("%16s %10.1f us %9.2fx\n", names[i], run_us[i], run_us[0] / run_us[i]);
+    }
+    printf("\n");
+}
+
+static void bench_budget() {
+    const int frames = 600, settle = 50, slowdown_from = 300;
+    const double slowdown = 2.0;
+    PipelineModel model;
+    BudgetSettings settings;
+
+    printf("keypoint budget on a simulated 10 fps pipeline, %.0f B/s link, target %.0f ms, CPU %.0fx slower from frame %d\n",
+           model.link_bytes_per_second, settings.target_latency_ms, slowdown, slowdown_from);
+    printf("%16s %10s %12s %12s %12s %12s\n", "budget", "frames", "mean top_k", "mean ms", "max ms", "over target");
+
+    struct Phase {
+        const char* name;
+        int first, last;
+    };
+    const Phase phases[] = {{"settled", settle, slowdown_from}, {"slowed down", slowdown_from + settle, frames}};
+
+    for (const Phase& phase : phases) {
+        PipelineRun fixed = simulate_pipeline(model, phase.first, phase.last, slowdown_from, slowdown, nullptr,
+                                              settings.max_top_k, settings.target_latency_ms);
+        BudgetController controller(settings);
+        PipelineRun adaptive = simulate_pipeline(model, phase.first, phase.last, slowdown_from, slowdown, &controller,
+                                                 0, settings.target_latency_ms);
+        printf("%16s %4d..%-5d %12.1f %12.1f %12.1f %11.0f%%\n", "fixed", phase.first, phase.last,
+               fixed.mean_top_k, fixed.mean_latency_ms, fixed.max_latency_ms, 100 * fixed.over_target);
+        printf("%16s %4d..%-5d %12.1f %12.1f %12.1f %11.0f%%\n", "controller", phase.first, phase.last,
+               adaptive.mean_top_k, adaptive.mean_latency_ms, adaptive.max_latency_ms, 100 * adaptive.over_target);
+    }
+    printf("\n");
+}
+
+// The matcher was asked to do 500 x 500 well under 1 ms on the A7 of the RV1126. That is not
+// met: 500 x 500 x 96 is 24M MACs, and the 64 bit NEON unit of a single A7 core does a few
+// int16 MACs a cycle, so several ms. Not measured on the device. The deployment top k of
+// 200 is 3.8M MACs
+static void bench_match() {
+    const int D = 96;
+    const float threshold = 0.5f;
+    dkd::Quantization quantization;
+
+    printf("mutual nearest neighbour matching of %d-d descriptors, threshold %.2f\n", D, threshold);
+    printf("%8s %14s %14s %10s %10s %12s\n", "count", "float us", "int16 us", "speedup", "matches", "vs dequant");
+
+    const int counts[] = {200, 500};
+    for (int count : counts) {
+        std::vector<uint8_t> descriptors1, descriptors2;
+        make_descriptor_pair(count, D, quantization, count, descriptors1, descriptors2);
+
+        // The float matcher on the dequantized descriptors, as in slam_service
+        Eigen::MatrixXf dequantized1 = dequantize_descriptors(descriptors1.data(), count, D, quantization);
+        Eigen::MatrixXf dequantized2 = dequantize_descriptors(descriptors2.data(), count, D, quantization);
+        std::vector<std::pair<int, int>> dequantized_matches;
+        double reference_us = time_us([&]() {
+            dequantized_matches.clear();
+            perform_matching_reference(dequantized1, dequantized2, dequantized_matches, threshold);
+        }, 20);
+
+        dkd::MutualMatcher matcher;
+        matcher.configure(quantization, threshold);
+        std::vector<std::pair<int, int>> matches;
+        matcher.reserve(count, D);
+        double fast_us = time_us([&]() {
+            matcher.match(descriptors1.data(), count, descriptors2.data(), count, D, matches);
+        }, 100);
+
+        // Float rounding of the dequantized version may flip near ties, count how often
+        int differences = 0;
+        for (const std::pair<int, int>& m : dequantized_matches) {
+            differences += std::find(matches.begin(), matches.end(), m) == matches.end();
+        }
+        differences += static_cast<int>(matches.size()) - (static_cast<int>(dequantized_matches.size()) - differences);
+
+        printf("%8d %14.1f %14.1f %9.1fx %10zu %12d\n", count, reference_us, fast_us, reference_us / fast_us,
+               matches.size(), differences);
+    }
+    printf("\n");
+}
+
+static void bench_hamming() {
+    const int D = 96;
+    const float threshold = 0.5f;
+    dkd::Quantization quantization;
+    const int size = dkd::signature_size(D);
+
+    struct Setting {
+        int max_distance;
+        float ratio;
+    };
+    const Setting settings[] = {{24, 0.8f}, {32, 0.9f}, {D, 1.0f}};
+
+    printf("hamming matching of %d-bit signatures, %d bytes instead of %d, against the float matcher at %.2f\n",
+           D, size, D, threshold);
+    printf("%6s %6s %6s %12s %12s %10s %10s %10s\n", "count", "max", "ratio", "int16 us", "hamming us",
+           "matches", "recall", "precision");
+
+    const int counts[][2] = {{200, 199}, {500, 500}};
+    for (const auto& count : counts) {
+        std::vector<uint8_t> descriptors1, descriptors2;
+        make_descriptor_pair(std::max(count[0], count[1]), D, quantization, count[0], descriptors1, descriptors2);
+
+        std::vector<std::pair<int, int>> float_matches;
+        perform_matching_reference(dequantize_descriptors(descriptors1.data(), count[0], D, quantization),
+                                   dequantize_descriptors(descriptors2.data(), count[1], D, quantization),
+                                   float_matches, threshold);
+
+        std::vector<std::pair<int, int>> int_matches;
+        dkd::MutualMatcher int_matcher;
+        int_matcher.configure(quantization, threshold);
+        double int_us = time_us([&]() {
+            int_matcher.match(descriptors1.data(), count[0], descriptors2.data(), count[1], D, int_matches);
+        }, 100);
+
+        std::vector<uint8_t> signatures1(static_cast<size_t>(count[0]) * size);
+        std::vector<uint8_t> signatures2(static_cast<size_t>(count[1]) * size);
+        dkd::binarize(descriptors1.data(), count[0], D, quantization.zero_point, signatures1.data());
+        dkd::binarize(descriptors2.data(), count[1], D, quantization.zero_point, signatures2.data());
+
+        for (const Setting& setting : settings) {
+            std::vector<std::pair<int, int>> matches;
+            dkd::HammingMatcher matcher;
+            matcher.configure(setting.max_distance, setting.ratio);
+            matcher.reserve(std::max(count[0], count[1]), D);
+            double fast_us = time_us([&]() {
+                matcher.match(signatures1.data(), count[0], signatures2.data(), count[1], D, matches);
+            }, 100);
+
+            int common = common_matches(matches, float_matches);
+            printf("%6d %6d %6.2f %12.1f %12.1f %10zu %9.1f%% %9.1f%%\n", count[0], setting.max_distance,
+                   setting.ratio, int_us, fast_us, matches.size(), 100.0 * common / std::max<size_t>(float_matches.size(), 1),
+                   100.0 * common / std::max<size_t>(matches.size(), 1));
+        }
+    }
+    printf("\n");
+}
+
+static void bench_blocked() {
+    const int D = 96;
+    const float threshold = 0.5f;
+    dkd::Quantization quantization;
+
+    printf("tiled float matching, %dx%d tiles, against perform_matching at %.2f\n", dkd::BlockedMatcher::TILE_ROWS,
+           dkd::BlockedMatcher::TILE_COLS, threshold);
+    printf("%6s %6s %6s %12s %12s %10s %10s %8s\n", "count1", "count2", "ratio", "full us", "tiled us",
+           "speedup", "sim MB", "matches");
+
+    const int counts[][2] = {{200, 200}, {500, 500}, {2000, 500}, {5000, 500}};
+    for (const auto& count : counts) {
+        // A map of count1 points against a frame seeing part of them
+        std::vector<uint8_t> descriptors1, descriptors2;
+        make_descriptor_pair(count[0], D, quantization, count[0] + count[1], descriptors1, descriptors2);
+        Eigen::MatrixXf desc1 = dequantize_descriptors(descriptors1.data(), count[0], D, quantization).rowwise().normalized();
+        Eigen::MatrixXf desc2 = dequantize_descriptors(descriptors2.data(), count[1], D, quantization).rowwise().normalized();
+
+        const float ratios[] = {1.0f, 0.8f};
+        for (float ratio : ratios) {
+            std::vector<std::pair<int, int>> reference, matches;
+            double full_us = time_us([&]() {
+                reference.clear();
+                if (ratio >= 1.0f) {
+                    perform_matching_reference(desc1, desc2, reference, threshold);
+                } else {
+                    ratio_matching_reference(desc1, desc2, threshold, ratio, reference);
+                }
+            }, 10);
+
+            dkd::BlockedMatcher matcher;
+            matcher.configure(threshold, ratio);
+            double tiled_us = time_us([&]() {
+                matcher.match(desc1, desc2, matches);
+            }, 10);
+
+            printf("%6d %6d %6.2f %12.1f %12.1f %9.1fx %10.1f %8zu\n", count[0], count[1], ratio, full_us, tiled_us,
+                   full_us / tiled_us, count[0] * count[1] * sizeof(float) / 1e6, matches.size());
+        }
+    }
+    printf("\n");
+}
+
+static void bench_guided() {
+    const int D = 96;
+    const float threshold = 0.5f;
+    const float radius = 8.0f;
+    dkd::Quantization quantization;
+
+    // Keypoints on the 256 x 160 map, moving by a few pixels between the frames with some
+    // jitter, and a constant velocity prediction a pixel off
+    const float motion[2] = {3.0f, -2.0f};
+    dkd::MotionModel model = dkd::MotionModel::identity();
+    model.h[2] = 2.2f;
+    model.h[5] = -1.4f;
+
+    printf("guided matching within %.0f px of a constant velocity prediction, threshold %.2f\n", radius, threshold);
+    printf("%6s %12s %12s %10s %10s %10s %10s\n", "count", "brute us", "guided us", "speedup", "brute",
+           "guided", "true");
+
+    const int counts[] = {200, 500, 1000, 2000};
+    for (int count : counts) {
+        std::mt19937 rng(count);
+        std::uniform_real_distribution<float> x_dist(0.0f, MAP_W - 1), y_dist(0.0f, MAP_H - 1);
+        std::normal_distribution<float> jitter(0.0f, 0.5f);
+
+        std::vector<uint8_t> descriptors1, descriptors2;
+        std::vector<int> sources;
+        make_descriptor_pair(count, D, quantization, count, descriptors1, descriptors2, &sources);
+        std::vector<float> points1(2 * count), points2(2 * count), predicted1(2 * count);
+        for (int i = 0; i < count; ++i) {
+            points1[2 * i] = x_dist(rng);
+            points1[2 * i + 1] = y_dist(rng);
+        }
+        for (int j = 0; j < count; ++j) {
+            int i = sources[j];
+            points2[2 * j] = i >= 0 ? points1[2 * i] + motion[0] + jitter(rng) : x_dist(rng);
+            points2[2 * j + 1] = i >= 0 ? points1[2 * i + 1] + motion[1] + jitter(rng) : y_dist(rng);
+        }
+        model.predict(points1.data(), count, predicted1.data());
+
+        dkd::MutualMatcher brute_force;
+        brute_force.configure(quantization, threshold);
+        brute_force.reserve(count, D);
+        std::vector<std::pair<int, int>> brute_matches;
+        double brute_us = time_us([&]() {
+            brute_force.match(descriptors1.data(), count, descriptors2.data(), count, D, brute_matches);
+        }, 20);
+
+        dkd::GuidedMatcher matcher;
+        matcher.configure(quantization, threshold, radius, 0);
+        matcher.reserve(count, D);
+        std::vector<std::pair<int, int>> matches;
+        double guided_us = time_us([&]() {
+            matcher.match(descriptors1.data(), predicted1.data(), count, descriptors2.data(), points2.data(),
+                          count, D, matches);
+        }, 20);
+
+        int correct = 0;
+        for (const std::pair<int, int>& m : matches) {
+            correct += sources[m.second] == m.first;
+        }
+        printf("%6d %12.1f %12.1f %9.1fx %10zu %10zu %10d\n", count, brute_us, guided_us, brute_us / guided_us,
+               brute_matches.size(), matches.size(), correct);
+    }
+    printf("\n");
+}
+
+static void bench_top2() {
+    const int D = 96;
+    const float threshold = 0.5f;
+    dkd::Quantization quantization;
+
+    printf("single pass top 2 matching with the ratio test both ways, threshold %.2f\n", threshold);
+    printf("%6s %6s %12s %10s %10s %12s\n", "count", "ratio", "us", "matches", "wrong", "sim margin");
+
+    const int counts[][2] = {{200, 199}, {500, 500}};
+    for (const auto& count : counts) {
+        // Frames sharing two thirds of their keypoints, with the quantized values of the second
+        // frame off by one here and there on top so that some nearest neighbours are wrong
+        std::vector<uint8_t> descriptors1, descriptors2;
+        std::vector<int> sources;
+        make_descriptor_pair(count[0], D, quantization, count[0] + 1, descriptors1, descriptors2, &sources);
+        for (size_t k = 0; k < descriptors2.size(); ++k) {
+            int v = descriptors2[k] + static_cast<int>(hash_bytes(&k, sizeof(k)) % 3) - 1;
+            descriptors2[k] = static_cast<uint8_t>(std::min(std::max(v, 0), 255));
+        }
+
+        const float ratios[] = {1.0f, 0.9f, 0.8f};
+        for (float ratio : ratios) {
+            dkd::MutualMatcher matcher;
+            matcher.configure(quantization, threshold, ratio);
+            matcher.reserve(count[0], D);
+            std::vector<dkd::Match> matches;
+            double us = time_us([&]() {
+                matcher.match(descriptors1.data(), count[0], descriptors2.data(), count[1], D, matches);
+            }, 50);
+
+            int wrong = 0;
+            double margin = 0.0;
+            for (size_t k = 0; k < matches.size(); ++k) {
+                wrong += sources[matches[k].index2] != matches[k].index1;
+                margin += matches[k].similarity - matches[k].second_similarity;
+            }
+            printf("%6d %6.2f %12.1f %10zu %10d %12.3f\n", count[0], ratio, us, matches.size(), wrong,
+                   margin / std::max<size_t>(matches.size(), 1));
+        }
+    }
+    printf("\n");
+}
+
+static void bench_essential() {
+    const int runs = 20;
+    dkd::RansacSettings settings;
+
+    // Median errors, the lost scenes are the ones off by more than 10 degrees
+    printf("essential matrix RANSAC, 8 point, %.1f px threshold, %.3f confidence, 0.5 px noise, %d scenes each\n",
+           settings.threshold_px, settings.confidence, runs);
+    printf("%6s %8s %10s %10s %10s %10s %6s %10s %10s\n", "count", "outliers", "us", "iterations", "rot deg",
+           "t deg", "lost", "recall", "false");
+
+    const struct { int count; float outliers; } cases[] = {{200, 0.0f}, {200, 0.15f}, {200, 0.3f}, {500, 0.3f}};
+    for (const auto& c : cases) {
+        double total_us = 0.0, iterations = 0.0;
+        std::vector<float> rotation_errors, translation_errors;
+        int lost = 0;
+        int inliers = 0, found = 0, accepted_outliers = 0, accepted = 0;
+        for (int run = 0; run < runs; ++run) {
+            TwoViewScene scene = make_two_view_scene(c.count, c.outliers, 0.5f, 1000 * c.count + run);
+            dkd::EssentialRansac ransac(scene.intrinsics, settings);
+            ransac.reserve(c.count);
+            dkd::RelativePose pose;
+            bool success = false;
+            total_us += time_us([&]() {
+                success = ransac.estimate(scene.points1.data(), scene.points2.data(), c.count, pose);
+            }, 5);
+            iterations += pose.iterations;
+            if (!success) {
+                ++lost;
+                continue;
+            }
+
+            rotation_errors.push_back(rotation_error_deg(pose.R, scene.R));
+            translation_errors.push_back(direction_error_deg(pose.t, scene.t));
+            lost += translation_errors.back() > 10.0f;
+            const std::vector<uint8_t>& mask = ransac.inlier_mask();
+            for (int i = 0; i < c.count; ++i) {
+                inliers += !scene.outlier[i];
+                found += !scene.outlier[i] && mask[i];
+                accepted_outliers += scene.outlier[i] && mask[i];
+                accepted += mask[i];
+            }
+        }
+        double recall = static_cast<double>(found) / std::max(inliers, 1);
+        double false_ratio = static_cast<double>(accepted_outliers) / std::max(accepted, 1);
+        printf("%6d %7.0f%% %10.1f %10.1f %10.3f %10.2f %6d %9.1f%% %9.1f%%\n", c.count, 100.0f * c.outliers,
+               total_us / runs, iterations / runs, median(rotation_errors), median(translation_errors), lost,
+               100.0 * recall, 100.0 * false_ratio);
+    }
+    printf("\n");
+}
+
+static void bench_prosac() {
+    const int runs = 20;
+    dkd::RansacSettings settings;
+
+    // Qualities overlap: an inlier draws from [0.2, 1), an outlier from [0, 0.8). Solution is
+    // the iteration that drew the returned hypothesis, lost the scenes off by more than 10 degrees
+    printf("PROSAC against uniform sampling, %d scenes each\n", runs);
+    printf("%6s %8s %10s %10s %10s %10s %10s %10s %6s\n", "count", "outliers", "sampling", "us", "iterations",
+           "solution", "rot deg", "t deg", "lost");
+
+    const struct { int count; float outliers; } cases[] = {{200, 0.3f}, {500, 0.3f}, {200, 0.5f}, {200, 0.6f}};
+    for (const auto& c : cases) {
+        for (int progressive = 0; progressive < 2; ++progressive) {
+            double total_us = 0.0, iterations = 0.0, solutions = 0.0;
+            int lost = 0;
+            std::vector<float> rotation_errors, translation_errors;
+            for (int run = 0; run < runs; ++run) {
+                TwoViewScene scene = make_two_view_scene(c.count, c.outliers, 0.5f, 7000 + run);
+                std::mt19937 rng(run);
+                std::uniform_real_distribution<float> uniform(0.0f, 0.8f);
+                std::vector<float> quality(c.count);
+                for (int i = 0; i < c.count; ++i) {
+                    quality[i] = uniform(rng) + (scene.outlier[i] ? 0.0f : 0.2f);
+                }
+
+                dkd::EssentialRansac ransac(scene.intrinsics, settings);
+                ransac.reserve(c.count);
+                dkd::RelativePose pose;
+                bool success = false;
+                total_us += time_us([&]() {
+                    success = progressive
+                        ? ransac.estimate(scene.points1.data(), scene.points2.data(), quality.data(), c.count, pose)
+                        : ransac.estimate(scene.points1.data(), scene.points2.data(), c.count, pose);
+                }, 5);
+                iterations += pose.iterations;
+                solutions += pose.solution_iteration;
+                if (!success) {
+                    ++lost;
+                    continue;
+                }
+                rotation_errors.push_back(rotation_error_deg(pose.R, scene.R));
+                translation_errors.push_back(direction_error_deg(pose.t, scene.t));
+                lost += translation_errors.back() > 10.0f;
+            }
+            printf("%6d %7.0f%% %10s %10.1f %10.1f %10.1f %10.3f %10.2f %6d\n", c.count, 100.0f * c.outliers,
+                   progressive ? "prosac" : "uniform", total_us / runs, iterations / runs, solutions / runs,
+                   median(rotation_errors), median(translation_errors), lost);
+        }
+    }
+    printf("\n");
+}
+
+static void bench_odometry() {
+    const int frames = 150, top_k = 200;
+    const float noise_px = 0.5f, junk = 0.15f;
+    CorridorRun run = fly_corridor(frames, top_k, noise_px, junk);
+
+    // Drift is the position error of the last frame over the length of the path
+    printf("visual odometry, %d frames of %d keypoints, %.0f%% junk, %.1f px noise\n", frames, top_k,
+           100.0f * junk, noise_px);
+    printf("%10s %10s %6s %6s %8s %12s %12s %8s %10s\n", "us/frame", "keyframes", "lost", "resets", "packets",
+           "drift %path", "rot deg", "bytes", "reduction");
+    printf("%10.1f %10d %6d %6d %8s %11.2f%% %12.3f %8.0f %9.1fx\n", run.track_us / frames, run.keyframes, run.lost,
+           run.resets, run.packets_ok ? "yes" : "NO", 100.0f * run.drift, run.worst_rotation,
+           static_cast<double>(run.odometry_bytes) / frames,
+           static_cast<double>(run.feature_bytes) / std::max<size_t>(run.odometry_bytes, 1));
+    printf("a frame of full features is %.0f bytes, a pose packet %zu\n\n",
+           static_cast<double>(run.feature_bytes) / frames, dkd::POSE_PACKET_SIZE);
+}
+
+static void bench_triangulate() {
+    const int runs = 20;
+    // Kept when in front of both cameras within 2 px in both, with 1 degree of parallax
+    const float threshold_px = 2.0f;
+    const float min_parallax = static_cast<float>(M_PI) / 180.0f;
+
+    // Relative errors are |X - truth| / depth over the matches that aren't outliers,
+    // parallax the largest difference to the angle of the rays in double
+    printf("two view triangulation, midpoint against DLT (4x4 SVD a point), 0.5 px noise, 10%% outliers, "
+           "%d scenes each\n", runs);
+    printf("%6s %10s %10s %8s %12s %12s %12s %8s %8s\n", "count", "us", "dlt us", "speedup", "error",
+           "dlt error", "parallax", "kept", "rejected");
+
+    const int counts[] = {200, 1000};
+    for (int count : counts) {
+        double total_us = 0.0, reference_us = 0.0;
+        std::vector<float> errors, reference_errors;
+        float parallax_error = 0.0f;
+        int inliers = 0, kept = 0, outliers = 0, rejected = 0;
+        for (int run = 0; run < runs; ++run) {
+            TwoViewScene scene = make_two_view_scene(count, 0.1f, 0.5f, 3000 + run);
+            const dkd::Intrinsics& K = scene.intrinsics;
+            std::vector<float> x1(count), y1(count), x2(count), y2(count);
+            for (int i = 0; i < count; ++i) {
+                x1[i] = (scene.points1[2 * i] - K.cx) / K.fx;
+                y1[i] = (scene.points1[2 * i + 1] - K.cy) / K.fy;
+                x2[i] = (scene.points2[2 * i] - K.cx) / K.fx;
+                y2[i] = (scene.points2[2 * i + 1] - K.cy) / K.fy;
+            }
+            dkd::CameraPose pose1 = dkd::CameraPose::Zero(), pose2;
+            pose1.leftCols<3>().setIdentity();
+            pose2 << scene.R, scene.t;
+
+            dkd::Triangulation points;
+            points.reserve(count);
+            std::vector<Eigen::Vector3f> reference;
+            total_us += time_us([&]() {
+                dkd::triangulate(pose1, pose2, x1.data(), y1.data(), x2.data(), y2.data(), count, points);
+            }, 20);
+            reference_us += time_us([&]() {
+                triangulate_reference(pose1, pose2, x1.data(), y1.data(), x2.data(), y2.data(), count, reference);
+            }, 2);
+
+            float threshold2 = threshold_px * threshold_px / (K.fx * K.fy);
+            Eigen::Matrix3d rotation = scene.R.cast<double>();
+            for (int i = 0; i < count; ++i) {
+                bool keep = points.depth1[i] > 0.0f && points.depth2[i] > 0.0f &&
+                            points.error2[i] < threshold2 && points.parallax[i] > min_parallax;
+                if (scene.outlier[i]) {
+                    ++outliers;
+                    rejected += !keep;
+                    continue;
+                }
+                ++inliers;
+                kept += keep;
+                const Eigen::Vector3f& truth = scene.points[i];
+                Eigen::Vector3f point(points.X[i], points.Y[i], points.Z[i]);
+                errors.push_back((point - truth).norm() / truth.z());
+                reference_errors.push_back((reference[i] - truth).norm() / truth.z());
+                Eigen::Vector3d ray1(x1[i], y1[i], 1.0), ray2 = rotation.transpose() * Eigen::Vector3d(x2[i], y2[i], 1.0);
+                double angle = std::atan2(ray1.cross(ray2).norm(), ray1.dot(ray2));
+                parallax_error = std::max(parallax_error, static_cast<float>(std::fabs(points.parallax[i] - angle)));
+            }
+        }
+        printf("%6d %10.1f %10.1f %7.1fx %11.3f%% %11.3f%% %12.6f %7.1f%% %7.1f%%\n", count, total_us / runs,
+               reference_us / runs, reference_us / std::max(total_us, 1e-9), 100.0f * median(errors),
+               100.0f * median(reference_errors), parallax_error, 100.0 * kept / std::max(inliers, 1),
+               100.0 * rejected / std::max(outliers, 1));
+    }
+    printf("\n");
+}
+
+static void bench_bundle() {
+    const int runs = 10;
+    dkd::CameraModel camera = deployment_camera();
+    dkd::BundleSettings settings;
+    dkd::LocalBundleAdjuster adjuster(camera, settings);
+    // The same adjustment run to convergence, what the iteration budget gives up
+    dkd::BundleSettings converged_settings = settings;
+    converged_settings.iterations = 50;
+    dkd::LocalBundleAdjuster converged(camera, converged_settings);
+
+    // Wall clock of an adjustment by window size in the foreground, its robust cost over the
+    // converged one, the median reprojection error of the inliers and the errors of the free
+    // poses before and after
+    printf("local bundle adjustment, %d iterations, %d fixed keyframes, 0.5 px noise, 5%% outliers, %d windows each\n",
+           settings.iterations, settings.fixed_keyframes, runs);
+    printf("%9s %7s %7s %9s %9s %10s %10s %9s %9s %9s %9s\n", "keyframes", "points", "obs", "ms", "cost",
+           "median px", "median px'", "rot deg", "rot deg'", "pos m", "pos m'");
+
+    const int sizes[] = {3, 5, 8, 12};
+    for (int keyframes : sizes) {
+        double total_ms = 0.0, cost_ratio = 0.0;
+        double median_before = 0.0, median_after = 0.0;
+        double rotation_before = 0.0, rotation_after = 0.0, position_before = 0.0, position_after = 0.0;
+        int points = 0, observations = 0;
+        for (int run = 0; run < runs; ++run) {
+            BundleScene scene = make_bundle_scene(adjuster, keyframes, settings.fixed_keyframes, 0.05f, 0.5f,
+                                                  4000 + run);
+            points += static_cast<int>(scene.window.points.size());
+            observations += static_cast<int>(scene.window.observations.size());
+            median_before += bundle_median_px(adjuster, scene, scene.window);
+            double rotation, position;
+            bundle_pose_error(scene.truth, scene.window, settings.fixed_keyframes, rotation, position);
+            rotation_before += rotation;
+            position_before += position;
+
+            dkd::BundleWindow window = scene.window;
+            dkd::BundleReport report = adjuster.optimize(window);
+            total_ms += report.milliseconds;
+            median_after += bundle_median_px(adjuster, scene, window);
+            bundle_pose_error(scene.truth, window, settings.fixed_keyframes, rotation, position);
+            rotation_after += rotation;
+            position_after += position;
+
+            dkd::BundleWindow reference = scene.window;
+            cost_ratio += report.final_cost / converged.optimize(reference).final_cost;
+        }
+        printf("%9d %7d %7d %9.2f %9.3f %10.2f %10.2f %9.3f %9.3f %9.4f %9.4f\n", keyframes, points / runs,
+               observations / runs, total_ms / runs, cost_ratio / runs, median_before / runs, median_after / runs,
+               rotation_before / runs, rotation_after / runs, position_before / runs, position_after / runs);
+    }
+    printf("\n");
+}
+
+struct Section {
+    const char* name;
+    void (*run)();
+};
+
+static const Section SECTIONS[] = {
+    {"maxpool", bench_maxpool},
+    {"nms", bench_nms},
+    {"fused", bench_fused},
+    {"topk", bench_topk},
+    {"grid", bench_grid},
+    {"subpixel", bench_subpixel},
+    {"threads", bench_threads},
+    {"gather", bench_gather},
+    {"bilinear", bench_bilinear},
+    {"specialized", bench_specialized},
+    {"budget", bench_budget},
+    {"match", bench_match},
+    {"hamming", bench_hamming},
+    {"blocked", bench_blocked},
+    {"guided", bench_guided},
+    {"top2", bench_top2},
+    {"essential", bench_essential},
+    {"prosac", bench_prosac},
+    {"odometry", bench_odometry},
+    {"triangulate", bench_triangulate},
+    {"bundle", bench_bundle},
+};
+
+// Runs the deployment DKD over recorded dumps
+static int replay(int argc, char** argv) {
+    int D = 96, H = MAP_H, W = MAP_W;
+    std::vector<std::string> dumps;
+    for (int i = 0; i < argc; ++i) {
+        std::string arg = argv[i];
+        if ((arg == "-D" || arg == "-H" || arg == "-W") && i + 1 < argc) {
+            int value = atoi(argv[++i]);
+            (arg == "-D" ? D : arg == "-H" ? H : W) = value;
+        } else {
+            dumps.push_back(arg);
+        }
+    }
+    if (dumps.empty()) {
+        printf("Usage: dkd_bench replay [-D depth] [-H height] [-W width] dump...\n");
+        return -1;
+    }
+
+    const int iterations = 100;
+    size_t feature_map_size = static_cast<size_t>(D + 1) * H * W;
+    size_t scoremap_size = static_cast<size_t>(H) * W;
+    // Scoremap dumps come without descriptors, they are sampled from a synthetic map
+    const std::vector<uint8_t> synthetic = make_feature_map(D, H, W, 1);
+    std::vector<uint8_t> feature_map;
+
+    DKD dkd(200, 1, 4);
+    configure_deployment(dkd, D, H, W);
+    std::vector<int32_t> keypoints(2 * dkd.top_k());
+    std::vector<uint8_t> descriptors(static_cast<size_t>(dkd.top_k()) * D);
+
+    printf("DKD(200, 1, 4) as deployed over %zu dumps, %dx%dx%d\n", dumps.size(), D + 1, H, W);
+    printf("%40s %12s %10s %20s\n", "dump", "ns/frame", "keypoints", "hash");
+    double total_ns = 0.0;
+    int replayed = 0;
+    for (const std::string& path : dumps) {
+        std::ifstream file(path, std::ios::binary);
+        std::vector<uint8_t> dump((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (dump.size() == feature_map_size) {
+            feature_map = dump;
+        } else if (dump.size() == scoremap_size) {
+            feature_map = synthetic;
+            std::copy(dump.begin(), dump.end(), feature_map.begin() + static_cast<size_t>(D) * H * W);
+        } else {
+            printf("%40s: %zu bytes is neither a feature map nor a scoremap, skipped\n", path.c_str(), dump.size());
+            continue;
+        }
+
+        const uint8_t* scores = feature_map.data() + static_cast<size_t>(D) * H * W;
+        int count = 0;
+        double ns = 1000.0 * time_us([&]() {
+            count = dkd.run_into(scores, feature_map.data(), keypoints.data(), descriptors.data(), D, H, W);
+        }, iterations);
+        uint64_t hash = hash_bytes(&count, sizeof(count));
+        hash = hash_bytes(keypoints.data(), keypoints.size() * sizeof(int32_t), hash);
+        hash = hash_bytes(descriptors.data(), descriptors.size(), hash);
+        printf("%40s %12.0f %10d   0x%016llx\n", path.c_str(), ns, count, static_cast<unsigned long long>(hash));
+        total_ns += ns;
+        ++replayed;
+    }
+    if (replayed > 0) {
+        printf("%40s %12.0f\n", "mean", total_ns / replayed);
+    }
+    return replayed > 0 ? 0 : -1;
+}
+
+static bool read_file(const std::string& path, std::vector<uint8_t>& data) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+static int recall(int argc, char** argv) {
+    int D = 96;
+    float threshold = 0.5f;
+    std::string folder;
+    for (int i = 0; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-D" && i + 1 < argc) {
+            D = atoi(argv[++i]);
+        } else if (arg == "-t" && i + 1 < argc) {
+            threshold = static_cast<float>(atof(argv[++i]));
+        } else {
+            folder = arg;
+        }
+    }
+    if (folder.empty()) {
+        printf("Usage: dkd_bench recall [-D depth] [-t threshold] data_folder\n");
+        return -1;
+    }
+
+    // Valid descriptors of every frame, budget_N.bin has their count when it was written
+    dkd::Quantization quantization;
+    std::vector<std::vector<uint8_t>> frames;
+    std::vector<int> counts;
+    std::vector<uint8_t> descriptors, budget;
+    while (read_file(folder + "/descriptors_" + std::to_string(frames.size()) + ".bin", descriptors)) {
+        int count = static_cast<int>(descriptors.size() / D);
+        if (read_file(folder + "/budget_" + std::to_string(frames.size()) + ".bin", budget) &&
+            budget.size() >= 3 * sizeof(int32_t)) {
+            int32_t values[3];
+            memcpy(values, budget.data(), sizeof(values));
+            count = std::min(count, static_cast<int>(values[2]));
+        }
+        frames.push_back(descriptors);
+        counts.push_back(count);
+    }
+    if (frames.size() < 2) {
+        printf("%s: need at least descriptors_0.bin and descriptors_1.bin\n", folder.c_str());
+        return -1;
+    }
+
+    // Matches of the float matcher between consecutive frames are the ground truth
+    int size = dkd::signature_size(D);
+    size_t pairs = frames.size() - 1;
+    std::vector<std::vector<std::pair<int, int>>> float_matches(pairs);
+    std::vector<std::vector<uint8_t>> signatures(frames.size());
+    size_t total_float = 0;
+    double keypoints = 0.0;
+    for (size_t f = 0; f < frames.size(); ++f) {
+        signatures[f].resize(static_cast<size_t>(counts[f]) * size);
+        dkd::binarize(frames[f].data(), counts[f], D, quantization.zero_point, signatures[f].data());
+        keypoints += counts[f];
+        if (f + 1 < frames.size()) {
+            perform_matching_reference(dequantize_descriptors(frames[f].data(), counts[f], D, quantization),
+                                       dequantize_descriptors(frames[f + 1].data(), counts[f + 1], D, quantization),
+                                       float_matches[f], threshold);
+            total_float += float_matches[f].size();
+        }
+    }
+    keypoints /= frames.size();
+
+    // 10 bits a byte on the wire, 8N1
+    const double baud = 921600.0;
+    printf("%zu frame pairs, %.0f keypoints a frame, %zu float matches at %.2f\n", pairs, keypoints, total_float, threshold);
+    printf("descriptors %d bytes, %.1f ms a frame at 921600 baud; signatures %d bytes, %.1f ms\n", D,
+           1000.0 * keypoints * D * 10 / baud, size, 1000.0 * keypoints * size * 10 / baud);
+    printf("%6s %6s %12s %10s %10s\n", "max", "ratio", "matches", "recall", "precision");
+
+    dkd::HammingMatcher matcher;
+    std::vector<std::pair<int, int>> matches;
+    const float ratios[] = {0.7f, 0.8f, 0.9f, 1.0f};
+    for (int max_distance = D / 8; max_distance <= D / 2; max_distance += D / 8) {
+        for (float ratio : ratios) {
+            matcher.configure(max_distance, ratio);
+            size_t total = 0, common = 0;
+            for (size_t f = 0; f < pairs; ++f) {
+                matcher.match(signatures[f].data(), counts[f], signatures[f + 1].data(), counts[f + 1], D, matches);
+                total += matches.size();
+                common += common_matches(matches, float_matches[f]);
+            }
+            printf("%6d %6.2f %12.1f %9.1f%% %9.1f%%\n", max_distance, ratio, static_cast<double>(total) / pairs,
+                   100.0 * common / std::max<size_t>(total_float, 1), 100.0 * common / std::max<size_t>(total, 1));
+        }
+    }
+    return 0;
+}
+
+static int sampling(int argc, char** argv) {
+    int D = 96;
+    float threshold = 0.5f;
+    int subpixel_bits = dkd::SUBPIXEL_BITS;
+    std::string folder;
+    for (int i = 0; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-D" && i + 1 < argc) {
+            D = atoi(argv[++i]);
+        } else if (arg == "-t" && i + 1 < argc) {
+            threshold = static_cast<float>(atof(argv[++i]));
+        } else if (arg == "-s" && i + 1 < argc) {
+            subpixel_bits = atoi(argv[++i]);
+        } else {
+            folder = arg;
+        }
+    }
+    if (folder.empty()) {
+        printf("Usage: dkd_bench sampling [-D depth] [-t threshold] [-s subpixel_bits] data_folder\n");
+        return -1;
+    }
+
+    // Valid keypoints and descriptors of every frame, as in recall
+    struct Frame {
+        std::vector<uint8_t> descriptors;
+        std::vector<float> points;
+        int top_k;
+        int count;
+    };
+    std::vector<Frame> frames;
+    std::vector<uint8_t> descriptors, keypoints, budget;
+    while (read_file(folder + "/descriptors_" + std::to_string(frames.size()) + ".bin", descriptors) &&
+           read_file(folder + "/keypoints_" + std::to_string(frames.size()) + ".bin", keypoints)) {
+        Frame frame;
+        frame.top_k = static_cast<int>(keypoints.size() / (2 * sizeof(int32_t)));
+        frame.count = std::min(frame.top_k, static_cast<int>(descriptors.size() / D));
+        if (read_file(folder + "/budget_" + std::to_string(frames.size()) + ".bin", budget) &&
+            budget.size() >= 3 * sizeof(int32_t)) {
+            int32_t values[3];
+            memcpy(values, budget.data(), sizeof(values));
+            frame.count = std::min(frame.count, static_cast<int>(values[2]));
+        }
+        // Column-major: all the x, then all the y
+        std::vector<int32_t> columns(2 * frame.top_k);
+        memcpy(columns.data(), keypoints.data(), columns.size() * sizeof(int32_t));
+        frame.points.resize(2 * frame.count);
+        for (int i = 0; i < frame.count; ++i) {
+            frame.points[2 * i] = static_cast<float>(columns[i]) / (1 << subpixel_bits);
+            frame.points[2 * i + 1] = static_cast<float>(columns[frame.top_k + i]) / (1 << subpixel_bits);
+        }
+        frame.descriptors = descriptors;
+        frames.push_back(std::move(frame));
+    }
+    if (frames.size() < 2) {
+        printf("%s: need at least keypoints_0.bin, descriptors_0.bin and the same for frame 1\n", folder.c_str());
+        return -1;
+    }
+
+    // Intrinsics of scripts/slam/app.py
+    const dkd::Intrinsics intrinsics = {323.04f, 321.80f, 250.84f, 141.83f};
+    dkd::Quantization quantization;
+    dkd::MutualMatcher matcher;
+    matcher.configure(quantization, threshold);
+    std::vector<dkd::Match> matches;
+    std::vector<float> points1, points2, quality;
+
+    size_t pairs = frames.size() - 1;
+    double total_matches = 0.0;
+    double total_us[2] = {0.0, 0.0}, iterations[2] = {0.0, 0.0}, solutions[2] = {0.0, 0.0}, inliers[2] = {0.0, 0.0};
+    int failures[2] = {0, 0};
+    std::vector<float> disagreement;
+    dkd::EssentialRansac ransac(intrinsics);
+    for (size_t f = 0; f < pairs; ++f) {
+        const Frame& a = frames[f];
+        const Frame& b = frames[f + 1];
+        matcher.match(a.descriptors.data(), a.count, b.descriptors.data(), b.count, D, matches);
+        int count = static_cast<int>(matches.size());
+        total_matches += count;
+        points1.resize(2 * count);
+        points2.resize(2 * count);
+        quality.resize(count);
+        for (int k = 0; k < count; ++k) {
+            int i = matches[k].index1, j = matches[k].index2;
+            points1[2 * k] = a.points[2 * i];
+            points1[2 * k + 1] = a.points[2 * i + 1];
+            points2[2 * k] = b.points[2 * j];
+            points2[2 * k + 1] = b.points[2 * j + 1];
+            // Score by rank, 1 for the best keypoint of a frame
+            float score1 = 1.0f - static_cast<float>(i) / a.count;
+            float score2 = 1.0f - static_cast<float>(j) / b.count;
+            quality[k] = score1 * score2 * matches[k].similarity;
+        }
+
+        dkd::RelativePose poses[2];
+        bool success[2];
+        for (int progressive = 0; progressive < 2; ++progressive) {
+            dkd::RelativePose& pose = poses[progressive];
+            total_us[progressive] += time_us([&]() {
+                success[progressive] = progressive
+                    ? ransac.estimate(points1.data(), points2.data(), quality.data(), count, pose)
+                    : ransac.estimate(points1.data(), points2.data(), count, pose);
+            }, 3);
+            failures[progressive] += !success[progressive];
+            iterations[progressive] += pose.iterations;
+            solutions[progressive] += pose.solution_iteration;
+            inliers[progressive] += pose.inliers;
+        }
+        if (success[0] && success[1]) {
+            disagreement.push_back(rotation_error_deg(poses[0].R, poses[1].R));
+        }
+    }
+
+    printf("%zu frame pairs, %.1f mutual matches a pair at %.2f\n", pairs, total_matches / pairs, threshold);
+    printf("%10s %10s %10s %10s %10s %10s\n", "sampling", "us", "iterations", "solution", "inliers", "failures");
+    for (int progressive = 0; progressive < 2; ++progressive) {
+        printf("%10s %10.1f %10.1f %10.1f %10.1f %10d\n", progressive ? "prosac" : "uniform", total_us[progressive] / pairs,
+               iterations[progressive] / pairs, solutions[progressive] / pairs, inliers[progressive] / pairs,
+               failures[progressive]);
+    }
+    if (!disagreement.empty()) {
+        std::nth_element(disagreement.begin(), disagreement.begin() + disagreement.size() / 2, disagreement.end());
+        printf("median rotation between the two estimates %.3f deg\n", disagreement[disagreement.size() / 2]);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "replay") == 0) {
+        return replay(argc - 2, argv + 2);
+    }
+    if (argc > 1 && strcmp(argv[1], "recall") == 0) {
+        return recall(argc - 2, argv + 2);
+    }
+    if (argc > 1 && strcmp(argv[1], "sampling") == 0) {
+        return sampling(argc - 2, argv + 2);
+    }
+
+    bool found = false;
+    for (const Section& section : SECTIONS) {
+        if (argc > 1 && strcmp(argv[1], section.name) != 0) {
+            continue;
+        }
+        found = true;
+        section.run();
+    }
+
+    if (!found) {
+        printf("Unknown section: %s\n", argv[1]);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,787 @@
+#include "dkd_kernels.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#if !defined(DKD_DISABLE_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define DKD_USE_NEON
+#elif !defined(DKD_DISABLE_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define DKD_USE_SSE2
+#endif
+
+namespace dkd {
+
+namespace {
+
+// Largest radius for which the horizontal pass scans the whole kernel directly
+const int DIRECT_MAX_RADIUS = 4;
+
+// 16 lane uint8 vector of the active backend
+#if defined(DKD_USE_NEON)
+typedef uint8x16_t u8x16;
+inline u8x16 load16(const uint8_t* p) { return vld1q_u8(p); }
+inline void store16(uint8_t* p, u8x16 v) { vst1q_u8(p, v); }
+inline u8x16 max16(u8x16 a, u8x16 b) { return vmaxq_u8(a, b); }
+#elif defined(DKD_USE_SSE2)
+typedef __m128i u8x16;
+inline u8x16 load16(const uint8_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+inline void store16(uint8_t* p, u8x16 v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+inline u8x16 max16(u8x16 a, u8x16 b) { return _mm_max_epu8(a, b); }
+#else
+struct u8x16 { uint8_t v[16]; };
+inline u8x16 load16(const uint8_t* p) { u8x16 r; std::memcpy(r.v, p, 16); return r; }
+inline void store16(uint8_t* p, u8x16 v) { std::memcpy(p, v.v, 16); }
+inline u8x16 max16(u8x16 a, u8x16 b) {
+    for (int k = 0; k < 16; ++k) {
+        a.v[k] = std::max(a.v[k], b.v[k]);
+    }
+    return a;
+}
+#endif
+
+// 16 bit mask of the pixels that are equal to their pooled value and above the threshold
+inline uint32_t local_max_bits16(u8x16 scores, u8x16 pooled, uint8_t threshold) {
+#if defined(DKD_USE_NEON)
+    static const uint8_t bit_weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t hits = vandq_u8(vceqq_u8(scores, pooled), vcgtq_u8(scores, vdupq_n_u8(threshold)));
+    // NEON has no movemask, so weight every lane by its bit and add the halves horizontally
+    uint8x16_t bits = vandq_u8(hits, vld1q_u8(bit_weights));
+    uint8x8_t sum = vpadd_u8(vget_low_u8(bits), vget_high_u8(bits));
+    sum = vpadd_u8(sum, sum);
+    sum = vpadd_u8(sum, sum);
+    return vget_lane_u16(vreinterpret_u16_u8(sum), 0);
+#elif defined(DKD_USE_SSE2)
+    __m128i maxima = _mm_cmpeq_epi8(scores, pooled);
+    // SSE2 only compares signed bytes, flipping the sign bit makes it an unsigned comparison
+    __m128i sign = _mm_set1_epi8(static_cast<char>(0x80));
+    __m128i above = _mm_cmpgt_epi8(_mm_xor_si128(scores, sign), _mm_set1_epi8(static_cast<char>(threshold ^ 0x80)));
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(maxima, above)));
+#else
+    uint32_t bits = 0;
+    for (int k = 0; k < 16; ++k) {
+        if (scores.v[k] == pooled.v[k] && scores.v[k] > threshold) {
+            bits |= 1u << k;
+        }
+    }
+    return bits;
+#endif
+}
+
+// Bilinear interpolation of 16 lanes: a * wa + b * wb + c * wc + d * wd with uint8 weights
+// summing up to 256, so the uint16 accumulators never overflow
+#if defined(DKD_USE_NEON)
+struct u16x16 { uint16x8_t lo, hi; };
+inline u16x16 bilinear16(const uint8_t* a, const uint8_t* b, const uint8_t* c, const uint8_t* d,
+                         const uint8_t* wa, const uint8_t* wb, const uint8_t* wc, const uint8_t* wd) {
+    uint8x16_t va = vld1q_u8(a), vb = vld1q_u8(b), vc = vld1q_u8(c), vd = vld1q_u8(d);
+    uint8x16_t ka = vld1q_u8(wa), kb = vld1q_u8(wb), kc = vld1q_u8(wc), kd = vld1q_u8(wd);
+    u16x16 acc;
+    acc.lo = vmull_u8(vget_low_u8(va), vget_low_u8(ka));
+    acc.lo = vmlal_u8(acc.lo, vget_low_u8(vb), vget_low_u8(kb));
+    acc.lo = vmlal_u8(acc.lo, vget_low_u8(vc), vget_low_u8(kc));
+    acc.lo = vmlal_u8(acc.lo, vget_low_u8(vd), vget_low_u8(kd));
+    acc.hi = vmull_u8(vget_high_u8(va), vget_high_u8(ka));
+    acc.hi = vmlal_u8(acc.hi, vget_high_u8(vb), vget_high_u8(kb));
+    acc.hi = vmlal_u8(acc.hi, vget_high_u8(vc), vget_high_u8(kc));
+    acc.hi = vmlal_u8(acc.hi, vget_high_u8(vd), vget_high_u8(kd));
+    return acc;
+}
+// Back to the uint8 quantization, rounded
+inline void store_bilinear16(uint8_t* p, const u16x16& acc) {
+    vst1q_u8(p, vcombine_u8(vrshrn_n_u16(acc.lo, 8), vrshrn_n_u16(acc.hi, 8)));
+}
+// Quantized value with 4 fractional bits, rounded
+inline void store_bilinear16(int16_t* p, const u16x16& acc) {
+    vst1q_s16(p, vreinterpretq_s16_u16(vrshrq_n_u16(acc.lo, 4)));
+    vst1q_s16(p + 8, vreinterpretq_s16_u16(vrshrq_n_u16(acc.hi, 4)));
+}
+#elif defined(DKD_USE_SSE2)
+struct u16x16 { __m128i lo, hi; };
+inline u16x16 bilinear16(const uint8_t* a, const uint8_t* b, const uint8_t* c, const uint8_t* d,
+                         const uint8_t* wa, const uint8_t* wb, const uint8_t* wc, const uint8_t* wd) {
+    // No widening multiply on SSE2, so unpack to 16 bits first. The products fit
+    // into 16 bits, so the low half of the multiplication is exact
+    const __m128i zero = _mm_setzero_si128();
+    const uint8_t* values[4] = {a, b, c, d};
+    const uint8_t* weights[4] = {wa, wb, wc, wd};
+    u16x16 acc = {zero, zero};
+    for (int k = 0; k < 4; ++k) {
+        __m128i v = load16(values[k]);
+        __m128i w = load16(weights[k]);
+        acc.lo = _mm_add_epi16(acc.lo, _mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), _mm_unpacklo_epi8(w, zero)));
+        acc.hi = _mm_add_epi16(acc.hi, _mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), _mm_unpackhi_epi8(w, zero)));
+    }
+    return acc;
+}
+inline void store_bilinear16(uint8_t* p, const u16x16& acc) {
+    const __m128i half = _mm_set1_epi16(128);
+    __m128i lo = _mm_srli_epi16(_mm_add_epi16(acc.lo, half), 8);
+    __m128i hi = _mm_srli_epi16(_mm_add_epi16(acc.hi, half), 8);
+    store16(p, _mm_packus_epi16(lo, hi));
+}
+inline void store_bilinear16(int16_t* p, const u16x16& acc) {
+    const __m128i half = _mm_set1_epi16(8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_srli_epi16(_mm_add_epi16(acc.lo, half), 4));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p + 8), _mm_srli_epi16(_mm_add_epi16(acc.hi, half), 4));
+}
+#else
+struct u16x16 { uint16_t v[16]; };
+inline u16x16 bilinear16(const uint8_t* a, const uint8_t* b, const uint8_t* c, const uint8_t* d,
+                         const uint8_t* wa, const uint8_t* wb, const uint8_t* wc, const uint8_t* wd) {
+    u16x16 acc;
+    for (int k = 0; k < 16; ++k) {
+        acc.v[k] = static_cast<uint16_t>(a[k] * wa[k] + b[k] * wb[k] + c[k] * wc[k] + d[k] * wd[k]);
+    }
+    return acc;
+}
+inline void store_bilinear16(uint8_t* p, const u16x16& acc) {
+    for (int k = 0; k < 16; ++k) {
+        p[k] = static_cast<uint8_t>((acc.v[k] + 128) >> 8);
+    }
+}
+inline void store_bilinear16(int16_t* p, const u16x16& acc) {
+    for (int k = 0; k < 16; ++k) {
+        p[k] = static_cast<int16_t>((acc.v[k] + 8) >> 4);
+    }
+}
+#endif
+
+// Scalar versions of the above for the tails
+inline uint8_t bilinear_value(uint32_t acc, uint8_t*) { return static_cast<uint8_t>((acc + 128) >> 8); }
+inline int16_t bilinear_value(uint32_t acc, int16_t*) { return static_cast<int16_t>((acc + 8) >> 4); }
+
+// Radius the kernels below take from their argument instead of the template one
+const int DYNAMIC_RADIUS = -1;
+
+// The kernels below are written once for both the radii known at compile time and the
+// runtime one. With a fixed radius the tap loops have constant trip counts and unroll
+// into straight runs of loads and max instructions
+template <int R>
+inline int kernel_radius(int radius) { return R == DYNAMIC_RADIUS ? radius : R; }
+
+// Horizontal (2r+1) dilation of a row scanning the whole kernel directly, all the taps
+// of 16 pixels stay in a register. src holds cols + 2r pixels
+template <int R>
+void dilate_row_direct(const uint8_t* src, uint8_t* dst, int cols, int radius, uint8_t*) {
+    const int taps = 2 * kernel_radius<R>(radius) + 1;
+    int j = 0;
+#if defined(DKD_USE_NEON) || defined(DKD_USE_SSE2)
+    for (; j + 16 <= cols; j += 16) {
+        u8x16 pooled = load16(src + j);
+        for (int k = 1; k < taps; ++k) {
+            pooled = max16(pooled, load16(src + j + k));
+        }
+        store16(dst + j, pooled);
+    }
+#endif
+    for (; j < cols; ++j) {
+        uint8_t pooled = src[j];
+        for (int k = 1; k < taps; ++k) {
+            pooled = std::max(pooled, src[j + k]);
+        }
+        dst[j] = pooled;
+    }
+}
+
+// Runtime radius, the direct kernel for the small ones and van Herk/Gil-Werman above
+void dilate_row_any(const uint8_t* src, uint8_t* dst, int cols, int radius, uint8_t* scratch) {
+    if (radius <= DIRECT_MAX_RADIUS) {
+        dilate_row_direct<DYNAMIC_RADIUS>(src, dst, cols, radius, scratch);
+    } else {
+        running_max_1d(src, dst, cols, radius, scratch);
+    }
+}
+
+// Vertical (2r+1) dilation of the rolling window, compared against the center row and
+// the threshold, packed into the candidate mask 16 pixels at a time
+template <int R>
+void pool_row(const uint8_t* ring, size_t row_size, int radius, const uint8_t* center,
+              int w_start, int w_stop, uint8_t threshold, uint8_t* row_mask) {
+    const int kernel_size = 2 * kernel_radius<R>(radius) + 1;
+    for (int c = w_start / 16 * 16; c < w_stop; c += 16) {
+        u8x16 pooled = load16(ring + c);
+        for (int k = 1; k < kernel_size; ++k) {
+            pooled = max16(pooled, load16(ring + k * row_size + c));
+        }
+        uint32_t bits = local_max_bits16(load16(center + c), pooled, threshold);
+
+        int lo = std::max(w_start - c, 0);
+        int hi = std::min(w_stop - c, 16);
+        bits &= ((1u << hi) - 1) & ~((1u << lo) - 1);
+
+        row_mask[c / 8] = static_cast<uint8_t>(bits);
+        row_mask[c / 8 + 1] = static_cast<uint8_t>(bits >> 8);
+    }
+}
+
+// Soft-argmax of every keypoint over its (2r+1)x(2r+1) neighbourhood
+template <int R>
+void soft_argmax_refine(const uint16_t* weights, int radius, const uint8_t* scores, int W,
+                        const int32_t* xy, int count, int32_t* xy_q8) {
+    const int r = kernel_radius<R>(radius);
+    const int one = 1 << SUBPIXEL_BITS;
+
+    for (int i = 0; i < count; ++i) {
+        int x = xy[2 * i];
+        int y = xy[2 * i + 1];
+        const uint8_t* center = scores + static_cast<size_t>(y) * W + x;
+        int peak = *center;
+
+        // Center weight is 1.0, so the sum never is zero
+        int32_t sum = 0, sum_dx = 0, sum_dy = 0;
+        for (int dy = -r; dy <= r; ++dy) {
+            const uint8_t* row = center + static_cast<ptrdiff_t>(dy) * W;
+            for (int dx = -r; dx <= r; ++dx) {
+                // A neighbour above the center only happens when the window is larger
+                // than the NMS one, it just gets the full weight
+                int32_t weight = weights[std::max(peak - row[dx], 0)];
+                sum += weight;
+                sum_dx += weight * dx;
+                sum_dy += weight * dy;
+            }
+        }
+
+        // Round to nearest, the offsets are within [-r, r]
+        int64_t offset_x = static_cast<int64_t>(sum_dx) * one;
+        int64_t offset_y = static_cast<int64_t>(sum_dy) * one;
+        offset_x += offset_x >= 0 ? sum / 2 : -sum / 2;
+        offset_y += offset_y >= 0 ? sum / 2 : -sum / 2;
+        xy_q8[2 * i] = x * one + static_cast<int32_t>(offset_x / sum);
+        xy_q8[2 * i + 1] = y * one + static_cast<int32_t>(offset_y / sum);
+    }
+}
+
+} // namespace
+
+uint8_t quantize_score_threshold(float score, const Quantization& quantization) {
+    // q > t <=> (q - zp) * scale > score <=> q > zp + score / scale, q is an integer
+    double t = std::floor(quantization.zero_point + static_cast<double>(score) / quantization.scale);
+    return static_cast<uint8_t>(std::min(std::max(t, 0.0), 255.0));
+}
+
+void SigmoidLut::configure(const Quantization& quantization) {
+    for (int q = 0; q < 256; ++q) {
+        float x = (q - quantization.zero_point) * quantization.scale;
+        m_lut[q] = 1.0f / (1.0f + std::exp(-x));
+    }
+}
+
+uint8_t SigmoidLut::threshold(float probability) const {
+    // The LUT is monotonic, the threshold is the last score not above the probability
+    int t = 0;
+    while (t < 255 && m_lut[t + 1] <= probability) {
+        ++t;
+    }
+    return static_cast<uint8_t>(t);
+}
+
+void running_max_1d(const uint8_t* src, uint8_t* dst, int n, int radius, uint8_t* scratch) {
+    if (radius == 0) {
+        std::memcpy(dst, src, n);
+        return;
+    }
+
+    int length = n + 2 * radius;
+    int kernel_size = 2 * radius + 1;
+    uint8_t* prefix = scratch;
+    uint8_t* suffix = scratch + length;
+
+    // Running max from the start and from the end of every kernel sized block
+    for (int block = 0; block < length; block += kernel_size) {
+        int end = std::min(block + kernel_size, length);
+
+        prefix[block] = src[block];
+        for (int i = block + 1; i < end; ++i) {
+            prefix[i] = std::max(prefix[i - 1], src[i]);
+        }
+
+        suffix[end - 1] = src[end - 1];
+        for (int i = end - 2; i >= block; --i) {
+            suffix[i] = std::max(suffix[i + 1], src[i]);
+        }
+    }
+
+    // Any window spans at most two blocks: the tail of one and the head of the next
+    for (int i = 0; i < n; ++i) {
+        dst[i] = std::max(suffix[i], prefix[i + 2 * radius]);
+    }
+}
+
+void LocalMaxStream::reset(const uint8_t* scores, int W,
+                           int h_start, int w_start, int h_stop, int w_stop,
+                           int radius, uint8_t threshold) {
+    m_scores = scores;
+    m_W = W;
+    m_h_start = h_start;
+    m_w_start = w_start;
+    m_h_stop = h_stop;
+    m_w_stop = w_stop;
+    m_radius = radius;
+    m_threshold = threshold;
+    m_next_y = h_start;
+
+    int cols = w_stop - w_start;
+    if (h_stop <= h_start || cols <= 0) {
+        m_next_y = h_stop;
+        return;
+    }
+
+    // Rows are staged in buffers indexed by the map column and padded to whole
+    // 16 pixel chunks, so the SIMD loops can run past the window without bounds checks
+    int kernel_size = 2 * radius + 1;
+    m_row_size = W + 16;
+    m_mask_stride = nms_mask_stride(W);
+    reserve(W, radius);
+    m_ring = m_buffer.data();
+    m_center = m_ring + kernel_size * m_row_size;
+    m_row_mask = m_center + m_row_size;
+    m_line_scratch = m_row_mask + m_mask_stride;
+
+    // Kernels unrolled for the radius when there are ones for it
+    m_dilate_row = &dilate_row_any;
+    m_pool_row = &pool_row<DYNAMIC_RADIUS>;
+    if (m_specialized) {
+        switch (radius) {
+        case 1: m_dilate_row = &dilate_row_direct<1>; m_pool_row = &pool_row<1>; break;
+        case 2: m_dilate_row = &dilate_row_direct<2>; m_pool_row = &pool_row<2>; break;
+        case 3: m_dilate_row = &dilate_row_direct<3>; m_pool_row = &pool_row<3>; break;
+        case 4: m_dilate_row = &dilate_row_direct<4>; m_pool_row = &pool_row<4>; break;
+        }
+    }
+
+    // Prime the window with all the rows above the first output row and the ones
+    // below it except the last, which next_row() adds itself
+    for (int y = h_start - radius; y < h_start + radius; ++y) {
+        dilate_row(y);
+    }
+}
+
+void LocalMaxStream::reserve(int W, int radius) {
+    size_t required = (2 * radius + 2) * static_cast<size_t>(W + 16) + nms_mask_stride(W) + 2 * (W + 2 * radius);
+    if (m_buffer.size() < required) {
+        m_buffer.resize(required, 0);
+    }
+}
+
+bool LocalMaxStream::next_row(int& y, const uint8_t*& row_mask) {
+    if (m_next_y >= m_h_stop) {
+        return false;
+    }
+
+    y = m_next_y++;
+    int cols = m_w_stop - m_w_start;
+
+    // Slide the window down by one row
+    dilate_row(y + m_radius);
+    std::memcpy(m_center + m_w_start, m_scores + static_cast<size_t>(y) * m_W + m_w_start, cols);
+
+    // Dilate vertically, compare, threshold and pack 16 pixels at a time
+    std::memset(m_row_mask, 0, m_mask_stride);
+    m_pool_row(m_ring, m_row_size, m_radius, m_center, m_w_start, m_w_stop, m_threshold, m_row_mask);
+
+    row_mask = m_row_mask;
+    return true;
+}
+
+void LocalMaxStream::dilate_row(int y) {
+    int kernel_size = 2 * m_radius + 1;
+    int slot = (y - (m_h_start - m_radius)) % kernel_size;
+    uint8_t* dst = m_ring + static_cast<size_t>(slot) * m_row_size + m_w_start;
+    const uint8_t* src = m_scores + static_cast<size_t>(y) * m_W + (m_w_start - m_radius);
+    m_dilate_row(src, dst, m_w_stop - m_w_start, m_radius, m_line_scratch);
+}
+
+void HistogramTopK::reserve(size_t candidates) {
+    m_candidates.reserve(candidates);
+    m_scores.reserve(candidates);
+}
+
+void HistogramTopK::clear() {
+    m_candidates.clear();
+    m_scores.clear();
+    std::memset(m_histogram, 0, sizeof(m_histogram));
+}
+
+int HistogramTopK::select(int k, int32_t* xy, uint8_t* scores) {
+    int count = static_cast<int>(std::min<size_t>(std::max(k, 0), m_candidates.size()));
+    if (count == 0) {
+        return 0;
+    }
+
+    // Walk the histogram from the top until k candidates are covered. Every bucket
+    // above the cutoff is taken whole, the cutoff one only partially
+    uint32_t offsets[256];
+    uint32_t taken = 0;
+    int cutoff = 255;
+    for (; cutoff >= 0; --cutoff) {
+        offsets[cutoff] = taken;
+        taken += m_histogram[cutoff];
+        if (taken >= static_cast<uint32_t>(count)) {
+            break;
+        }
+    }
+    uint32_t cutoff_quota = count - offsets[cutoff];
+
+    // Stable scatter, so equal scores keep their push order
+    for (size_t i = 0; i < m_candidates.size(); ++i) {
+        int score = m_scores[i];
+        if (score < cutoff) {
+            continue;
+        }
+        if (score == cutoff) {
+            if (cutoff_quota == 0) {
+                continue;
+            }
+            --cutoff_quota;
+        }
+
+        uint32_t slot = offsets[score]++;
+        xy[2 * slot] = static_cast<int32_t>(m_candidates[i] & 0xffff);
+        xy[2 * slot + 1] = static_cast<int32_t>(m_candidates[i] >> 16);
+        if (scores) {
+            scores[slot] = static_cast<uint8_t>(score);
+        }
+    }
+
+    return count;
+}
+
+void GridTopK::reserve(size_t candidates) {
+    m_candidates.reserve(candidates);
+    m_scores.reserve(candidates);
+    m_cells.reserve(candidates);
+}
+
+void GridTopK::reset(int cells_x, int cells_y, int h_start, int w_start, int h_stop, int w_stop) {
+    cells_x = std::max(cells_x, 1);
+    cells_y = std::max(cells_y, 1);
+    int rows = h_stop - h_start;
+    int cols = w_stop - w_start;
+
+    if (cells_x != m_cells_x || cells_y != m_cells_y ||
+        rows != static_cast<int>(m_cell_of_row.size()) || cols != static_cast<int>(m_cell_of_col.size())) {
+        m_cell_of_row.resize(rows);
+        for (int y = 0; y < rows; ++y) {
+            m_cell_of_row[y] = static_cast<uint16_t>(y * cells_y / rows * cells_x);
+        }
+        m_cell_of_col.resize(cols);
+        for (int x = 0; x < cols; ++x) {
+            m_cell_of_col[x] = static_cast<uint16_t>(x * cells_x / cols);
+        }
+        m_cells_x = cells_x;
+        m_cells_y = cells_y;
+        m_cell_cutoffs.resize(cells());
+        m_cell_cutoff_quotas.resize(cells());
+    }
+    m_h_start = h_start;
+    m_w_start = w_start;
+
+    m_candidates.clear();
+    m_scores.clear();
+    m_cells.clear();
+    m_histograms.assign(cells() * 256, 0);
+    std::memset(m_histogram, 0, sizeof(m_histogram));
+    m_min_score = 255;
+    m_max_score = 0;
+}
+
+int GridTopK::select(int k, int32_t* xy, uint8_t* scores) {
+    int count = static_cast<int>(std::min<size_t>(std::max(k, 0), m_candidates.size()));
+    if (count == 0) {
+        return 0;
+    }
+
+    // Per cell pass: take the best quota keypoints of every cell
+    uint32_t selected[256] = {};
+    int num_cells = cells();
+    int taken = 0;
+    for (int cell = 0; cell < num_cells; ++cell) {
+        const uint32_t* histogram = &m_histograms[cell * 256];
+        uint32_t quota = count / num_cells + (cell < count % num_cells ? 1 : 0);
+
+        // Nothing taken unless the quota runs out or the cell does
+        int cutoff = 256;
+        uint32_t cutoff_quota = 0;
+        for (int score = m_max_score; score >= m_min_score && quota > 0; --score) {
+            uint32_t take = std::min(histogram[score], quota);
+            if (take > 0) {
+                selected[score] += take;
+                quota -= take;
+                taken += take;
+                cutoff = score;
+                cutoff_quota = take;
+            }
+        }
+        m_cell_cutoffs[cell] = cutoff;
+        m_cell_cutoff_quotas[cell] = cutoff_quota;
+    }
+
+    // Unused quota goes to the best remaining keypoints regardless of their cell
+    int leftover = count - taken;
+    int cutoff = 256;
+    uint32_t cutoff_quota = 0;
+    for (int score = m_max_score; score >= m_min_score && leftover > 0; --score) {
+        uint32_t take = std::min<uint32_t>(m_histogram[score] - selected[score], leftover);
+        if (take > 0) {
+            selected[score] += take;
+            leftover -= take;
+            cutoff = score;
+            cutoff_quota = take;
+        }
+    }
+
+    uint32_t offsets[256];
+    uint32_t offset = 0;
+    for (int score = 255; score >= 0; --score) {
+        offsets[score] = offset;
+        offset += selected[score];
+    }
+
+    // Stable scatter, so equal scores keep their push order
+    for (size_t i = 0; i < m_candidates.size(); ++i) {
+        int score = m_scores[i];
+        int cell = m_cells[i];
+        if (score < m_cell_cutoffs[cell] || (score == m_cell_cutoffs[cell] && m_cell_cutoff_quotas[cell] == 0)) {
+            // Not within its cell quota, may still be picked by the redistribution
+            if (score < cutoff || (score == cutoff && cutoff_quota == 0)) {
+                continue;
+            }
+            if (score == cutoff) {
+                --cutoff_quota;
+            }
+        } else if (score == m_cell_cutoffs[cell]) {
+            --m_cell_cutoff_quotas[cell];
+        }
+
+        uint32_t slot = offsets[score]++;
+        xy[2 * slot] = static_cast<int32_t>(m_candidates[i] & 0xffff);
+        xy[2 * slot + 1] = static_cast<int32_t>(m_candidates[i] >> 16);
+        if (scores) {
+            scores[slot] = static_cast<uint8_t>(score);
+        }
+    }
+
+    return count;
+}
+
+void SoftArgmax::configure(int radius, float temperature) {
+    m_radius = radius;
+    for (int d = 0; d < 256; ++d) {
+        m_weights[d] = static_cast<uint16_t>(std::lround(65535.0 * std::exp(-d / temperature)));
+    }
+}
+
+void SoftArgmax::refine(const uint8_t* scores, int W, const int32_t* xy, int count, int32_t* xy_q8) const {
+    if (m_specialized) {
+        switch (m_radius) {
+        case 1: soft_argmax_refine<1>(m_weights, m_radius, scores, W, xy, count, xy_q8); return;
+        case 2: soft_argmax_refine<2>(m_weights, m_radius, scores, W, xy, count, xy_q8); return;
+        case 3: soft_argmax_refine<3>(m_weights, m_radius, scores, W, xy, count, xy_q8); return;
+        case 4: soft_argmax_refine<4>(m_weights, m_radius, scores, W, xy, count, xy_q8); return;
+        }
+    }
+    soft_argmax_refine<DYNAMIC_RADIUS>(m_weights, m_radius, scores, W, xy, count, xy_q8);
+}
+
+void DescriptorGather::reserve(int count) {
+    m_order.reserve(count);
+    m_pixels.reserve(count);
+    m_rows.reserve(count);
+}
+
+void DescriptorGather::gather(const uint8_t* descriptor_map, DescriptorLayout layout, int D, int H, int W,
+                              const int32_t* pixels, int count, uint8_t* descriptors) {
+    const size_t plane_size = static_cast<size_t>(H) * W;
+
+    if (layout == DescriptorLayout::HWC) {
+        // Just a copy per keypoint, the next ones are prefetched while copying
+        const int ahead = 4;
+        for (int i = 0; i < count; ++i) {
+            if (i + ahead < count && pixels[i + ahead] >= 0) {
+                __builtin_prefetch(descriptor_map + static_cast<size_t>(pixels[i + ahead]) * D);
+            }
+            uint8_t* row = descriptors + static_cast<size_t>(i) * D;
+            if (pixels[i] < 0) {
+                std::memset(row, 0, D);
+            } else {
+                std::memcpy(row, descriptor_map + static_cast<size_t>(pixels[i]) * D, D);
+            }
+        }
+        return;
+    }
+
+    m_order.clear();
+    for (int i = 0; i < count; ++i) {
+        if (pixels[i] < 0) {
+            std::memset(descriptors + static_cast<size_t>(i) * D, 0, D);
+        } else {
+            m_order.push_back(static_cast<uint64_t>(pixels[i]) << 32 | static_cast<uint32_t>(i));
+        }
+    }
+    std::sort(m_order.begin(), m_order.end());
+
+    int n = static_cast<int>(m_order.size());
+    m_pixels.resize(n);
+    m_rows.resize(n);
+    for (int j = 0; j < n; ++j) {
+        m_pixels[j] = static_cast<int32_t>(m_order[j] >> 32);
+        m_rows[j] = static_cast<int32_t>(m_order[j] & 0xffffffff);
+    }
+
+    const int32_t* sorted_pixels = m_pixels.data();
+    const int32_t* rows = m_rows.data();
+    for (int d = 0; d < D; ++d) {
+        const uint8_t* plane = descriptor_map + d * plane_size;
+        // A whole plane worth of reads ahead, the lines arrive before they are needed
+        const uint8_t* next_plane = d + 1 < D ? plane + plane_size : plane;
+        for (int j = 0; j < n; ++j) {
+            __builtin_prefetch(next_plane + sorted_pixels[j]);
+            descriptors[static_cast<size_t>(rows[j]) * D + d] = plane[sorted_pixels[j]];
+        }
+    }
+}
+
+void BilinearSampler::reserve(int count) {
+    int padded = (count + 15) / 16 * 16;
+    m_order.reserve(count);
+    m_pixels.reserve(padded);
+    m_rows.reserve(padded);
+    m_right.reserve(padded);
+    m_down.reserve(padded);
+    m_weights.reserve(4 * padded);
+}
+
+template <typename T>
+void BilinearSampler::sample_impl(const uint8_t* descriptor_map, DescriptorLayout layout, int D, int H, int W,
+                                  const int32_t* xy_q8, int count, T* descriptors) {
+    const size_t plane_size = static_cast<size_t>(H) * W;
+    const int fraction_shift = SUBPIXEL_BITS - WEIGHT_BITS;
+    const int one = 1 << WEIGHT_BITS;
+
+    // Top left pixel, the offsets of its neighbours and the four weights of every keypoint
+    m_order.clear();
+    for (int i = 0; i < count; ++i) {
+        if (xy_q8[2 * i] < 0 || xy_q8[2 * i + 1] < 0) {
+            std::fill(descriptors + static_cast<size_t>(i) * D, descriptors + static_cast<size_t>(i + 1) * D, T(0));
+            continue;
+        }
+        // Down to WEIGHT_BITS fractional bits, rounded
+        int x = (xy_q8[2 * i] + (1 << fraction_shift >> 1)) >> fraction_shift;
+        int y = (xy_q8[2 * i + 1] + (1 << fraction_shift >> 1)) >> fraction_shift;
+        int pixel = (y >> WEIGHT_BITS) * W + (x >> WEIGHT_BITS);
+        m_order.push_back(static_cast<uint64_t>(pixel) << 32 | static_cast<uint32_t>(i));
+    }
+    if (layout == DescriptorLayout::CHW) {
+        // Sorted to walk the planes front to back
+        std::sort(m_order.begin(), m_order.end());
+    }
+
+    // Padded to whole blocks of 16 keypoints with zero weights
+    int n = static_cast<int>(m_order.size());
+    int padded = (n + 15) / 16 * 16;
+    m_pixels.assign(padded, 0);
+    m_rows.assign(padded, 0);
+    m_right.assign(padded, 0);
+    m_down.assign(padded, 0);
+    m_weights.assign(4 * padded, 0);
+    uint8_t* w00 = m_weights.data();
+    uint8_t* w01 = w00 + padded;
+    uint8_t* w10 = w01 + padded;
+    uint8_t* w11 = w10 + padded;
+
+    for (int j = 0; j < n; ++j) {
+        int row = static_cast<int>(m_order[j] & 0xffffffff);
+        int x = (xy_q8[2 * row] + (1 << fraction_shift >> 1)) >> fraction_shift;
+        int y = (xy_q8[2 * row + 1] + (1 << fraction_shift >> 1)) >> fraction_shift;
+        int fx = x & (one - 1);
+        int fy = y & (one - 1);
+
+        m_pixels[j] = static_cast<int32_t>(m_order[j] >> 32);
+        m_rows[j] = row;
+        // Neighbours with zero weight are not read, so there is no access past the borders
+        m_right[j] = fx > 0 ? 1 : 0;
+        m_down[j] = fy > 0 ? W : 0;
+
+        int weight = (one - fx) * (one - fy);
+        if (weight == one * one) {
+            // Right on a pixel. 256 doesn't fit into uint8, so it is split over the
+            // pixel and itself as its right neighbour
+            w00[j] = w01[j] = static_cast<uint8_t>(weight / 2);
+            continue;
+        }
+        w00[j] = static_cast<uint8_t>(weight);
+        w01[j] = static_cast<uint8_t>(fx * (one - fy));
+        w10[j] = static_cast<uint8_t>((one - fx) * fy);
+        w11[j] = static_cast<uint8_t>(fx * fy);
+    }
+
+    if (layout == DescriptorLayout::HWC) {
+        // A keypoint is four contiguous rows of D channels, SIMD over the channels
+        uint8_t weights[4][16];
+        for (int j = 0; j < n; ++j) {
+            const uint8_t* a = descriptor_map + static_cast<size_t>(m_pixels[j]) * D;
+            const uint8_t* b = a + static_cast<size_t>(m_right[j]) * D;
+            const uint8_t* c = a + static_cast<size_t>(m_down[j]) * D;
+            const uint8_t* d = c + static_cast<size_t>(m_right[j]) * D;
+            T* out = descriptors + static_cast<size_t>(m_rows[j]) * D;
+            std::memset(weights[0], w00[j], 16);
+            std::memset(weights[1], w01[j], 16);
+            std::memset(weights[2], w10[j], 16);
+            std::memset(weights[3], w11[j], 16);
+
+            int channel = 0;
+            for (; channel + 16 <= D; channel += 16) {
+                store_bilinear16(out + channel, bilinear16(a + channel, b + channel, c + channel, d + channel,
+                                                           weights[0], weights[1], weights[2], weights[3]));
+            }
+            for (; channel < D; ++channel) {
+                uint32_t acc = a[channel] * w00[j] + b[channel] * w01[j] + c[channel] * w10[j] + d[channel] * w11[j];
+                out[channel] = bilinear_value(acc, out);
+            }
+        }
+        return;
+    }
+
+    // CHW: SIMD over blocks of 16 keypoints. Their four neighbours are gathered from
+    // every plane into small staging vectors, the weights stay the same for all planes
+    uint8_t staging[4][16];
+    T result[16];
+    for (int channel = 0; channel < D; ++channel) {
+        const uint8_t* plane = descriptor_map + channel * plane_size;
+        const uint8_t* next_plane = channel + 1 < D ? plane + plane_size : plane;
+        for (int block = 0; block < padded; block += 16) {
+            int lanes = std::min(16, n - block);
+            for (int k = 0; k < lanes; ++k) {
+                int j = block + k;
+                const uint8_t* top = plane + m_pixels[j];
+                const uint8_t* bottom = top + m_down[j];
+                __builtin_prefetch(next_plane + m_pixels[j]);
+                __builtin_prefetch(next_plane + m_pixels[j] + m_down[j]);
+                staging[0][k] = top[0];
+                staging[1][k] = top[m_right[j]];
+                staging[2][k] = bottom[0];
+                staging[3][k] = bottom[m_right[j]];
+            }
+            store_bilinear16(result, bilinear16(staging[0], staging[1], staging[2], staging[3],
+                                                w00 + block, w01 + block, w10 + block, w11 + block));
+            for (int k = 0; k < lanes; ++k) {
+                descriptors[static_cast<size_t>(m_rows[block + k]) * D + channel] = result[k];
+            }
+        }
+    }
+}
+
+void BilinearSampler::sample(const uint8_t* descriptor_map, DescriptorLayout layout, int D, int H, int W,
+                             const int32_t* xy_q8, int count, uint8_t* descriptors) {
+    sample_impl(descriptor_map, layout, D, H, W, xy_q8, count, descriptors);
+}
+
+void BilinearSampler::sample(const uint8_t* descriptor_map, DescriptorLayout layout, int D, int H, int W,
+                             const int32_t* xy_q8, int count, int16_t* descriptors) {
+    sample_impl(descriptor_map, layout, D, H, W, xy_q8, count, descriptors);
+}
+
+} // namespace dkd
@@ -0,0 +1,826 @@
+#include "dkd_reference.h"
+
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <queue>
+#include <random>
+
+#include "dkd_kernels.h"
+
+/*
+* Helpers
+*/
+
+std::vector<uint8_t> make_scoremap(int H, int W, uint32_t seed) {
+    std::vector<uint8_t> map(H * W);
+    uint32_t state = seed;
+    auto next = [&state]() {
+        state = state * 1664525u + 1013904223u;
+        return state >> 24;
+    };
+
+    for (int i = 0; i < H * W; ++i) {
+        map[i] = static_cast<uint8_t>(next() / 2);
+    }
+    for (int blob = 0; blob < H * W / 64; ++blob) {
+        int cy = next() % H;
+        int cx = next() % W;
+        int peak = 128 + next() / 2;
+        for (int dy = -2; dy <= 2; ++dy) {
+            for (int dx = -2; dx <= 2; ++dx) {
+                int y = cy + dy, x = cx + dx;
+                if (y < 0 || y >= H || x < 0 || x >= W) continue;
+                int value = peak - 12 * (dy * dy + dx * dx);
+                if (value > map[y * W + x]) map[y * W + x] = static_cast<uint8_t>(value);
+            }
+        }
+    }
+    return map;
+}
+
+uint64_t hash_bytes(const void* data, size_t size, uint64_t hash) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+std::vector<uint8_t> make_feature_map(int D, int H, int W, uint32_t seed) {
+    std::vector<uint8_t> feature_map(static_cast<size_t>(D + 1) * H * W);
+    for (size_t i = 0; i < static_cast<size_t>(D) * H * W; ++i) {
+        feature_map[i] = static_cast<uint8_t>((static_cast<uint32_t>(i) + seed) * 2654435761u >> 24);
+    }
+    std::vector<uint8_t> scores = make_scoremap(H, W, seed);
+    std::copy(scores.begin(), scores.end(), feature_map.begin() + static_cast<size_t>(D) * H * W);
+    return feature_map;
+}
+
+void configure_deployment(DKD& dkd, int D, int H, int W) {
+    dkd.set_grid_cells(8, 5);
+    dkd.set_subpixel_refinement(true);
+    dkd.set_bilinear_sampling(true);
+    dkd.reserve(D, H, W);
+}
+
+void make_descriptor_pair(int count, int D, const dkd::Quantization& quantization, uint32_t seed,
+                          std::vector<uint8_t>& descriptors1, std::vector<uint8_t>& descriptors2,
+                          std::vector<int>* sources) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+    auto quantize = [&](std::vector<float>& v, uint8_t* out) {
+        float norm = 0.0f;
+        for (float x : v) norm += x * x;
+        norm = std::sqrt(norm);
+        for (int k = 0; k < D; ++k) {
+            float q = std::round(v[k] / norm / quantization.scale) + quantization.zero_point;
+            out[k] = static_cast<uint8_t>(std::min(std::max(q, 0.0f), 255.0f));
+        }
+    };
+
+    descriptors1.resize(static_cast<size_t>(count) * D);
+    descriptors2.resize(static_cast<size_t>(count) * D);
+    std::vector<std::vector<float>> originals(count, std::vector<float>(D));
+    for (int i = 0; i < count; ++i) {
+        for (float& x : originals[i]) x = normal(rng);
+        quantize(originals[i], descriptors1.data() + static_cast<size_t>(i) * D);
+    }
+    std::vector<int> order(count);
+    for (int i = 0; i < count; ++i) order[i] = i;
+    std::shuffle(order.begin(), order.end(), rng);
+    for (int i = 0; i < count; ++i) {
+        std::vector<float> v(D);
+        bool seen = i < count * 2 / 3;
+        for (int k = 0; k < D; ++k) {
+            v[k] = seen ? originals[order[i]][k] + 0.4f * normal(rng) : normal(rng);
+        }
+        quantize(v, descriptors2.data() + static_cast<size_t>(i) * D);
+        if (sources) {
+            sources->push_back(seen ? order[i] : -1);
+        }
+    }
+}
+
+TwoViewScene make_two_view_scene(int count, float outlier_ratio, float noise_px, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    std::normal_distribution<float> noise(0.0f, noise_px);
+
+    TwoViewScene scene;
+    scene.intrinsics = {323.04f, 321.80f, 250.84f, 141.83f};
+    Eigen::Vector3f axis(uniform(rng), uniform(rng), uniform(rng));
+    float angle = (2.0f + 3.0f * std::fabs(uniform(rng))) * static_cast<float>(M_PI) / 180.0f;
+    scene.R = Eigen::AngleAxisf(angle, axis.normalized()).toRotationMatrix();
+    scene.t = Eigen::Vector3f(uniform(rng), 0.3f * uniform(rng), 0.5f * uniform(rng)).normalized() * 0.5f;
+
+    const dkd::Intrinsics& K = scene.intrinsics;
+    auto project = [&](const Eigen::Vector3f& X, float* pixel) {
+        pixel[0] = K.fx * X.x() / X.z() + K.cx + noise(rng);
+        pixel[1] = K.fy * X.y() / X.z() + K.cy + noise(rng);
+    };
+    scene.points1.resize(2 * count);
+    scene.points2.resize(2 * count);
+    scene.outlier.resize(count);
+    for (int i = 0; i < count; ++i) {
+        float z = 8.0f + 4.0f * uniform(rng);
+        Eigen::Vector3f X(0.7f * z * uniform(rng), 0.4f * z * uniform(rng), z);
+        scene.points.push_back(X);
+        project(X, &scene.points1[2 * i]);
+        project(scene.R * X + scene.t, &scene.points2[2 * i]);
+        scene.outlier[i] = (uniform(rng) + 1.0f) * 0.5f < outlier_ratio;
+        if (scene.outlier[i]) {
+            scene.points2[2 * i] = 250.0f + 250.0f * uniform(rng);
+            scene.points2[2 * i + 1] = 142.0f + 142.0f * uniform(rng);
+        }
+    }
+    return scene;
+}
+
+float rotation_error_deg(const Eigen::Matrix3f& R1, const Eigen::Matrix3f& R2) {
+    float c = 0.5f * ((R1.transpose() * R2).trace() - 1.0f);
+    return std::acos(std::min(std::max(c, -1.0f), 1.0f)) * 180.0f / static_cast<float>(M_PI);
+}
+
+float direction_error_deg(const Eigen::Vector3f& a, const Eigen::Vector3f& b) {
+    float c = a.normalized().dot(b.normalized());
+    return std::acos(std::min(std::max(c, -1.0f), 1.0f)) * 180.0f / static_cast<float>(M_PI);
+}
+
+/*
+* Reference implementations
+*/
+
+MatrixU8 maxpool2d_reference(const MatrixU8& input,
+                             int h_start, int w_start, int h_stop, int w_stop, int radius, int stride) {
+    MatrixU8 output = MatrixU8::Zero(input.rows(), input.cols());
+
+    int kernel_size = 2 * radius + 1;
+
+    for (int i = h_start; i < h_stop; i += stride) {
+        for (int j = w_start; j < w_stop; j += stride) {
+            MatrixU8 kernel = input.block(i - radius, j - radius, kernel_size, kernel_size);
+            output(i, j) = kernel.maxCoeff();
+        }
+    }
+
+    return output;
+}
+
+void maxpool2d_separable(const uint8_t* input, uint8_t* output, int W,
+                         int h_start, int w_start, int h_stop, int w_stop,
+                         int radius, std::vector<uint8_t>& scratch) {
+    int rows = h_stop - h_start;
+    int cols = w_stop - w_start;
+    if (rows <= 0 || cols <= 0) {
+        return;
+    }
+
+    int rows_in = rows + 2 * radius;
+    size_t plane_size = static_cast<size_t>(rows_in) * cols;
+    scratch.resize(plane_size + 2 * (cols + 2 * radius));
+    uint8_t* row_max = scratch.data();
+    uint8_t* line_scratch = row_max + plane_size;
+
+    const uint8_t* src = input + static_cast<size_t>(h_start - radius) * W + (w_start - radius);
+    for (int i = 0; i < rows_in; ++i, src += W) {
+        dkd::running_max_1d(src, row_max + static_cast<size_t>(i) * cols, cols, radius, line_scratch);
+    }
+
+    for (int i = 0; i < rows; ++i) {
+        uint8_t* out = output + static_cast<size_t>(h_start + i) * W + w_start;
+        memcpy(out, row_max + static_cast<size_t>(i) * cols, cols);
+        for (int k = 1; k <= 2 * radius; ++k) {
+            const uint8_t* row = row_max + static_cast<size_t>(i + k) * cols;
+            for (int j = 0; j < cols; ++j) {
+                out[j] = std::max(out[j], row[j]);
+            }
+        }
+    }
+}
+
+void local_maxima_reference(const uint8_t* scores_map, int H, int W, int radius, int padding,
+                            std::vector<uint8_t>& pooled, std::vector<uint8_t>& scratch,
+                            std::vector<int>& candidates) {
+    Eigen::Map<const MatrixU8> scores(scores_map, H, W);
+    int full_padding = padding + radius;
+    int h_start = full_padding, w_start = full_padding;
+    int h_stop = H - full_padding, w_stop = W - full_padding;
+
+    pooled.assign(H * W, 0);
+    maxpool2d_separable(scores_map, pooled.data(), W, h_start, w_start, h_stop, w_stop, radius, scratch);
+    Eigen::Map<const MatrixU8> maxpooled(pooled.data(), H, W);
+
+    Eigen::Matrix<bool, Eigen::Dynamic, Eigen::Dynamic> max_mask = (scores.array() == maxpooled.array()).matrix();
+    MatrixU8 int_mask = max_mask.cast<uint8_t>();
+
+    candidates.clear();
+    for (int i = h_start; i < h_stop; ++i) {
+        for (int j = w_start; j < w_stop; ++j) {
+            if (max_mask(i, j) && int_mask(i, j) && scores(i, j) > 127) {
+                candidates.push_back(i * W + j);
+            }
+        }
+    }
+}
+
+void nms_mask(const uint8_t* scores, int W,
+              int h_start, int w_start, int h_stop, int w_stop,
+              int radius, uint8_t threshold, uint8_t* mask, dkd::LocalMaxStream& stream) {
+    int stride = dkd::nms_mask_stride(W);
+    stream.reset(scores, W, h_start, w_start, h_stop, w_stop, radius, threshold);
+
+    int y;
+    const uint8_t* row_mask;
+    while (stream.next_row(y, row_mask)) {
+        memcpy(mask + static_cast<size_t>(y) * stride, row_mask, stride);
+    }
+}
+
+void top_k_reference(const uint8_t* scores_map, int H, int W, const std::vector<int>& candidates, int top_k,
+                     Eigen::Matrix<int, Eigen::Dynamic, 2, Eigen::RowMajor>& keypoints) {
+    Eigen::Map<const MatrixU8> scores(scores_map, H, W);
+
+    auto cmp = [&scores](const Eigen::Vector2i& a, const Eigen::Vector2i& b) {
+        return scores(a.y(), a.x()) > scores(b.y(), b.x());
+    };
+    std::priority_queue<Eigen::Vector2i, std::vector<Eigen::Vector2i>, decltype(cmp)> pq(cmp);
+    for (int index : candidates) {
+        pq.push(Eigen::Vector2i(index % W, index / W));
+        if (pq.size() > static_cast<size_t>(top_k)) {
+            pq.pop();
+        }
+    }
+
+    keypoints.setConstant(-1);
+    for (int i = top_k - 1; !pq.empty(); --i) {
+        keypoints.row(i) = pq.top().transpose();
+        pq.pop();
+    }
+}
+
+void grid_top_k_reference(const uint8_t* scores_map, int W, const std::vector<int>& candidates, int top_k,
+                          int cells_x, int cells_y, int h_start, int w_start, int h_stop, int w_stop,
+                          std::vector<int>& selected) {
+    int num_cells = cells_x * cells_y;
+    int count = std::min<int>(top_k, static_cast<int>(candidates.size()));
+    auto by_score = [&](int a, int b) {
+        return scores_map[a] != scores_map[b] ? scores_map[a] > scores_map[b] : a < b;
+    };
+
+    std::vector<std::vector<int>> cells(num_cells);
+    for (int index : candidates) {
+        int cx = (index % W - w_start) * cells_x / (w_stop - w_start);
+        int cy = (index / W - h_start) * cells_y / (h_stop - h_start);
+        cells[cy * cells_x + cx].push_back(index);
+    }
+
+    selected.clear();
+    std::vector<int> rest;
+    for (int cell = 0; cell < num_cells; ++cell) {
+        std::sort(cells[cell].begin(), cells[cell].end(), by_score);
+        size_t quota = count / num_cells + (cell < count % num_cells ? 1 : 0);
+        for (size_t i = 0; i < cells[cell].size(); ++i) {
+            (i < quota ? selected : rest).push_back(cells[cell][i]);
+        }
+    }
+    std::sort(rest.begin(), rest.end(), by_score);
+    rest.resize(count - selected.size());
+    selected.insert(selected.end(), rest.begin(), rest.end());
+    std::sort(selected.begin(), selected.end(), by_score);
+}
+
+void soft_argmax_reference(const uint8_t* scores_map, int W, const int32_t* xy, int count,
+                           int radius, float temperature, float* refined) {
+    for (int i = 0; i < count; ++i) {
+        int x = xy[2 * i], y = xy[2 * i + 1];
+        float peak = scores_map[y * W + x];
+        float sum = 0.0f, sum_x = 0.0f, sum_y = 0.0f;
+        for (int dy = -radius; dy <= radius; ++dy) {
+            for (int dx = -radius; dx <= radius; ++dx) {
+                float d = std::max(peak - scores_map[(y + dy) * W + x + dx], 0.0f);
+                float weight = std::exp(-d / temperature);
+                sum += weight;
+                sum_x += weight * dx;
+                sum_y += weight * dy;
+            }
+        }
+        refined[2 * i] = x + sum_x / sum;
+        refined[2 * i + 1] = y + sum_y / sum;
+    }
+}
+
+void sample_descriptors_reference(const uint8_t* descriptor_map, const std::vector<int32_t>& xy, int D, int H, int W,
+                                  MatrixU8& descriptors) {
+    Eigen::Map<const MatrixU8> descriptors_reshaped(descriptor_map, D, H * W);
+    int count = static_cast<int>(xy.size() / 2);
+    descriptors.resize(count, D);
+    for (int i = 0; i < count; ++i) {
+        descriptors.row(i) = descriptors_reshaped.col(xy[2 * i + 1] * W + xy[2 * i]).transpose();
+    }
+}
+
+void sample_bilinear_reference(const uint8_t* descriptor_map, const std::vector<int32_t>& xy_q8, int D, int H, int W,
+                               Eigen::MatrixXf& descriptors) {
+    int count = static_cast<int>(xy_q8.size() / 2);
+    descriptors.resize(count, D);
+    for (int i = 0; i < count; ++i) {
+        float x = xy_q8[2 * i] / float(1 << dkd::SUBPIXEL_BITS);
+        float y = xy_q8[2 * i + 1] / float(1 << dkd::SUBPIXEL_BITS);
+        int x0 = static_cast<int>(x), y0 = static_cast<int>(y);
+        float fx = x - x0, fy = y - y0;
+        int x1 = std::min(x0 + 1, W - 1), y1 = std::min(y0 + 1, H - 1);
+        for (int d = 0; d < D; ++d) {
+            const uint8_t* plane = descriptor_map + static_cast<size_t>(d) * H * W;
+            descriptors(i, d) = (1 - fx) * (1 - fy) * plane[y0 * W + x0] + fx * (1 - fy) * plane[y0 * W + x1] +
+                                (1 - fx) * fy * plane[y1 * W + x0] + fx * fy * plane[y1 * W + x1];
+        }
+    }
+}
+
+/*
+* Matching
+*/
+
+void perform_matching_reference(const Eigen::MatrixXf& desc1, const Eigen::MatrixXf& desc2,
+                                std::vector<std::pair<int, int>>& matches, float threshold) {
+    Eigen::MatrixXf sim = desc1 * desc2.transpose();
+    sim = (sim.array() >= threshold).select(sim, Eigen::MatrixXf::Zero(sim.rows(), sim.cols()));
+
+    Eigen::VectorXi nn12 = Eigen::VectorXi::Zero(sim.rows());
+    Eigen::VectorXi nn21 = Eigen::VectorXi::Zero(sim.cols());
+
+    for (int i = 0; i < sim.rows(); ++i) {
+        sim.row(i).maxCoeff(&nn12(i));
+    }
+
+    for (int i = 0; i < sim.cols(); ++i) {
+        sim.col(i).maxCoeff(&nn21(i));
+    }
+
+    for (int i = 0; i < sim.rows(); ++i) {
+        if (i == nn21[nn12[i]] && sim.row(i)[nn12[i]]){
+        matches.emplace_back(i, nn12[i]);
+        }
+    }
+}
+
+void hamming_matching_reference(const uint8_t* desc1, int count1, const uint8_t* desc2, int count2, int D,
+                                int32_t zero_point, int max_distance, float ratio,
+                                std::vector<std::pair<int, int>>& matches) {
+    Eigen::MatrixXi distances(count1, count2);
+    for (int i = 0; i < count1; ++i) {
+        for (int j = 0; j < count2; ++j) {
+            int distance = 0;
+            for (int k = 0; k < D; ++k) {
+                distance += (desc1[i * D + k] > zero_point) != (desc2[j * D + k] > zero_point);
+            }
+            distances(i, j) = distance;
+        }
+    }
+
+    matches.clear();
+    for (int i = 0; i < count1; ++i) {
+        int j;
+        int best = distances.row(i).minCoeff(&j);
+        int i2;
+        distances.col(j).minCoeff(&i2);
+        int second = std::numeric_limits<int>::max();
+        for (int c = 0; c < count2; ++c) {
+            if (c != j) second = std::min(second, distances(i, c));
+        }
+        bool distinct = ratio >= 1.0f || second == std::numeric_limits<int>::max() || best < ratio * second;
+        if (i2 == i && best <= max_distance && distinct) {
+            matches.emplace_back(i, j);
+        }
+    }
+}
+
+void ratio_matching_reference(const Eigen::MatrixXf& desc1, const Eigen::MatrixXf& desc2, float threshold,
+                              float ratio, std::vector<std::pair<int, int>>& matches) {
+    Eigen::MatrixXf sim = desc1 * desc2.transpose();
+    auto second_best = [](const Eigen::VectorXf& v, int best) {
+        float second = -std::numeric_limits<float>::infinity();
+        for (int k = 0; k < v.size(); ++k) {
+            if (k != best) second = std::max(second, v[k]);
+        }
+        return second;
+    };
+    auto distinct = [&](float best, float second) {
+        return second == -std::numeric_limits<float>::infinity() || 1.0f - best < ratio * ratio * (1.0f - second);
+    };
+
+    matches.clear();
+    for (int i = 0; i < sim.rows(); ++i) {
+        int j, i2;
+        float best = sim.row(i).maxCoeff(&j);
+        sim.col(j).maxCoeff(&i2);
+        if (i2 == i && best >= threshold && distinct(best, second_best(sim.row(i).transpose(), j)) &&
+            distinct(best, second_best(sim.col(j), i))) {
+            matches.emplace_back(i, j);
+        }
+    }
+}
+
+void guided_matching_reference(const uint8_t* desc1, const std::vector<float>& predicted1,
+                               const uint8_t* desc2, const std::vector<float>& points2, int D,
+                               const dkd::Quantization& quantization, int32_t threshold, float radius,
+                               std::vector<std::pair<int, int>>& matches) {
+    int count1 = static_cast<int>(predicted1.size() / 2);
+    int count2 = static_cast<int>(points2.size() / 2);
+    const int32_t none = std::numeric_limits<int32_t>::min();
+    Eigen::MatrixXi sim = Eigen::MatrixXi::Constant(count1, count2, none);
+    for (int i = 0; i < count1; ++i) {
+        for (int j = 0; j < count2; ++j) {
+            float dx = points2[2 * j] - predicted1[2 * i];
+            float dy = points2[2 * j + 1] - predicted1[2 * i + 1];
+            if (dx * dx + dy * dy > radius * radius) continue;
+            int32_t dot = 0;
+            for (int k = 0; k < D; ++k) {
+                dot += (desc1[i * D + k] - quantization.zero_point) * (desc2[j * D + k] - quantization.zero_point);
+            }
+            sim(i, j) = dot;
+        }
+    }
+
+    matches.clear();
+    for (int i = 0; i < count1; ++i) {
+        int j, i2;
+        int32_t best = sim.row(i).maxCoeff(&j);
+        sim.col(j).maxCoeff(&i2);
+        if (best != none && best >= threshold && i2 == i) {
+            matches.emplace_back(i, j);
+        }
+    }
+}
+
+void top2_matching_reference(const uint8_t* desc1, int count1, const uint8_t* desc2, int count2, int D,
+                             const dkd::Quantization& quantization, int32_t threshold, float ratio,
+                             std::vector<dkd::Match>& matches) {
+    Eigen::MatrixXi centered1(count1, D), centered2(count2, D);
+    for (int i = 0; i < count1; ++i) {
+        for (int k = 0; k < D; ++k) centered1(i, k) = desc1[i * D + k] - quantization.zero_point;
+    }
+    for (int j = 0; j < count2; ++j) {
+        for (int k = 0; k < D; ++k) centered2(j, k) = desc2[j * D + k] - quantization.zero_point;
+    }
+    Eigen::MatrixXi sim = centered1 * centered2.transpose();
+
+    // Lowest index of the largest value besides the best
+    auto second_best = [](const Eigen::VectorXi& v, int best, int& index) {
+        index = -1;
+        for (int k = 0; k < v.size(); ++k) {
+            if (k != best && (index < 0 || v[k] > v[index])) index = k;
+        }
+        return index >= 0 ? v[index] : 0;
+    };
+    // Squared L2 distances of the dequantized descriptors, without their common scale^2
+    auto distance = [&](int i, int j) {
+        return static_cast<double>((centered1.row(i) - centered2.row(j)).squaredNorm());
+    };
+
+    float scale2 = quantization.scale * quantization.scale;
+    matches.clear();
+    for (int i = 0; i < count1; ++i) {
+        int j, i2, row_second_index, column_second_index;
+        int32_t best = sim.row(i).maxCoeff(&j);
+        sim.col(j).maxCoeff(&i2);
+        int32_t row_second = second_best(sim.row(i).transpose(), j, row_second_index);
+        second_best(sim.col(j), i, column_second_index);
+        double r2 = static_cast<double>(ratio) * ratio;
+        bool row_distinct = ratio >= 1.0f || row_second_index < 0 || distance(i, j) < r2 * distance(i, row_second_index);
+        bool column_distinct = ratio >= 1.0f || column_second_index < 0 ||
+                               distance(i, j) < r2 * distance(column_second_index, j);
+        if (best >= threshold && i2 == i && row_distinct && column_distinct) {
+            dkd::Match match;
+            match.index1 = i;
+            match.index2 = j;
+            match.second_index2 = row_second_index;
+            match.similarity = best * scale2;
+            match.second_similarity = row_second_index >= 0 ? row_second * scale2 : 0.0f;
+            matches.push_back(match);
+        }
+    }
+}
+
+void triangulate_reference(const dkd::CameraPose& pose1, const dkd::CameraPose& pose2, const float* x1,
+                           const float* y1, const float* x2, const float* y2, int count,
+                           std::vector<Eigen::Vector3f>& points) {
+    Eigen::Matrix<double, 3, 4> P1 = pose1.cast<double>(), P2 = pose2.cast<double>();
+    points.resize(count);
+    for (int i = 0; i < count; ++i) {
+        Eigen::Matrix4d A;
+        A.row(0) = x1[i] * P1.row(2) - P1.row(0);
+        A.row(1) = y1[i] * P1.row(2) - P1.row(1);
+        A.row(2) = x2[i] * P2.row(2) - P2.row(0);
+        A.row(3) = y2[i] * P2.row(2) - P2.row(1);
+        Eigen::JacobiSVD<Eigen::Matrix4d> svd(A, Eigen::ComputeFullV);
+        Eigen::Vector4d X = svd.matrixV().col(3);
+        points[i] = (X.head<3>() / X(3)).cast<float>();
+    }
+}
+
+int common_matches(const std::vector<std::pair<int, int>>& a, const std::vector<std::pair<int, int>>& b) {
+    std::vector<std::pair<int, int>> common;
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(common));
+    return static_cast<int>(common.size());
+}
+
+Eigen::MatrixXf dequantize_descriptors(const uint8_t* descriptors, int count, int D,
+                                       const dkd::Quantization& quantization) {
+    Eigen::MatrixXf dequantized(count, D);
+    for (int i = 0; i < count; ++i) {
+        for (int k = 0; k < D; ++k) {
+            dequantized(i, k) = (descriptors[i * D + k] - quantization.zero_point) * quantization.scale;
+        }
+    }
+    return dequantized;
+}
+
+/*
+* Simulations
+*/
+
+PipelineRun simulate_pipeline(const PipelineModel& model, int first_frame, int frames, int slowdown_from,
+                              double slowdown, BudgetController* controller, int fixed_top_k,
+                              double target_latency_ms) {
+    struct Sent {
+        double done_ms;
+        FrameStats stats;
+    };
+    std::deque<Sent> in_flight;
+    double extractor_free = 0.0, link_free = 0.0, last_report = 0.0;
+    PipelineRun run = {0.0, 0.0, 0.0, 0.0};
+    int measured = 0;
+    for (int i = 0; i < frames; ++i) {
+        double start = std::max(i * model.frame_interval_ms, extractor_free);
+
+        // Frames already sent are reported before the next one picks its budget
+        while (controller && !in_flight.empty() && in_flight.front().done_ms <= start) {
+            FrameStats stats = in_flight.front().stats;
+            stats.interval_ms = in_flight.front().done_ms - last_report;
+            last_report = in_flight.front().done_ms;
+            controller->report(stats);
+            in_flight.pop_front();
+        }
+
+        int top_k = controller ? controller->budget().top_k : fixed_top_k;
+        double extract = (model.extract_ms + model.extract_ms_per_keypoint * top_k) * (i >= slowdown_from ? slowdown : 1.0);
+        double ready = start + extract;
+        extractor_free = ready;
+
+        size_t bytes = 3 * sizeof(int32_t) + top_k * model.bytes_per_keypoint;
+        double send_start = std::max(ready, link_free);
+        size_t queue_depth = 0;
+        for (const Sent& sent : in_flight) {
+            queue_depth += sent.done_ms - sent.stats.send_ms > ready;
+        }
+        link_free = send_start + bytes * 1000.0 / model.link_bytes_per_second;
+
+        Sent sent;
+        sent.done_ms = link_free;
+        sent.stats.latency_ms = link_free - start;
+        sent.stats.extract_ms = extract;
+        sent.stats.send_ms = link_free - send_start;
+        sent.stats.queue_depth = queue_depth;
+        sent.stats.bytes_sent = bytes;
+        in_flight.push_back(sent);
+
+        if (i >= first_frame) {
+            ++measured;
+            run.mean_latency_ms += sent.stats.latency_ms;
+            run.max_latency_ms = std::max(run.max_latency_ms, sent.stats.latency_ms);
+            run.over_target += sent.stats.latency_ms > target_latency_ms;
+            run.mean_top_k += top_k;
+        }
+    }
+    run.mean_latency_ms /= measured;
+    run.over_target /= measured;
+    run.mean_top_k /= measured;
+    return run;
+}
+
+CorridorRun fly_corridor(int frames, int top_k, float noise_px, float junk) {
+    const int D = 96, points = 8000;
+    dkd::Quantization quantization;
+    const dkd::Intrinsics K = {323.04f, 321.80f, 250.84f, 141.83f};
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+    auto quantize = [&](std::vector<float>& v, uint8_t* out) {
+        float norm = 0.0f;
+        for (float x : v) norm += x * x;
+        norm = std::sqrt(norm);
+        for (int k = 0; k < D; ++k) {
+            float q = std::round(v[k] / norm / quantization.scale) + quantization.zero_point;
+            out[k] = static_cast<uint8_t>(std::min(std::max(q, 0.0f), 255.0f));
+        }
+    };
+
+    // Every point has a descriptor and a score, seen again with noise in every frame
+    std::vector<Eigen::Vector3f> world(points);
+    std::vector<std::vector<float>> originals(points, std::vector<float>(D));
+    std::vector<float> scores(points);
+    for (int i = 0; i < points; ++i) {
+        world[i] = Eigen::Vector3f(40.0f * uniform(rng) - 20.0f, 12.0f * uniform(rng) - 6.0f, 70.0f * uniform(rng));
+        for (float& x : originals[i]) x = normal(rng);
+        scores[i] = uniform(rng);
+    }
+    std::vector<Eigen::Matrix3f> rotations(frames);
+    std::vector<Eigen::Vector3f> positions(frames);
+    for (int f = 0; f < frames; ++f) {
+        rotations[f] = Eigen::AngleAxisf(0.15f * std::sin(0.05f * f), Eigen::Vector3f::UnitY()).toRotationMatrix();
+        positions[f] = Eigen::Vector3f(1.5f * std::sin(0.04f * f), 0.3f * std::sin(0.07f * f), 0.3f * f);
+    }
+
+    dkd::OdometrySettings settings;
+    dkd::VisualOdometry odometry(K, quantization, settings);
+    odometry.reserve(top_k, D);
+    std::vector<float> frame_points(2 * top_k);
+    std::vector<uint8_t> frame_descriptors(static_cast<size_t>(top_k) * D);
+    std::vector<std::pair<float, int>> visible;
+    std::vector<float> v(D);
+    uint8_t buffer[dkd::POSE_PACKET_SIZE];
+
+    CorridorRun run = {0.0, 0, 0, 0, true, 0, 0, 0.0f, 0.0f};
+    float path = 0.0f;
+    float unit = (positions[1] - positions[0]).norm();
+    for (int f = 0; f < frames; ++f) {
+        // World to camera f is R^T (X - p)
+        visible.clear();
+        for (int i = 0; i < points; ++i) {
+            Eigen::Vector3f X = rotations[f].transpose() * (world[i] - positions[f]);
+            if (X.z() < 2.0f || X.z() > 30.0f) continue;
+            float x = K.fx * X.x() / X.z() + K.cx, y = K.fy * X.y() / X.z() + K.cy;
+            if (x < 0.0f || x >= 500.0f || y < 0.0f || y >= 284.0f) continue;
+            visible.emplace_back(scores[i] + 0.2f * uniform(rng), i);
+        }
+        // DKD order: the best scores first
+        std::sort(visible.begin(), visible.end(), std::greater<std::pair<float, int>>());
+        int count = std::min<int>(top_k, static_cast<int>(visible.size()));
+        for (int k = 0; k < count; ++k) {
+            int i = visible[k].second;
+            bool garbage = uniform(rng) < junk;
+            Eigen::Vector3f X = rotations[f].transpose() * (world[i] - positions[f]);
+            frame_points[2 * k] = garbage ? 500.0f * uniform(rng) : K.fx * X.x() / X.z() + K.cx + noise_px * normal(rng);
+            frame_points[2 * k + 1] = garbage ? 284.0f * uniform(rng) : K.fy * X.y() / X.z() + K.cy + noise_px * normal(rng);
+            for (int d = 0; d < D; ++d) {
+                v[d] = garbage ? normal(rng) : originals[i][d] + 0.4f * normal(rng);
+            }
+            quantize(v, frame_descriptors.data() + static_cast<size_t>(k) * D);
+        }
+
+        dkd::PosePacket packet, received;
+        auto start = std::chrono::steady_clock::now();
+        bool keyframe = odometry.track(f, frame_points.data(), frame_descriptors.data(), count, D, packet);
+        run.track_us += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        run.keyframes += keyframe;
+        run.lost += (packet.flags & dkd::POSE_LOST) != 0;
+        run.resets += (packet.flags & dkd::POSE_SCALE_RESET) != 0;
+        dkd::serialize(packet, buffer);
+        run.packets_ok = run.packets_ok && dkd::deserialize(buffer, received) &&
+                         memcmp(&received.q, &packet.q, sizeof(packet.q)) == 0 &&
+                         memcmp(&received.t, &packet.t, sizeof(packet.t)) == 0 && received.frame_id == packet.frame_id;
+        buffer[10] ^= 1;
+        run.packets_ok = run.packets_ok && !dkd::deserialize(buffer, received);
+
+        // What slam_service writes: budget, column-major keypoints and descriptors
+        size_t features = 3 * sizeof(int32_t) + 2 * count * sizeof(int32_t) + static_cast<size_t>(count) * D;
+        run.feature_bytes += features;
+        run.odometry_bytes += dkd::POSE_PACKET_SIZE + (keyframe ? features : 0);
+
+        // Against the truth in the frame of the first camera, in units of the first step
+        Eigen::Vector3f truth = rotations[0].transpose() * (positions[f] - positions[0]) / unit;
+        if (f > 0) path += (positions[f] - positions[f - 1]).norm() / unit;
+        run.drift = (odometry.position() - truth).norm() / std::max(path, 1.0f);
+        run.worst_rotation = std::max(run.worst_rotation, rotation_error_deg(odometry.rotation(),
+                                                                            rotations[0].transpose() * rotations[f]));
+    }
+    return run;
+}
+
+dkd::CameraModel deployment_camera() {
+    dkd::CameraModel camera;
+    camera.fx = 323.0422;
+    camera.fy = 321.7988;
+    camera.cx = 250.8429;
+    camera.cy = 141.8251;
+    camera.k1 = -0.41;
+    camera.k2 = 0.70;
+    camera.k3 = -1.42;
+    return camera;
+}
+
+BundleScene make_bundle_scene(const dkd::LocalBundleAdjuster& adjuster, int keyframes, int fixed,
+                              float outlier_ratio, float noise_px, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> normal(0.0, 1.0);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    const double W = 2.0 * adjuster.camera().cx, H = 2.0 * adjuster.camera().cy;
+
+    BundleScene scene;
+    dkd::BundleWindow& truth = scene.truth;
+    // A keyframe every metre or so and 3 degrees of yaw, as VisualOdometry makes them
+    for (int k = 0; k < keyframes; ++k) {
+        Eigen::Matrix3d R = Eigen::AngleAxisd(0.05 * k, Eigen::Vector3d::UnitY()).toRotationMatrix();
+        Eigen::Vector3d center(0.3 * k, 0.05 * k, 1.0 * k);
+        truth.rotations.push_back(R);
+        truth.translations.push_back(-R * center);
+    }
+    for (int i = 0; i < 80 * keyframes; ++i) {
+        // Tracked over a run of 3 to 5 consecutive keyframes, fewer in the smallest windows,
+        // 6 to 18 m in front of the first
+        int length = std::min(keyframes, 3 + static_cast<int>(uniform(rng) * 3));
+        int first = static_cast<int>(uniform(rng) * (keyframes - length + 1));
+        int last = first + length - 1;
+        double depth = 6.0 + 12.0 * uniform(rng);
+        Eigen::Vector3d ray((uniform(rng) - 0.5) * 1.2, (uniform(rng) - 0.5) * 0.7, 1.0);
+        Eigen::Vector3d X = truth.rotations[first].transpose() * (depth * ray - truth.translations[first]);
+        int point = static_cast<int>(truth.points.size());
+        int seen = 0;
+        for (int k = first; k <= last; ++k) {
+            // The calibrated radial model folds back at r^2 = 0.5, the lens sees nothing past 0.4
+            Eigen::Vector3d camera_point = truth.rotations[k] * X + truth.translations[k];
+            Eigen::Vector2d pixel;
+            if (camera_point.head<2>().squaredNorm() > 0.4 * camera_point.z() * camera_point.z() ||
+                !adjuster.project(camera_point, pixel) || pixel.x() < 0.0 || pixel.y() < 0.0 || pixel.x() >= W ||
+                pixel.y() >= H) {
+                continue;
+            }
+            bool outlier = uniform(rng) < outlier_ratio;
+            if (outlier) {
+                // Matched to another keypoint nearby, the epipolar check of the front end
+                // removed the rest
+                double angle = 2.0 * M_PI * uniform(rng);
+                pixel += (8.0 + 32.0 * uniform(rng)) * Eigen::Vector2d(std::cos(angle), std::sin(angle));
+            } else {
+                pixel += noise_px * Eigen::Vector2d(normal(rng), normal(rng));
+            }
+            truth.observations.push_back(dkd::Observation{k, point, pixel.x(), pixel.y()});
+            scene.outlier.push_back(outlier);
+            ++seen;
+        }
+        if (seen < std::min(length, 3)) {
+            truth.observations.resize(truth.observations.size() - seen);
+            scene.outlier.resize(scene.outlier.size() - seen);
+            continue;
+        }
+        truth.points.push_back(X);
+    }
+
+    // The fixed keyframes stay at the truth, the others are off by about half a degree and
+    // 3 cm, the points by 2% of their depth
+    scene.window = truth;
+    for (int k = fixed; k < keyframes; ++k) {
+        Eigen::Vector3d axis(normal(rng), normal(rng), normal(rng));
+        Eigen::Matrix3d dR = Eigen::AngleAxisd(0.5 * M_PI / 180.0, axis.normalized()).toRotationMatrix();
+        scene.window.rotations[k] = dR * truth.rotations[k];
+        scene.window.translations[k] = dR * truth.translations[k] +
+                                       0.03 * Eigen::Vector3d(normal(rng), normal(rng), normal(rng));
+    }
+    for (Eigen::Vector3d& X : scene.window.points) {
+        X += 0.02 * X.z() * Eigen::Vector3d(normal(rng), normal(rng), normal(rng));
+    }
+    return scene;
+}
+
+double bundle_median_px(const dkd::LocalBundleAdjuster& adjuster, const BundleScene& scene,
+                        const dkd::BundleWindow& window) {
+    std::vector<double> errors;
+    for (size_t i = 0; i < window.observations.size(); ++i) {
+        if (scene.outlier[i]) {
+            continue;
+        }
+        const dkd::Observation& o = window.observations[i];
+        Eigen::Vector2d pixel;
+        bool visible = adjuster.project(window.rotations[o.keyframe] * window.points[o.point] +
+                                        window.translations[o.keyframe], pixel);
+        errors.push_back(visible ? (pixel - Eigen::Vector2d(o.x, o.y)).norm() : std::numeric_limits<double>::infinity());
+    }
+    if (errors.empty()) {
+        return 0.0;
+    }
+    std::nth_element(errors.begin(), errors.begin() + errors.size() / 2, errors.end());
+    return errors[errors.size() / 2];
+}
+
+void bundle_pose_error(const dkd::BundleWindow& truth, const dkd::BundleWindow& window, int fixed,
+                       double& rotation_deg, double& position) {
+    rotation_deg = 0.0;
+    position = 0.0;
+    int count = static_cast<int>(truth.rotations.size()) - fixed;
+    for (int k = fixed; k < fixed + count; ++k) {
+        Eigen::AngleAxisd error(window.rotations[k] * truth.rotations[k].transpose());
+        rotation_deg += error.angle() * 180.0 / M_PI;
+        Eigen::Vector3d c1 = -truth.rotations[k].transpose() * truth.translations[k];
+        Eigen::Vector3d c2 = -window.rotations[k].transpose() * window.translations[k];
+        position += (c1 - c2).norm();
+    }
+    rotation_deg /= std::max(count, 1);
+    position /= std::max(count, 1);
+}
@@ -0,0 +1,241 @@
+#ifndef SLAM_DKD_REFERENCE_H
+#define SLAM_DKD_REFERENCE_H
+
+// Shared by dkd_tests and dkd_bench: synthetic inputs and the implementations the
+// DKD kernels replaced, kept verbatim as the reference they are checked against.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <utility>
+
+#include <Eigen/Dense>
+
+#include "dkd.h"
+#include "dkd_kernels.h"
+#include "budget_controller.h"
+#include "matcher.h"
+#include "essential_ransac.h"
+#include "visual_odometry.h"
+#include "triangulation.h"
+#include "bundle_adjustment.h"
+
+typedef Eigen::Matrix<uint8_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> MatrixU8;
+
+// Deployment model output size
+static const int MAP_H = 160;
+static const int MAP_W = 256;
+
+/*
+* Helpers
+*/
+
+// Deterministic pseudo random scoremap with some blobs on top of the noise,
+// so local maxima are spread roughly like on the real ALIKE output
+std::vector<uint8_t> make_scoremap(int H, int W, uint32_t seed);
+
+// FNV-1a, to pin down outputs in a few bytes
+uint64_t hash_bytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull);
+
+// Feature map of D descriptor channels with a scoremap as the last one, like the NPU output
+std::vector<uint8_t> make_feature_map(int D, int H, int W, uint32_t seed);
+
+// DKD set up like in slam_service
+void configure_deployment(DKD& dkd, int D, int H, int W);
+
+// Quantized unit length descriptors like the ALIKE ones, and noisy copies of a part of them
+// in shuffled order, so there are true matches to find among the distractors.
+// sources gets the row of descriptors1 every row of descriptors2 copies, -1 for the distractors
+void make_descriptor_pair(int count, int D, const dkd::Quantization& quantization, uint32_t seed,
+                          std::vector<uint8_t>& descriptors1, std::vector<uint8_t>& descriptors2,
+                          std::vector<int>* sources = nullptr);
+
+// Two views of a random scene 4 to 12 m in front of the first camera, with the intrinsics of
+// scripts/slam/app.py. The second camera is turned by a few degrees and moved by half a meter.
+// Keypoints get Gaussian noise and outliers swap theirs in the second view for a random pixel
+struct TwoViewScene {
+    dkd::Intrinsics intrinsics;
+    Eigen::Matrix3f R;
+    Eigen::Vector3f t;
+    // In the first camera
+    std::vector<Eigen::Vector3f> points;
+    // Interleaved (x, y) pixels
+    std::vector<float> points1, points2;
+    std::vector<uint8_t> outlier;
+};
+
+TwoViewScene make_two_view_scene(int count, float outlier_ratio, float noise_px, uint32_t seed);
+
+float rotation_error_deg(const Eigen::Matrix3f& R1, const Eigen::Matrix3f& R2);
+
+float direction_error_deg(const Eigen::Vector3f& a, const Eigen::Vector3f& b);
+
+/*
+* Reference implementations
+*/
+
+// DKD::maxpool2d before the running max engine
+MatrixU8 maxpool2d_reference(const MatrixU8& input,
+                             int h_start, int w_start, int h_stop, int w_stop, int radius, int stride);
+
+// Separable full frame maxpool the Eigen one was replaced with before the streaming
+// detector: running_max_1d along the rows, then the max of 2r+1 pooled rows.
+// Only the [h_start, h_stop) x [w_start, w_stop) window of the output is written
+void maxpool2d_separable(const uint8_t* input, uint8_t* output, int W,
+                         int h_start, int w_start, int h_stop, int w_stop,
+                         int radius, std::vector<uint8_t>& scratch);
+
+// Candidate extraction of DKD::maxpool_detect_keypoints before the packed mask:
+// maxpool, Eigen bool mask, its uint8 copy and a scan over both
+void local_maxima_reference(const uint8_t* scores_map, int H, int W, int radius, int padding,
+                            std::vector<uint8_t>& pooled, std::vector<uint8_t>& scratch,
+                            std::vector<int>& candidates);
+
+// Packed mask of the candidates of the whole window, the LocalMaxStream rows stacked
+// into a full frame as the packed mask detector kept them. Rows outside of
+// [h_start, h_stop) are not written, mask holds dkd::nms_mask_stride(W) bytes per map row
+void nms_mask(const uint8_t* scores, int W,
+              int h_start, int w_start, int h_stop, int w_stop,
+              int radius, uint8_t threshold, uint8_t* mask, dkd::LocalMaxStream& stream);
+
+// Calls fn(x, y) for every set bit of an nms_mask() mask in raster order
+template <typename Fn>
+inline void for_each_mask_bit(const uint8_t* mask, int W, int h_start, int h_stop, Fn fn) {
+    int stride = dkd::nms_mask_stride(W);
+    for (int y = h_start; y < h_stop; ++y) {
+        dkd::for_each_row_bit(mask + static_cast<size_t>(y) * stride, stride, [&](int x) { fn(x, y); });
+    }
+}
+
+// Top k selection of DKD::maxpool_detect_keypoints before the histogram selector.
+// Rows are filled from the back, so with less than k candidates the leading ones stay unset
+void top_k_reference(const uint8_t* scores_map, int H, int W, const std::vector<int>& candidates, int top_k,
+                     Eigen::Matrix<int, Eigen::Dynamic, 2, Eigen::RowMajor>& keypoints);
+
+// Sort based grid selection: best quota keypoints of every cell, then the best of
+// the rest, then everything ordered by score with ties in raster order
+void grid_top_k_reference(const uint8_t* scores_map, int W, const std::vector<int>& candidates, int top_k,
+                          int cells_x, int cells_y, int h_start, int w_start, int h_stop, int w_stop,
+                          std::vector<int>& selected);
+
+// Float soft-argmax of the original ALIKE DKD over the keypoint neighbourhood
+void soft_argmax_reference(const uint8_t* scores_map, int W, const int32_t* xy, int count,
+                           int radius, float temperature, float* refined);
+
+// DKD::sample_descriptors before the gather engine
+void sample_descriptors_reference(const uint8_t* descriptor_map, const std::vector<int32_t>& xy, int D, int H, int W,
+                                  MatrixU8& descriptors);
+
+// Float bilinear interpolation of the uint8 planes at the Q8 keypoints, in the uint8 quantization
+void sample_bilinear_reference(const uint8_t* descriptor_map, const std::vector<int32_t>& xy_q8, int D, int H, int W,
+                               Eigen::MatrixXf& descriptors);
+
+/*
+* Matching
+*/
+
+// perform_matching() of slam_service before the integer matcher
+void perform_matching_reference(const Eigen::MatrixXf& desc1, const Eigen::MatrixXf& desc2,
+                                std::vector<std::pair<int, int>>& matches, float threshold);
+
+// Hamming matching with the distances straight from the descriptors, bit by bit
+void hamming_matching_reference(const uint8_t* desc1, int count1, const uint8_t* desc2, int count2, int D,
+                                int32_t zero_point, int max_distance, float ratio,
+                                std::vector<std::pair<int, int>>& matches);
+
+// Mutual matching with the ratio test of BlockedMatcher on the full similarity matrix
+void ratio_matching_reference(const Eigen::MatrixXf& desc1, const Eigen::MatrixXf& desc2, float threshold,
+                              float ratio, std::vector<std::pair<int, int>>& matches);
+
+// Mutual matching of the int16 similarities over the pairs within radius of the prediction
+void guided_matching_reference(const uint8_t* desc1, const std::vector<float>& predicted1,
+                               const uint8_t* desc2, const std::vector<float>& points2, int D,
+                               const dkd::Quantization& quantization, int32_t threshold, float radius,
+                               std::vector<std::pair<int, int>>& matches);
+
+// Top 2 of every row and column of the full int16 similarity matrix, then the filters of MutualMatcher
+void top2_matching_reference(const uint8_t* desc1, int count1, const uint8_t* desc2, int count2, int D,
+                             const dkd::Quantization& quantization, int32_t threshold, float ratio,
+                             std::vector<dkd::Match>& matches);
+
+// triangulate() of scripts/main.py: DLT, the null vector of a 4x4 system a point by SVD
+void triangulate_reference(const dkd::CameraPose& pose1, const dkd::CameraPose& pose2, const float* x1,
+                           const float* y1, const float* x2, const float* y2, int count,
+                           std::vector<Eigen::Vector3f>& points);
+
+// Number of matches two lists in index1 order have in common
+int common_matches(const std::vector<std::pair<int, int>>& a, const std::vector<std::pair<int, int>>& b);
+
+// Dequantized descriptors as perform_matching() takes them
+Eigen::MatrixXf dequantize_descriptors(const uint8_t* descriptors, int count, int D,
+                                       const dkd::Quantization& quantization);
+
+/*
+* Simulations
+*/
+
+// Pipeline of the service, simulated in time: a camera at 10 fps, keypoint extraction
+// taking a fixed part plus a part per keypoint, and a serial link sending the frames in order
+struct PipelineModel {
+    double frame_interval_ms = 100.0;
+    double extract_ms = 40.0;
+    double extract_ms_per_keypoint = 0.1;
+    double link_bytes_per_second = 92160.0;
+    size_t bytes_per_keypoint = 2 * sizeof(int32_t) + 96;
+};
+
+struct PipelineRun {
+    double mean_latency_ms;
+    double max_latency_ms;
+    double over_target;
+    double mean_top_k;
+};
+
+PipelineRun simulate_pipeline(const PipelineModel& model, int first_frame, int frames, int slowdown_from,
+                              double slowdown, BudgetController* controller, int fixed_top_k,
+                              double target_latency_ms);
+
+// Visual odometry flying down a corridor of points at 0.3 m a frame, weaving and yawing,
+// with top_k keypoints a frame of which a junk part are garbage
+struct CorridorRun {
+    // Wall clock of VisualOdometry::track() over all the frames
+    double track_us;
+    int keyframes;
+    int lost;
+    int resets;
+    // Every packet round trips through serialize() and a corrupted one is rejected
+    bool packets_ok;
+    // Bytes of full features every frame against the pose packets and the keyframe features
+    size_t feature_bytes;
+    size_t odometry_bytes;
+    // Position error of the last frame over the length of the path
+    float drift;
+    float worst_rotation;
+};
+
+CorridorRun fly_corridor(int frames, int top_k, float noise_px, float junk);
+
+// Calibration of the deployment camera in keypoint pixels, radial terms only
+dkd::CameraModel deployment_camera();
+
+// Window of keyframes flying forward with some yaw over a field of points, and the points
+// each keyframe sees, in the distorted pixels of the camera
+struct BundleScene {
+    dkd::BundleWindow truth;
+    dkd::BundleWindow window;
+    std::vector<bool> outlier;
+};
+
+BundleScene make_bundle_scene(const dkd::LocalBundleAdjuster& adjuster, int keyframes, int fixed,
+                              float outlier_ratio, float noise_px, uint32_t seed);
+
+// Median reprojection error in px of the observations that aren't outliers. A point with an
+// outlier among a few observations is off in all of them, whatever the adjustment
+double bundle_median_px(const dkd::LocalBundleAdjuster& adjuster, const BundleScene& scene,
+                        const dkd::BundleWindow& window);
+
+// Mean rotation error in degrees and camera position error in m of the free keyframes
+void bundle_pose_error(const dkd::BundleWindow& truth, const dkd::BundleWindow& window, int fixed,
+                       double& rotation_deg, double& position);
+
+#endif // SLAM_DKD_REFERENCE_H
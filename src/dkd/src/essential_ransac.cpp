@@ -0,0 +1,641 @@
+#include "essential_ransac.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if !defined(DKD_DISABLE_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define DKD_USE_NEON
+#elif !defined(DKD_DISABLE_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define DKD_USE_SSE2
+#endif
+
+namespace dkd {
+
+namespace {
+
+// Hartley normalization: centroid to the origin and a mean distance of sqrt(2) from it
+struct Normalization {
+    float cx, cy, scale;
+
+    Eigen::Matrix3f matrix() const {
+        Eigen::Matrix3f T;
+        T << scale, 0.0f, -scale * cx,
+             0.0f, scale, -scale * cy,
+             0.0f, 0.0f, 1.0f;
+        return T;
+    }
+};
+
+template<typename Indices>
+Normalization normalization(const float* x, const float* y, const Indices& indices, int count) {
+    Normalization n = {0.0f, 0.0f, 1.0f};
+    for (int k = 0; k < count; ++k) {
+        n.cx += x[indices[k]];
+        n.cy += y[indices[k]];
+    }
+    n.cx /= count;
+    n.cy /= count;
+    float distance = 0.0f;
+    for (int k = 0; k < count; ++k) {
+        distance += std::sqrt((x[indices[k]] - n.cx) * (x[indices[k]] - n.cx) + (y[indices[k]] - n.cy) * (y[indices[k]] - n.cy));
+    }
+    distance /= count;
+    n.scale = distance > 1e-12f ? std::sqrt(2.0f) / distance : 1.0f;
+    return n;
+}
+
+// Row of the epipolar constraint x2^T E x1 = 0 for the row-major entries of E
+inline Eigen::Matrix<float, 1, 9> epipolar_row(float x1, float y1, float x2, float y2) {
+    Eigen::Matrix<float, 1, 9> row;
+    row << x2 * x1, x2 * y1, x2, y2 * x1, y2 * y1, y2, x1, y1, 1.0f;
+    return row;
+}
+
+// Back from normalized coordinates, then the closest essential matrix: singular values (1, 1, 0)
+inline Eigen::Matrix3f essential_from(const Eigen::Matrix<float, 9, 1>& e, const Normalization& n1,
+                                      const Normalization& n2) {
+    Eigen::Matrix3f E;
+    E << e(0), e(1), e(2),
+         e(3), e(4), e(5),
+         e(6), e(7), e(8);
+    E = n2.matrix().transpose() * E * n1.matrix();
+    Eigen::JacobiSVD<Eigen::Matrix3f> svd(E, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    return svd.matrixU() * Eigen::Vector3f(1.0f, 1.0f, 0.0f).asDiagonal() * svd.matrixV().transpose();
+}
+
+inline Eigen::Matrix3d skew(const Eigen::Vector3d& v) {
+    Eigen::Matrix3d S;
+    S << 0.0, -v.z(), v.y(),
+         v.z(), 0.0, -v.x(),
+         -v.y(), v.x(), 0.0;
+    return S;
+}
+
+// Iterations until an all inlier sample of 8 is drawn with the given confidence
+inline int iterations_for(double inlier_ratio, double confidence, int max_iterations) {
+    double all_inliers = std::pow(inlier_ratio, 8);
+    if (all_inliers >= 1.0) {
+        return 1;
+    }
+    if (all_inliers <= 1e-12) {
+        return max_iterations;
+    }
+    double n = std::ceil(std::log(1.0 - confidence) / std::log(1.0 - all_inliers));
+    return static_cast<int>(std::min(n, static_cast<double>(max_iterations)));
+}
+
+} // namespace
+
+EssentialRansac::EssentialRansac(const Intrinsics& intrinsics, const RansacSettings& settings)
+    : m_intrinsics(intrinsics), m_settings(settings) {
+    float f = 0.5f * (intrinsics.fx + intrinsics.fy);
+    m_threshold2 = (settings.threshold_px / f) * (settings.threshold_px / f);
+    m_state = settings.seed ? settings.seed : 1;
+}
+
+void EssentialRansac::reserve(int count) {
+    m_x1.reserve(count);
+    m_y1.reserve(count);
+    m_x2.reserve(count);
+    m_y2.reserve(count);
+    m_mask.reserve(count);
+    m_indices.reserve(count);
+}
+
+uint32_t EssentialRansac::random() {
+    // xorshift32, plenty for drawing samples and reproducible across platforms
+    m_state ^= m_state << 13;
+    m_state ^= m_state >> 17;
+    m_state ^= m_state << 5;
+    return m_state;
+}
+
+bool EssentialRansac::solve_minimal(Eigen::Matrix3f& E) const {
+    const float* x1 = m_x1.data();
+    const float* y1 = m_y1.data();
+    const float* x2 = m_x2.data();
+    const float* y2 = m_y2.data();
+    Normalization n1 = normalization(x1, y1, m_sample, 8);
+    Normalization n2 = normalization(x2, y2, m_sample, 8);
+
+    Eigen::Matrix<float, 8, 9> A;
+    for (int k = 0; k < 8; ++k) {
+        int i = m_sample[k];
+        A.row(k) = epipolar_row(n1.scale * (x1[i] - n1.cx), n1.scale * (y1[i] - n1.cy),
+                                n2.scale * (x2[i] - n2.cx), n2.scale * (y2[i] - n2.cy));
+    }
+
+    // Gauss-Jordan with partial pivoting, the null vector falls out of the last column.
+    // The normalized entries are O(1), a tiny pivot means a degenerate sample
+    for (int c = 0; c < 8; ++c) {
+        int pivot;
+        float magnitude = A.col(c).tail(8 - c).cwiseAbs().maxCoeff(&pivot);
+        if (magnitude < 1e-5f) {
+            return false;
+        }
+        pivot += c;
+        if (pivot != c) {
+            A.row(pivot).swap(A.row(c));
+        }
+        A.row(c) /= A(c, c);
+        for (int r = 0; r < 8; ++r) {
+            if (r != c) {
+                A.row(r) -= A(r, c) * A.row(c);
+            }
+        }
+    }
+    Vector9f e;
+    e.head<8>() = -A.col(8);
+    e(8) = 1.0f;
+
+    E = essential_from(e, n1, n2);
+    return E.allFinite();
+}
+
+bool EssentialRansac::solve_inliers(Eigen::Matrix3f& E, const Eigen::Matrix3f* weighting) {
+    std::vector<int>& indices = m_indices;
+    indices.clear();
+    for (int i = 0; i < m_count; ++i) {
+        if (m_mask[i]) {
+            indices.push_back(i);
+        }
+    }
+    int count = static_cast<int>(indices.size());
+    if (count < 8) {
+        return false;
+    }
+    Normalization n1 = normalization(m_x1.data(), m_y1.data(), indices, count);
+    Normalization n2 = normalization(m_x2.data(), m_y2.data(), indices, count);
+
+    // Smallest eigenvector of A^T A, accumulated so nothing scales with the match count.
+    // In double, A^T A squares the condition number of A
+    Eigen::Matrix<double, 9, 9> AtA = Eigen::Matrix<double, 9, 9>::Zero();
+    for (int i : indices) {
+        Eigen::Matrix<double, 1, 9> row = epipolar_row(n1.scale * (m_x1[i] - n1.cx), n1.scale * (m_y1[i] - n1.cy),
+                                                       n2.scale * (m_x2[i] - n2.cx), n2.scale * (m_y2[i] - n2.cy)).cast<double>();
+        double weight = 1.0;
+        if (weighting) {
+            // Sampson weights turn the algebraic error into the Sampson distance of the
+            // previous estimate
+            const Eigen::Matrix3f& W = *weighting;
+            Eigen::Vector3f a = W * Eigen::Vector3f(m_x1[i], m_y1[i], 1.0f);
+            Eigen::Vector3f b = W.transpose() * Eigen::Vector3f(m_x2[i], m_y2[i], 1.0f);
+            weight = 1.0 / std::max(static_cast<double>(a.head<2>().squaredNorm() + b.head<2>().squaredNorm()), 1e-12);
+        }
+        AtA.noalias() += weight * row.transpose() * row;
+    }
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double, 9, 9>> solver(AtA);
+    if (solver.info() != Eigen::Success) {
+        return false;
+    }
+    E = essential_from(solver.eigenvectors().col(0).cast<float>(), n1, n2);
+    return E.allFinite();
+}
+
+int EssentialRansac::count_inliers(const Eigen::Matrix3f& E, float threshold2, uint8_t* mask) const {
+    // Sampson distance num^2 / den with num = x2^T E x1 and den the squared norms of the
+    // first two entries of E x1 and E^T x2
+    const float* x1 = m_x1.data();
+    const float* y1 = m_y1.data();
+    const float* x2 = m_x2.data();
+    const float* y2 = m_y2.data();
+    int count = 0;
+    int i = 0;
+#if defined(DKD_USE_NEON)
+    float32x4_t e00 = vdupq_n_f32(E(0, 0)), e01 = vdupq_n_f32(E(0, 1)), e02 = vdupq_n_f32(E(0, 2));
+    float32x4_t e10 = vdupq_n_f32(E(1, 0)), e11 = vdupq_n_f32(E(1, 1)), e12 = vdupq_n_f32(E(1, 2));
+    float32x4_t e20 = vdupq_n_f32(E(2, 0)), e21 = vdupq_n_f32(E(2, 1)), e22 = vdupq_n_f32(E(2, 2));
+    float32x4_t t2 = vdupq_n_f32(threshold2);
+    uint32x4_t counts = vdupq_n_u32(0);
+    for (; i + 4 <= m_count; i += 4) {
+        float32x4_t u1 = vld1q_f32(x1 + i), v1 = vld1q_f32(y1 + i);
+        float32x4_t u2 = vld1q_f32(x2 + i), v2 = vld1q_f32(y2 + i);
+        float32x4_t a = vmlaq_f32(vmlaq_f32(e02, e00, u1), e01, v1);
+        float32x4_t b = vmlaq_f32(vmlaq_f32(e12, e10, u1), e11, v1);
+        float32x4_t c = vmlaq_f32(vmlaq_f32(e22, e20, u1), e21, v1);
+        float32x4_t d = vmlaq_f32(vmlaq_f32(e20, e00, u2), e10, v2);
+        float32x4_t e = vmlaq_f32(vmlaq_f32(e21, e01, u2), e11, v2);
+        float32x4_t num = vmlaq_f32(vmlaq_f32(c, u2, a), v2, b);
+        float32x4_t den = vmlaq_f32(vmlaq_f32(vmlaq_f32(vmulq_f32(a, a), b, b), d, d), e, e);
+        uint32x4_t inlier = vcltq_f32(vmulq_f32(num, num), vmulq_f32(t2, den));
+        // All ones lanes, subtracting them counts
+        counts = vsubq_u32(counts, inlier);
+        if (mask) {
+            uint32_t lanes[4];
+            vst1q_u32(lanes, inlier);
+            for (int k = 0; k < 4; ++k) {
+                mask[i + k] = lanes[k] & 1;
+            }
+        }
+    }
+    uint32_t lanes[4];
+    vst1q_u32(lanes, counts);
+    count = static_cast<int>(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+#elif defined(DKD_USE_SSE2)
+    __m128 e00 = _mm_set1_ps(E(0, 0)), e01 = _mm_set1_ps(E(0, 1)), e02 = _mm_set1_ps(E(0, 2));
+    __m128 e10 = _mm_set1_ps(E(1, 0)), e11 = _mm_set1_ps(E(1, 1)), e12 = _mm_set1_ps(E(1, 2));
+    __m128 e20 = _mm_set1_ps(E(2, 0)), e21 = _mm_set1_ps(E(2, 1)), e22 = _mm_set1_ps(E(2, 2));
+    __m128 t2 = _mm_set1_ps(threshold2);
+    for (; i + 4 <= m_count; i += 4) {
+        __m128 u1 = _mm_loadu_ps(x1 + i), v1 = _mm_loadu_ps(y1 + i);
+        __m128 u2 = _mm_loadu_ps(x2 + i), v2 = _mm_loadu_ps(y2 + i);
+        __m128 a = _mm_add_ps(_mm_add_ps(e02, _mm_mul_ps(e00, u1)), _mm_mul_ps(e01, v1));
+        __m128 b = _mm_add_ps(_mm_add_ps(e12, _mm_mul_ps(e10, u1)), _mm_mul_ps(e11, v1));
+        __m128 c = _mm_add_ps(_mm_add_ps(e22, _mm_mul_ps(e20, u1)), _mm_mul_ps(e21, v1));
+        __m128 d = _mm_add_ps(_mm_add_ps(e20, _mm_mul_ps(e00, u2)), _mm_mul_ps(e10, v2));
+        __m128 e = _mm_add_ps(_mm_add_ps(e21, _mm_mul_ps(e01, u2)), _mm_mul_ps(e11, v2));
+        __m128 num = _mm_add_ps(_mm_add_ps(c, _mm_mul_ps(u2, a)), _mm_mul_ps(v2, b));
+        __m128 den = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a, a), _mm_mul_ps(b, b)), _mm_mul_ps(d, d)),
+                                _mm_mul_ps(e, e));
+        int bits = _mm_movemask_ps(_mm_cmplt_ps(_mm_mul_ps(num, num), _mm_mul_ps(t2, den)));
+        count += __builtin_popcount(bits);
+        if (mask) {
+            for (int k = 0; k < 4; ++k) {
+                mask[i + k] = (bits >> k) & 1;
+            }
+        }
+    }
+#endif
+    for (; i < m_count; ++i) {
+        float a = E(0, 2) + E(0, 0) * x1[i] + E(0, 1) * y1[i];
+        float b = E(1, 2) + E(1, 0) * x1[i] + E(1, 1) * y1[i];
+        float c = E(2, 2) + E(2, 0) * x1[i] + E(2, 1) * y1[i];
+        float d = E(2, 0) + E(0, 0) * x2[i] + E(1, 0) * y2[i];
+        float e = E(2, 1) + E(0, 1) * x2[i] + E(1, 1) * y2[i];
+        float num = c + x2[i] * a + y2[i] * b;
+        float den = a * a + b * b + d * d + e * e;
+        bool inlier = num * num < threshold2 * den;
+        count += inlier;
+        if (mask) {
+            mask[i] = inlier;
+        }
+    }
+    return count;
+}
+
+int EssentialRansac::recover_pose(const Eigen::Matrix3f& E, Eigen::Matrix3f& R, Eigen::Vector3f& t) {
+    Eigen::JacobiSVD<Eigen::Matrix3f> svd(E, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    Eigen::Matrix3f U = svd.matrixU();
+    Eigen::Matrix3f V = svd.matrixV();
+    if (U.determinant() < 0.0f) U = -U;
+    if (V.determinant() < 0.0f) V = -V;
+    Eigen::Matrix3f W;
+    W << 0.0f, -1.0f, 0.0f,
+         1.0f, 0.0f, 0.0f,
+         0.0f, 0.0f, 1.0f;
+
+    const Eigen::Matrix3f rotations[4] = {U * W * V.transpose(), U * W * V.transpose(),
+                                          U * W.transpose() * V.transpose(), U * W.transpose() * V.transpose()};
+    const Eigen::Vector3f translations[4] = {U.col(2), -U.col(2), U.col(2), -U.col(2)};
+
+    // Depths z1, z2 of a match minimize |z1 R x1 + t - z2 x2|, it counts when both are positive
+    auto in_front = [&](const Eigen::Matrix3f& Rc, const Eigen::Vector3f& tc, int i) {
+        Eigen::Vector3f r = Rc * Eigen::Vector3f(m_x1[i], m_y1[i], 1.0f);
+        Eigen::Vector3f x2(m_x2[i], m_y2[i], 1.0f);
+        float rr = r.dot(r), rx = r.dot(x2), xx = x2.dot(x2);
+        float rt = r.dot(tc), xt = x2.dot(tc);
+        float det = rx * rx - rr * xx;
+        if (std::fabs(det) < 1e-9f) {
+            return false;
+        }
+        float z1 = (rt * xx - rx * xt) / det;
+        float z2 = (rx * rt - rr * xt) / det;
+        return z1 > 0.0f && z2 > 0.0f;
+    };
+
+    int best = -1, best_count = -1;
+    for (int k = 0; k < 4; ++k) {
+        int count = 0;
+        for (int i = 0; i < m_count; ++i) {
+            count += m_mask[i] && in_front(rotations[k], translations[k], i);
+        }
+        if (count > best_count) {
+            best_count = count;
+            best = k;
+        }
+    }
+
+    R = rotations[best];
+    t = translations[best];
+    for (int i = 0; i < m_count; ++i) {
+        m_mask[i] = m_mask[i] && in_front(R, t, i);
+    }
+    return best_count;
+}
+
+int EssentialRansac::optimize(Eigen::Matrix3f& E, int inliers) {
+    // Refitting only on the matches within the threshold of a noisy hypothesis keeps its
+    // bias, the refits take the matches within a wider threshold that shrinks back round
+    // after round. The first round is plain least squares, the next ones are reweighted by
+    // the Sampson denominators of the previous estimate to minimize the Sampson distance
+    // instead of the algebraic error
+    for (int round = 0; round < REFIT_ROUNDS; ++round) {
+        float widening = static_cast<float>(REFIT_ROUNDS - round);
+        count_inliers(E, widening * widening * m_threshold2, m_mask.data());
+        Eigen::Matrix3f refit;
+        if (!solve_inliers(refit, round > 0 ? &E : nullptr)) {
+            break;
+        }
+        int refit_inliers = count_inliers(refit, m_threshold2, nullptr);
+        if (refit_inliers < inliers) {
+            break;
+        }
+        E = refit;
+        inliers = refit_inliers;
+    }
+    return inliers;
+}
+
+void EssentialRansac::refine(Eigen::Matrix3f& R, Eigen::Vector3f& t, Eigen::Matrix3f& rotation_covariance,
+                             Eigen::Matrix3f& translation_covariance) {
+    // Nothing known until there is a fit
+    rotation_covariance.setIdentity();
+    translation_covariance.setIdentity();
+    std::vector<int>& indices = m_indices;
+    indices.clear();
+    for (int i = 0; i < m_count; ++i) {
+        if (m_mask[i]) {
+            indices.push_back(i);
+        }
+    }
+    int count = static_cast<int>(indices.size());
+    if (count < 6) {
+        return;
+    }
+
+    // Sampson distances of the matches under R, t
+    auto residuals = [&](const Eigen::Matrix3d& Rc, const Eigen::Vector3d& tc, Eigen::VectorXd& r) {
+        Eigen::Matrix3d E = skew(tc) * Rc;
+        for (int k = 0; k < count; ++k) {
+            int i = indices[k];
+            Eigen::Vector3d x1(m_x1[i], m_y1[i], 1.0), x2(m_x2[i], m_y2[i], 1.0);
+            Eigen::Vector3d a = E * x1, b = E.transpose() * x2;
+            double den = a.head<2>().squaredNorm() + b.head<2>().squaredNorm();
+            r(k) = x2.dot(a) / std::sqrt(std::max(den, 1e-18));
+        }
+    };
+    // R exp(w) and t moved in the plane orthogonal to it, 5 parameters
+    auto update = [](const Eigen::Matrix3d& Rc, const Eigen::Vector3d& tc, const Eigen::Vector3d& t1,
+                     const Eigen::Vector3d& t2, const Eigen::Matrix<double, 5, 1>& step,
+                     Eigen::Matrix3d& Rn, Eigen::Vector3d& tn) {
+        Eigen::Vector3d w = step.head<3>();
+        double angle = w.norm();
+        Rn = angle > 0.0 ? Eigen::Matrix3d(Rc * Eigen::AngleAxisd(angle, w / angle)) : Rc;
+        tn = (tc + step(3) * t1 + step(4) * t2).normalized();
+    };
+
+    Eigen::Matrix3d Rd = R.cast<double>();
+    Eigen::Vector3d td = t.cast<double>().normalized();
+    Eigen::VectorXd r(count), shifted(count);
+    Eigen::Matrix<double, Eigen::Dynamic, 5> J(count, 5);
+    auto jacobian = [&](const Eigen::Vector3d& t1, const Eigen::Vector3d& t2) {
+        const double delta = 1e-7;
+        for (int p = 0; p < 5; ++p) {
+            Eigen::Matrix<double, 5, 1> step = Eigen::Matrix<double, 5, 1>::Zero();
+            step(p) = delta;
+            Eigen::Matrix3d Rn;
+            Eigen::Vector3d tn;
+            update(Rd, td, t1, t2, step, Rn, tn);
+            residuals(Rn, tn, shifted);
+            J.col(p) = (shifted - r) / delta;
+        }
+    };
+    residuals(Rd, td, r);
+    double cost = r.squaredNorm();
+    double lambda = 1e-3;
+    // Levenberg-Marquardt with forward differences, the residuals are cheap next to
+    // getting their derivatives right
+    for (int iteration = 0; iteration < REFINE_ITERATIONS; ++iteration) {
+        Eigen::Vector3d t1 = td.unitOrthogonal();
+        Eigen::Vector3d t2 = td.cross(t1);
+        jacobian(t1, t2);
+        Eigen::Matrix<double, 5, 5> H = J.transpose() * J;
+        Eigen::Matrix<double, 5, 1> g = J.transpose() * r;
+        bool improved = false;
+        while (!improved && lambda < 1e6) {
+            Eigen::Matrix<double, 5, 5> damped = H;
+            damped.diagonal() *= 1.0 + lambda;
+            Eigen::Matrix<double, 5, 1> step = -damped.ldlt().solve(g);
+            Eigen::Matrix3d Rn;
+            Eigen::Vector3d tn;
+            update(Rd, td, t1, t2, step, Rn, tn);
+            residuals(Rn, tn, shifted);
+            double shifted_cost = shifted.squaredNorm();
+            if (shifted_cost < cost) {
+                improved = true;
+                Rd = Rn;
+                td = tn;
+                r.swap(shifted);
+                lambda = std::max(lambda * 0.1, 1e-9);
+                if (cost - shifted_cost < 1e-10 * cost) {
+                    iteration = REFINE_ITERATIONS;
+                }
+                cost = shifted_cost;
+            } else {
+                lambda *= 10.0;
+            }
+        }
+        if (!improved) {
+            break;
+        }
+    }
+    R = Rd.cast<float>();
+    t = td.cast<float>();
+
+    // Gauss-Newton covariance at the solution, scaled by the residual variance
+    Eigen::Vector3d t1 = td.unitOrthogonal();
+    Eigen::Vector3d t2 = td.cross(t1);
+    jacobian(t1, t2);
+    Eigen::Matrix<double, 5, 5> H = J.transpose() * J;
+    Eigen::FullPivLU<Eigen::Matrix<double, 5, 5>> lu(H);
+    if (!lu.isInvertible()) {
+        return;
+    }
+    Eigen::Matrix<double, 5, 5> covariance = cost / (count - 5) * lu.inverse();
+    Eigen::Matrix<double, 3, 2> basis;
+    basis << t1, t2;
+    rotation_covariance = covariance.topLeftCorner<3, 3>().cast<float>();
+    translation_covariance = (basis * covariance.bottomRightCorner<2, 2>() * basis.transpose()).cast<float>();
+}
+
+void EssentialRansac::draw_sample(int iteration, Prosac* prosac) {
+    if (!prosac) {
+        for (int k = 0; k < 8; ++k) {
+            bool repeated;
+            do {
+                m_sample[k] = static_cast<int>(random() % static_cast<uint32_t>(m_count));
+                repeated = std::find(m_sample, m_sample + k, m_sample[k]) != m_sample + k;
+            } while (repeated);
+        }
+        return;
+    }
+
+    // The top set grows once the samples reach T'_n. Until then every sample takes the
+    // n-th match and 7 of the better ones, so no sample is drawn twice
+    int t = iteration + 1;
+    if (t == prosac->T_n_prime && prosac->n < m_count) {
+        double T_next = prosac->T_n * (prosac->n + 1) / (prosac->n + 1 - 8);
+        prosac->T_n_prime += static_cast<int>(std::ceil(T_next - prosac->T_n));
+        prosac->T_n = T_next;
+        ++prosac->n;
+    }
+    int n = prosac->n;
+    int drawn = 0;
+    if (prosac->T_n_prime >= t) {
+        m_sample[drawn++] = n - 1;
+        --n;
+    }
+    for (; drawn < 8; ++drawn) {
+        bool repeated;
+        do {
+            m_sample[drawn] = static_cast<int>(random() % static_cast<uint32_t>(n));
+            repeated = std::find(m_sample, m_sample + drawn, m_sample[drawn]) != m_sample + drawn;
+        } while (repeated);
+    }
+    for (int k = 0; k < 8; ++k) {
+        m_sample[k] = m_order[m_sample[k]];
+    }
+}
+
+int EssentialRansac::progressive_iterations(int drawn) const {
+    // Maximality of the PROSAC paper: the samples came from the top drawn matches, so they
+    // were drawn from the top n for every n >= drawn too
+    int needed = m_settings.max_iterations;
+    int inliers = 0;
+    for (int n = 1; n <= m_count; ++n) {
+        inliers += m_mask[m_order[n - 1]];
+        if (n >= drawn && inliers >= m_min_inliers[n]) {
+            needed = std::min(needed, iterations_for(static_cast<double>(inliers) / n, m_settings.confidence,
+                                                     m_settings.max_iterations));
+        }
+    }
+    return needed;
+}
+
+const int EssentialRansac::PROSAC_MIN_TOP;
+
+bool EssentialRansac::estimate(const float* points1, const float* points2, int count, RelativePose& pose) {
+    return estimate(points1, points2, nullptr, count, pose);
+}
+
+bool EssentialRansac::estimate(const float* points1, const float* points2, const float* quality, int count,
+                               RelativePose& pose) {
+    m_count = count;
+    m_mask.assign(count, 0);
+    pose.inliers = 0;
+    pose.iterations = 0;
+    pose.solution_iteration = 0;
+    if (count < 8) {
+        return false;
+    }
+
+    m_x1.resize(count);
+    m_y1.resize(count);
+    m_x2.resize(count);
+    m_y2.resize(count);
+    for (int i = 0; i < count; ++i) {
+        m_x1[i] = (points1[2 * i] - m_intrinsics.cx) / m_intrinsics.fx;
+        m_y1[i] = (points1[2 * i + 1] - m_intrinsics.cy) / m_intrinsics.fy;
+        m_x2[i] = (points2[2 * i] - m_intrinsics.cx) / m_intrinsics.fx;
+        m_y2[i] = (points2[2 * i + 1] - m_intrinsics.cy) / m_intrinsics.fy;
+    }
+
+    Prosac prosac;
+    if (quality) {
+        m_order.resize(count);
+        for (int i = 0; i < count; ++i) {
+            m_order[i] = i;
+        }
+        std::stable_sort(m_order.begin(), m_order.end(), [quality](int a, int b) { return quality[a] > quality[b]; });
+
+        // T_n for n = 8 and the first growth on the first sample
+        prosac.n = 8;
+        prosac.T_n = PROSAC_GROWTH;
+        for (int i = 0; i < 8; ++i) {
+            prosac.T_n *= static_cast<double>(8 - i) / (count - i);
+        }
+        prosac.T_n_prime = 1;
+
+        // Non-randomness: the fewest inliers among the top n that a wrong hypothesis has
+        // with a probability under psi, its 8 sample matches plus Binomial(n - 8, beta) others.
+        // A small top n passes on a couple of matches agreeing by chance, the stopping rule
+        // only looks at the top n from PROSAC_MIN_TOP and a fraction of all the matches on
+        m_min_inliers.assign(count + 1, count + 1);
+        int min_top = std::max(PROSAC_MIN_TOP, count / PROSAC_MIN_TOP_DIVISOR);
+        for (int n = min_top; n <= count; ++n) {
+            int trials = n - 8;
+            double pmf = std::pow(1.0 - PROSAC_BETA, trials);
+            double cdf = pmf;
+            int extra = 0;
+            while (cdf < 1.0 - PROSAC_PSI && extra < trials) {
+                pmf *= static_cast<double>(trials - extra) / (extra + 1) * PROSAC_BETA / (1.0 - PROSAC_BETA);
+                cdf += pmf;
+                ++extra;
+            }
+            m_min_inliers[n] = 8 + extra + 1;
+        }
+    }
+
+    // Same samples for the same matches, frame after frame
+    m_state = m_settings.seed ? m_settings.seed : 1;
+    Eigen::Matrix3f best_E = Eigen::Matrix3f::Zero();
+    int best_count = 0;
+    int best_raw = 0;
+    int needed = m_settings.max_iterations;
+    int iteration = 0;
+    for (; iteration < needed; ++iteration) {
+        draw_sample(iteration, quality ? &prosac : nullptr);
+
+        Eigen::Matrix3f E;
+        if (!solve_minimal(E)) {
+            continue;
+        }
+        int inliers = count_inliers(E, m_threshold2, nullptr);
+        // Local optimization: 8 noisy matches make a poor hypothesis, refit on its inliers so
+        // the stopping criterion sees the inlier ratio of a good one. Samples are compared by
+        // their own inliers, the refit count of an early one is a bar few samples reach
+        if (inliers > best_raw) {
+            best_raw = inliers;
+            inliers = optimize(E, inliers);
+            if (inliers > best_count) {
+                best_count = inliers;
+                best_E = E;
+                pose.solution_iteration = iteration + 1;
+                if (quality) {
+                    count_inliers(best_E, m_threshold2, m_mask.data());
+                    needed = progressive_iterations(prosac.n);
+                } else {
+                    needed = iterations_for(static_cast<double>(inliers) / count, m_settings.confidence,
+                                            m_settings.max_iterations);
+                }
+                needed = std::max(iteration + 1, needed);
+            }
+        }
+    }
+    pose.iterations = iteration;
+    if (best_count < 8) {
+        return false;
+    }
+
+    count_inliers(best_E, m_threshold2, m_mask.data());
+    Eigen::Matrix3f R;
+    Eigen::Vector3f t;
+    int best_inliers = recover_pose(best_E, R, t);
+    // The linear fits don't know E has 5 degrees of freedom, the pose does
+    count_inliers(best_E, REFINE_WIDENING * REFINE_WIDENING * m_threshold2, m_mask.data());
+    refine(R, t, pose.rotation_covariance, pose.translation_covariance);
+    pose.E = (skew(t.cast<double>()) * R.cast<double>()).cast<float>();
+    count_inliers(pose.E, m_threshold2, m_mask.data());
+    pose.inliers = recover_pose(pose.E, pose.R, pose.t);
+    if (pose.inliers < best_inliers) {
+        // Outliers within the wider threshold can pull the refinement off, keep the hypothesis then
+        pose.E = best_E;
+        count_inliers(best_E, m_threshold2, m_mask.data());
+        pose.inliers = recover_pose(best_E, pose.R, pose.t);
+    }
+    return pose.inliers >= 8;
+}
+
+} // namespace dkd
@@ -0,0 +1,701 @@
+#include "matcher.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string.h>
+
+#if !defined(DKD_DISABLE_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define DKD_USE_NEON
+#elif !defined(DKD_DISABLE_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define DKD_USE_SSE2
+#endif
+
+namespace dkd {
+
+namespace {
+
+// Descriptor rows are padded to whole 8 lane int16 vectors
+inline int padded_depth(int D) { return (D + 7) / 8 * 8; }
+
+// Dot products of a with the 4 rows starting at b, n is a multiple of 8
+inline void dot4(const int16_t* a, const int16_t* b, int n, int32_t* out) {
+    const int16_t* b0 = b;
+    const int16_t* b1 = b + n;
+    const int16_t* b2 = b + 2 * n;
+    const int16_t* b3 = b + 3 * n;
+#if defined(DKD_USE_NEON)
+    int32x4_t s0 = vdupq_n_s32(0), s1 = vdupq_n_s32(0), s2 = vdupq_n_s32(0), s3 = vdupq_n_s32(0);
+    for (int k = 0; k < n; k += 8) {
+        int16x8_t va = vld1q_s16(a + k);
+        int16x4_t lo = vget_low_s16(va), hi = vget_high_s16(va);
+        int16x8_t v0 = vld1q_s16(b0 + k), v1 = vld1q_s16(b1 + k), v2 = vld1q_s16(b2 + k), v3 = vld1q_s16(b3 + k);
+        s0 = vmlal_s16(vmlal_s16(s0, lo, vget_low_s16(v0)), hi, vget_high_s16(v0));
+        s1 = vmlal_s16(vmlal_s16(s1, lo, vget_low_s16(v1)), hi, vget_high_s16(v1));
+        s2 = vmlal_s16(vmlal_s16(s2, lo, vget_low_s16(v2)), hi, vget_high_s16(v2));
+        s3 = vmlal_s16(vmlal_s16(s3, lo, vget_low_s16(v3)), hi, vget_high_s16(v3));
+    }
+    // ARMv7 has no horizontal add, pairwise adds reduce all four at once
+    int32x2_t p0 = vpadd_s32(vget_low_s32(s0), vget_high_s32(s0));
+    int32x2_t p1 = vpadd_s32(vget_low_s32(s1), vget_high_s32(s1));
+    int32x2_t p2 = vpadd_s32(vget_low_s32(s2), vget_high_s32(s2));
+    int32x2_t p3 = vpadd_s32(vget_low_s32(s3), vget_high_s32(s3));
+    vst1_s32(out, vpadd_s32(p0, p1));
+    vst1_s32(out + 2, vpadd_s32(p2, p3));
+#elif defined(DKD_USE_SSE2)
+    __m128i s0 = _mm_setzero_si128(), s1 = s0, s2 = s0, s3 = s0;
+    for (int k = 0; k < n; k += 8) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + k));
+        // pmaddwd: int16 products summed pairwise into int32, exact
+        s0 = _mm_add_epi32(s0, _mm_madd_epi16(va, _mm_loadu_si128(reinterpret_cast<const __m128i*>(b0 + k))));
+        s1 = _mm_add_epi32(s1, _mm_madd_epi16(va, _mm_loadu_si128(reinterpret_cast<const __m128i*>(b1 + k))));
+        s2 = _mm_add_epi32(s2, _mm_madd_epi16(va, _mm_loadu_si128(reinterpret_cast<const __m128i*>(b2 + k))));
+        s3 = _mm_add_epi32(s3, _mm_madd_epi16(va, _mm_loadu_si128(reinterpret_cast<const __m128i*>(b3 + k))));
+    }
+    // Transpose and add, lane i ends up with the sum of s_i
+    __m128i s01 = _mm_add_epi32(_mm_unpacklo_epi32(s0, s1), _mm_unpackhi_epi32(s0, s1));
+    __m128i s23 = _mm_add_epi32(_mm_unpacklo_epi32(s2, s3), _mm_unpackhi_epi32(s2, s3));
+    __m128i sums = _mm_add_epi32(_mm_unpacklo_epi64(s01, s23), _mm_unpackhi_epi64(s01, s23));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), sums);
+#else
+    int32_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (int k = 0; k < n; ++k) {
+        int32_t va = a[k];
+        s0 += va * b0[k];
+        s1 += va * b1[k];
+        s2 += va * b2[k];
+        s3 += va * b3[k];
+    }
+    out[0] = s0;
+    out[1] = s1;
+    out[2] = s2;
+    out[3] = s3;
+#endif
+}
+
+// Dot product of two rows, for the tail of the columns
+inline int32_t dot1(const int16_t* a, const int16_t* b, int n) {
+    int32_t sum = 0;
+    for (int k = 0; k < n; ++k) {
+        sum += static_cast<int32_t>(a[k]) * b[k];
+    }
+    return sum;
+}
+
+// uint8 row minus the zero point, padded to n with zeros
+inline void center_row(const uint8_t* src, int D, int n, int32_t zero_point, int16_t* dst) {
+    for (int k = 0; k < D; ++k) {
+        dst[k] = static_cast<int16_t>(src[k] - zero_point);
+    }
+    std::fill(dst + D, dst + n, 0);
+}
+
+void center(const uint8_t* descriptors, int count, int D, int n, int32_t zero_point, std::vector<int16_t>& centered) {
+    centered.resize(static_cast<size_t>(count) * n);
+    for (int i = 0; i < count; ++i) {
+        center_row(descriptors + static_cast<size_t>(i) * D, D, n, zero_point, centered.data() + static_cast<size_t>(i) * n);
+    }
+}
+
+// Squared norms of count centered rows of n values
+void squared_norms(const std::vector<int16_t>& centered, int count, int n, std::vector<int32_t>& norms) {
+    norms.resize(count);
+    for (int i = 0; i < count; ++i) {
+        const int16_t* row = centered.data() + static_cast<size_t>(i) * n;
+        norms[i] = dot1(row, row, n);
+    }
+}
+
+// dot(dequantized) = scale^2 * dot(centered), the integer dot must reach threshold / scale^2
+int32_t quantized_similarity(float threshold, const Quantization& quantization) {
+    double scale2 = static_cast<double>(quantization.scale) * quantization.scale;
+    double t = std::ceil(threshold / scale2);
+    return static_cast<int32_t>(std::min(std::max(t, 1.0), static_cast<double>(std::numeric_limits<int32_t>::max())));
+}
+
+// Cell range [first, last] of the grid covering [lo, hi], clamped to the count cells.
+// Empty when first > last
+inline void cell_range(float lo, float hi, float origin, float cell, int count, int& first, int& last) {
+    float a = std::floor((lo - origin) / cell);
+    float b = std::floor((hi - origin) / cell);
+    first = static_cast<int>(std::min(std::max(a, 0.0f), static_cast<float>(count)));
+    last = static_cast<int>(std::max(std::min(b, static_cast<float>(count - 1)), -1.0f));
+}
+
+// Signature rows are padded to whole 16 byte vectors
+inline int padded_signature(int D) { return (signature_size(D) + 15) / 16 * 16; }
+
+// Popcount of the xor of two rows of n bytes, n is a multiple of 8
+inline int32_t hamming1(const uint8_t* a, const uint8_t* b, int n) {
+    int32_t distance = 0;
+    for (int k = 0; k < n; k += 8) {
+        uint64_t wa, wb;
+        memcpy(&wa, a + k, 8);
+        memcpy(&wb, b + k, 8);
+        distance += __builtin_popcountll(wa ^ wb);
+    }
+    return distance;
+}
+
+#if defined(DKD_USE_SSE2) && !defined(__POPCNT__)
+// Bit counts of the 16 bytes, SSE2 has neither popcnt nor pshufb
+inline __m128i popcount_bytes(__m128i v) {
+    const __m128i m1 = _mm_set1_epi8(0x55), m2 = _mm_set1_epi8(0x33), m4 = _mm_set1_epi8(0x0f);
+    v = _mm_sub_epi8(v, _mm_and_si128(_mm_srli_epi16(v, 1), m1));
+    v = _mm_add_epi8(_mm_and_si128(v, m2), _mm_and_si128(_mm_srli_epi16(v, 2), m2));
+    return _mm_and_si128(_mm_add_epi8(v, _mm_srli_epi16(v, 4)), m4);
+}
+#endif
+
+// Hamming distances of a to the 4 rows starting at b, n is a multiple of 16
+inline void hamming4(const uint8_t* a, const uint8_t* b, int n, int32_t* out) {
+    const uint8_t* b0 = b;
+    const uint8_t* b1 = b + n;
+    const uint8_t* b2 = b + 2 * n;
+    const uint8_t* b3 = b + 3 * n;
+#if defined(DKD_USE_NEON)
+    uint16x8_t s0 = vdupq_n_u16(0), s1 = vdupq_n_u16(0), s2 = vdupq_n_u16(0), s3 = vdupq_n_u16(0);
+    for (int k = 0; k < n; k += 16) {
+        uint8x16_t va = vld1q_u8(a + k);
+        s0 = vpadalq_u8(s0, vcntq_u8(veorq_u8(va, vld1q_u8(b0 + k))));
+        s1 = vpadalq_u8(s1, vcntq_u8(veorq_u8(va, vld1q_u8(b1 + k))));
+        s2 = vpadalq_u8(s2, vcntq_u8(veorq_u8(va, vld1q_u8(b2 + k))));
+        s3 = vpadalq_u8(s3, vcntq_u8(veorq_u8(va, vld1q_u8(b3 + k))));
+    }
+    uint16x4_t p0 = vpadd_u16(vget_low_u16(s0), vget_high_u16(s0));
+    uint16x4_t p1 = vpadd_u16(vget_low_u16(s1), vget_high_u16(s1));
+    uint16x4_t p2 = vpadd_u16(vget_low_u16(s2), vget_high_u16(s2));
+    uint16x4_t p3 = vpadd_u16(vget_low_u16(s3), vget_high_u16(s3));
+    uint16x4_t sums = vpadd_u16(vpadd_u16(p0, p1), vpadd_u16(p2, p3));
+    vst1q_s32(out, vreinterpretq_s32_u32(vmovl_u16(sums)));
+#elif defined(DKD_USE_SSE2) && !defined(__POPCNT__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i s0 = zero, s1 = zero, s2 = zero, s3 = zero;
+    for (int k = 0; k < n; k += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + k));
+        // psadbw against zero sums the byte counts into the two 64 bit halves
+        s0 = _mm_add_epi64(s0, _mm_sad_epu8(popcount_bytes(_mm_xor_si128(va, _mm_loadu_si128(reinterpret_cast<const __m128i*>(b0 + k)))), zero));
+        s1 = _mm_add_epi64(s1, _mm_sad_epu8(popcount_bytes(_mm_xor_si128(va, _mm_loadu_si128(reinterpret_cast<const __m128i*>(b1 + k)))), zero));
+        s2 = _mm_add_epi64(s2, _mm_sad_epu8(popcount_bytes(_mm_xor_si128(va, _mm_loadu_si128(reinterpret_cast<const __m128i*>(b2 + k)))), zero));
+        s3 = _mm_add_epi64(s3, _mm_sad_epu8(popcount_bytes(_mm_xor_si128(va, _mm_loadu_si128(reinterpret_cast<const __m128i*>(b3 + k)))), zero));
+    }
+    out[0] = _mm_cvtsi128_si32(s0) + _mm_cvtsi128_si32(_mm_srli_si128(s0, 8));
+    out[1] = _mm_cvtsi128_si32(s1) + _mm_cvtsi128_si32(_mm_srli_si128(s1, 8));
+    out[2] = _mm_cvtsi128_si32(s2) + _mm_cvtsi128_si32(_mm_srli_si128(s2, 8));
+    out[3] = _mm_cvtsi128_si32(s3) + _mm_cvtsi128_si32(_mm_srli_si128(s3, 8));
+#else
+    // A single popcnt per 64 bits when the target has it
+    out[0] = hamming1(a, b0, n);
+    out[1] = hamming1(a, b1, n);
+    out[2] = hamming1(a, b2, n);
+    out[3] = hamming1(a, b3, n);
+#endif
+}
+
+// Signature rows padded to n bytes with zeros
+void pad_signatures(const uint8_t* signatures, int count, int size, int n, std::vector<uint8_t>& padded) {
+    padded.resize(static_cast<size_t>(count) * n);
+    for (int i = 0; i < count; ++i) {
+        uint8_t* dst = padded.data() + static_cast<size_t>(i) * n;
+        memcpy(dst, signatures + static_cast<size_t>(i) * size, size);
+        memset(dst + size, 0, n - size);
+    }
+}
+
+} // namespace
+
+void MutualMatcher::configure(const Quantization& quantization, float threshold, float ratio) {
+    m_quantization = quantization;
+    m_threshold = quantized_similarity(threshold, quantization);
+    m_ratio = ratio;
+}
+
+void MutualMatcher::reserve(int count, int D) {
+    size_t size = static_cast<size_t>(count) * padded_depth(D);
+    m_centered1.reserve(size);
+    m_centered2.reserve(size);
+    m_norms1.reserve(count);
+    m_norms2.reserve(count);
+    m_rows.reserve(count);
+    m_columns.reserve(count);
+}
+
+bool MutualMatcher::sweep(const uint8_t* descriptors1, int count1, const uint8_t* descriptors2, int count2, int D) {
+    if (count1 <= 0 || count2 <= 0) {
+        return false;
+    }
+
+    int n = padded_depth(D);
+    center(descriptors1, count1, D, n, m_quantization.zero_point, m_centered1);
+    center(descriptors2, count2, D, n, m_quantization.zero_point, m_centered2);
+    if (m_ratio < 1.0f) {
+        // The uint8 rounding leaves the rows off unit norm, by a different amount each
+        squared_norms(m_centered1, count1, n, m_norms1);
+        squared_norms(m_centered2, count2, n, m_norms2);
+    }
+
+    const int32_t lowest = std::numeric_limits<int32_t>::min();
+    const Best empty = {lowest, lowest, -1, -1};
+    m_rows.assign(count1, empty);
+    m_columns.assign(count2, empty);
+
+    // Equal to the best goes to second, a tie makes a match ambiguous for the ratio test
+    auto update = [](Best& best, int32_t sim, int index) {
+        if (sim > best.best) {
+            best.second = best.best;
+            best.second_index = best.index;
+            best.best = sim;
+            best.index = index;
+        } else if (sim > best.second) {
+            best.second = sim;
+            best.second_index = index;
+        }
+    };
+
+    // One pass over all the pairs, 4 columns at a time to reuse the row in registers.
+    // Strict comparisons keep the lowest index on ties
+    int32_t sims[4];
+    for (int i = 0; i < count1; ++i) {
+        const int16_t* a = m_centered1.data() + static_cast<size_t>(i) * n;
+        Best row = empty;
+
+        int j = 0;
+        for (; j + 4 <= count2; j += 4) {
+            dot4(a, m_centered2.data() + static_cast<size_t>(j) * n, n, sims);
+            for (int c = 0; c < 4; ++c) {
+                update(row, sims[c], j + c);
+                update(m_columns[j + c], sims[c], i);
+            }
+        }
+        for (; j < count2; ++j) {
+            int32_t sim = dot1(a, m_centered2.data() + static_cast<size_t>(j) * n, n);
+            update(row, sim, j);
+            update(m_columns[j], sim, i);
+        }
+        m_rows[i] = row;
+    }
+    return true;
+}
+
+bool MutualMatcher::distinct(const Best& best, int index, const std::vector<int32_t>& norms,
+                             const std::vector<int32_t>& other_norms) const {
+    if (m_ratio >= 1.0f || best.second_index < 0) {
+        return true;
+    }
+    // |a - b|^2 = |a|^2 + |b|^2 - 2 a.b on the centered rows, the scale^2 of the dequantized
+    // distances cancels out of d1 < ratio * d2 squared
+    int64_t norm = norms[index];
+    int64_t d1 = norm + other_norms[best.index] - 2 * static_cast<int64_t>(best.best);
+    int64_t d2 = norm + other_norms[best.second_index] - 2 * static_cast<int64_t>(best.second);
+    return d1 < static_cast<double>(m_ratio) * m_ratio * d2;
+}
+
+bool MutualMatcher::accepted(int i) const {
+    const Best& row = m_rows[i];
+    if (row.best < m_threshold) {
+        return false;
+    }
+    const Best& column = m_columns[row.index];
+    return column.index == i && distinct(row, i, m_norms1, m_norms2) && distinct(column, row.index, m_norms2, m_norms1);
+}
+
+void MutualMatcher::match(const uint8_t* descriptors1, int count1, const uint8_t* descriptors2, int count2, int D,
+                          std::vector<std::pair<int, int>>& matches) {
+    matches.clear();
+    if (!sweep(descriptors1, count1, descriptors2, count2, D)) {
+        return;
+    }
+    for (int i = 0; i < count1; ++i) {
+        if (accepted(i)) {
+            matches.emplace_back(i, m_rows[i].index);
+        }
+    }
+}
+
+void MutualMatcher::match(const uint8_t* descriptors1, int count1, const uint8_t* descriptors2, int count2, int D,
+                          std::vector<Match>& matches) {
+    matches.clear();
+    if (!sweep(descriptors1, count1, descriptors2, count2, D)) {
+        return;
+    }
+    float scale2 = m_quantization.scale * m_quantization.scale;
+    for (int i = 0; i < count1; ++i) {
+        if (accepted(i)) {
+            const Best& row = m_rows[i];
+            Match match;
+            match.index1 = i;
+            match.index2 = row.index;
+            match.second_index2 = row.second_index;
+            match.similarity = row.best * scale2;
+            match.second_similarity = row.second_index >= 0 ? row.second * scale2 : 0.0f;
+            matches.push_back(match);
+        }
+    }
+}
+
+void binarize(const uint8_t* descriptors, int count, int D, int32_t zero_point, uint8_t* signatures) {
+    int size = signature_size(D);
+    for (int i = 0; i < count; ++i) {
+        const uint8_t* src = descriptors + static_cast<size_t>(i) * D;
+        uint8_t* dst = signatures + static_cast<size_t>(i) * size;
+        memset(dst, 0, size);
+        for (int k = 0; k < D; ++k) {
+            dst[k >> 3] |= static_cast<uint8_t>((src[k] > zero_point) << (k & 7));
+        }
+    }
+}
+
+void HammingMatcher::configure(int max_distance, float ratio) {
+    m_max_distance = max_distance;
+    m_ratio = ratio;
+}
+
+void HammingMatcher::reserve(int count, int D) {
+    size_t size = static_cast<size_t>(count) * padded_signature(D);
+    m_padded1.reserve(size);
+    m_padded2.reserve(size);
+    m_column_best.reserve(count);
+    m_column_index.reserve(count);
+    m_row_index.reserve(count);
+}
+
+void HammingMatcher::match(const uint8_t* signatures1, int count1, const uint8_t* signatures2, int count2, int D,
+                           std::vector<std::pair<int, int>>& matches) {
+    matches.clear();
+    if (count1 <= 0 || count2 <= 0) {
+        return;
+    }
+
+    int n = padded_signature(D);
+    pad_signatures(signatures1, count1, signature_size(D), n, m_padded1);
+    pad_signatures(signatures2, count2, signature_size(D), n, m_padded2);
+
+    m_column_best.assign(count2, std::numeric_limits<int32_t>::max());
+    m_column_index.assign(count2, -1);
+    m_row_index.resize(count1);
+
+    // Same single pass as MutualMatcher, keeping the second best of the rows for the ratio test
+    int32_t distances[4];
+    for (int i = 0; i < count1; ++i) {
+        const uint8_t* a = m_padded1.data() + static_cast<size_t>(i) * n;
+        int32_t row_best = std::numeric_limits<int32_t>::max();
+        int32_t row_second = std::numeric_limits<int32_t>::max();
+        int row_index = -1;
+
+        auto update = [&](int j, int32_t distance) {
+            if (distance < row_best) {
+                row_second = row_best;
+                row_best = distance;
+                row_index = j;
+            } else if (distance < row_second) {
+                row_second = distance;
+            }
+            if (distance < m_column_best[j]) {
+                m_column_best[j] = distance;
+                m_column_index[j] = i;
+            }
+        };
+
+        int j = 0;
+        for (; j + 4 <= count2; j += 4) {
+            hamming4(a, m_padded2.data() + static_cast<size_t>(j) * n, n, distances);
+            for (int c = 0; c < 4; ++c) {
+                update(j + c, distances[c]);
+            }
+        }
+        for (; j < count2; ++j) {
+            update(j, hamming1(a, m_padded2.data() + static_cast<size_t>(j) * n, n));
+        }
+
+        bool close = row_best <= m_max_distance;
+        // Without a second candidate there is nothing to be ambiguous with
+        bool distinct = m_ratio >= 1.0f || row_second == std::numeric_limits<int32_t>::max() ||
+                        row_best < m_ratio * row_second;
+        m_row_index[i] = close && distinct ? row_index : -1;
+    }
+
+    for (int i = 0; i < count1; ++i) {
+        int j = m_row_index[i];
+        if (j >= 0 && m_column_index[j] == i) {
+            matches.emplace_back(i, j);
+        }
+    }
+}
+
+const int BlockedMatcher::TILE_ROWS;
+const int BlockedMatcher::TILE_COLS;
+
+void BlockedMatcher::configure(float threshold, float ratio) {
+    m_threshold = threshold;
+    m_ratio = ratio;
+}
+
+bool BlockedMatcher::distinct(const Best& best) const {
+    if (m_ratio >= 1.0f || best.second == -std::numeric_limits<float>::infinity()) {
+        return true;
+    }
+    // |a - b|^2 = 2 - 2 a.b for unit rows, d1 < ratio * d2 without the square roots
+    return 1.0f - best.best < m_ratio * m_ratio * (1.0f - best.second);
+}
+
+void BlockedMatcher::match(const Eigen::MatrixXf& desc1, const Eigen::MatrixXf& desc2,
+                           std::vector<std::pair<int, int>>& matches) {
+    matches.clear();
+    int count1 = static_cast<int>(desc1.rows());
+    int count2 = static_cast<int>(desc2.rows());
+    if (count1 == 0 || count2 == 0) {
+        return;
+    }
+
+    const float lowest = -std::numeric_limits<float>::infinity();
+    const Best empty = {lowest, lowest, -1};
+    m_rows.assign(count1, empty);
+    m_columns.assign(count2, empty);
+    m_tile.resize(TILE_ROWS, TILE_COLS);
+
+    auto update = [](Best& best, float sim, int index) {
+        if (sim > best.best) {
+            best.second = best.best;
+            best.best = sim;
+            best.index = index;
+        } else if (sim > best.second) {
+            best.second = sim;
+        }
+    };
+
+    // Rows and columns both see their candidates in increasing index order, so the strict
+    // comparisons keep the lowest index on ties like maxCoeff()
+    for (int i0 = 0; i0 < count1; i0 += TILE_ROWS) {
+        int rows = std::min(TILE_ROWS, count1 - i0);
+        for (int j0 = 0; j0 < count2; j0 += TILE_COLS) {
+            int cols = std::min(TILE_COLS, count2 - j0);
+            auto tile = m_tile.topLeftCorner(rows, cols);
+            tile.noalias() = desc1.middleRows(i0, rows) * desc2.middleRows(j0, cols).transpose();
+
+            for (int c = 0; c < cols; ++c) {
+                Best& column = m_columns[j0 + c];
+                for (int r = 0; r < rows; ++r) {
+                    float sim = tile(r, c);
+                    update(m_rows[i0 + r], sim, j0 + c);
+                    update(column, sim, i0 + r);
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < count1; ++i) {
+        const Best& row = m_rows[i];
+        if (row.best < m_threshold || m_columns[row.index].index != i) {
+            continue;
+        }
+        if (distinct(row) && distinct(m_columns[row.index])) {
+            matches.emplace_back(i, row.index);
+        }
+    }
+}
+
+MotionModel MotionModel::identity() {
+    MotionModel model = {{1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f}};
+    return model;
+}
+
+MotionModel MotionModel::constant_velocity(const float* points1, const float* points2,
+                                           const std::vector<std::pair<int, int>>& matches) {
+    MotionModel model = identity();
+    if (matches.empty()) {
+        return model;
+    }
+    // Median rather than mean, the matches aren't verified yet
+    std::vector<float> dx, dy;
+    dx.reserve(matches.size());
+    dy.reserve(matches.size());
+    for (const std::pair<int, int>& m : matches) {
+        dx.push_back(points2[2 * m.second] - points1[2 * m.first]);
+        dy.push_back(points2[2 * m.second + 1] - points1[2 * m.first + 1]);
+    }
+    size_t middle = matches.size() / 2;
+    std::nth_element(dx.begin(), dx.begin() + middle, dx.end());
+    std::nth_element(dy.begin(), dy.begin() + middle, dy.end());
+    model.h[2] = dx[middle];
+    model.h[5] = dy[middle];
+    return model;
+}
+
+MotionModel MotionModel::rotation(float fx, float fy, float cx, float cy, const float* rotation) {
+    const float k[9] = {fx, 0.0f, cx, 0.0f, fy, cy, 0.0f, 0.0f, 1.0f};
+    const float k_inv[9] = {1.0f / fx, 0.0f, -cx / fx, 0.0f, 1.0f / fy, -cy / fy, 0.0f, 0.0f, 1.0f};
+    float kr[9];
+    for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 3; ++c) {
+            kr[3 * r + c] = k[3 * r] * rotation[c] + k[3 * r + 1] * rotation[3 + c] + k[3 * r + 2] * rotation[6 + c];
+        }
+    }
+    MotionModel model;
+    for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 3; ++c) {
+            model.h[3 * r + c] = kr[3 * r] * k_inv[c] + kr[3 * r + 1] * k_inv[3 + c] + kr[3 * r + 2] * k_inv[6 + c];
+        }
+    }
+    return model;
+}
+
+void MotionModel::predict(const float* points, int count, float* predicted) const {
+    for (int i = 0; i < count; ++i) {
+        float x = points[2 * i], y = points[2 * i + 1];
+        float w = h[6] * x + h[7] * y + h[8];
+        predicted[2 * i] = (h[0] * x + h[1] * y + h[2]) / w;
+        predicted[2 * i + 1] = (h[3] * x + h[4] * y + h[5]) / w;
+    }
+}
+
+void GuidedMatcher::configure(const Quantization& quantization, float threshold, float radius, int min_matches) {
+    m_quantization = quantization;
+    m_threshold = quantized_similarity(threshold, quantization);
+    // Zero, negative or NaN radii leave nothing to search, guided matching is off then
+    m_radius = std::isfinite(radius) && radius > 0.0f ? radius : 0.0f;
+    m_min_matches = min_matches;
+    m_brute_force.configure(quantization, threshold);
+}
+
+void GuidedMatcher::reserve(int count, int D) {
+    size_t size = static_cast<size_t>(count) * padded_depth(D);
+    m_brute_force.reserve(count, D);
+    m_cell_of.reserve(count);
+    m_sorted_index.reserve(count);
+    m_sorted_points.reserve(2 * count);
+    m_centered1.reserve(size);
+    m_sorted2.reserve(size);
+    m_column_best.reserve(count);
+    m_column_index.reserve(count);
+    m_row_index.reserve(count);
+}
+
+bool GuidedMatcher::match(const uint8_t* descriptors1, const float* predicted1, int count1,
+                          const uint8_t* descriptors2, const float* points2, int count2, int D,
+                          std::vector<std::pair<int, int>>& matches) {
+    matches.clear();
+    if (count1 <= 0 || count2 <= 0) {
+        return true;
+    }
+    if (m_radius == 0.0f) {
+        m_brute_force.match(descriptors1, count1, descriptors2, count2, D, matches);
+        return false;
+    }
+
+    // Grid of radius sized cells over the second frame, a search only spans 2-3 cells a side
+    float min_x = points2[0], max_x = points2[0], min_y = points2[1], max_y = points2[1];
+    for (int j = 1; j < count2; ++j) {
+        min_x = std::min(min_x, points2[2 * j]);
+        max_x = std::max(max_x, points2[2 * j]);
+        min_y = std::min(min_y, points2[2 * j + 1]);
+        max_y = std::max(max_y, points2[2 * j + 1]);
+    }
+    float extent = std::max(max_x - min_x, max_y - min_y);
+    float cell = std::max(std::max(m_radius, 1.0f), extent / MAX_GRID_SIDE);
+    int grid_w = static_cast<int>((max_x - min_x) / cell) + 1;
+    int grid_h = static_cast<int>((max_y - min_y) / cell) + 1;
+
+    // Counting sort of the second frame by cell, keeping the index order within a cell
+    m_cell_start.assign(grid_w * grid_h + 1, 0);
+    m_cell_of.resize(count2);
+    for (int j = 0; j < count2; ++j) {
+        int cx = std::min(static_cast<int>((points2[2 * j] - min_x) / cell), grid_w - 1);
+        int cy = std::min(static_cast<int>((points2[2 * j + 1] - min_y) / cell), grid_h - 1);
+        m_cell_of[j] = cy * grid_w + cx;
+        ++m_cell_start[m_cell_of[j] + 1];
+    }
+    for (int c = 0; c < grid_w * grid_h; ++c) {
+        m_cell_start[c + 1] += m_cell_start[c];
+    }
+
+    int n = padded_depth(D);
+    m_sorted_index.resize(count2);
+    m_sorted_points.resize(2 * count2);
+    m_sorted2.resize(static_cast<size_t>(count2) * n);
+    for (int j = 0; j < count2; ++j) {
+        // Fills the cells through their starts, shifted back below
+        int s = m_cell_start[m_cell_of[j]]++;
+        m_sorted_index[s] = j;
+        m_sorted_points[2 * s] = points2[2 * j];
+        m_sorted_points[2 * s + 1] = points2[2 * j + 1];
+        center_row(descriptors2 + static_cast<size_t>(j) * D, D, n, m_quantization.zero_point,
+                   m_sorted2.data() + static_cast<size_t>(s) * n);
+    }
+    for (int c = grid_w * grid_h; c > 0; --c) {
+        m_cell_start[c] = m_cell_start[c - 1];
+    }
+    m_cell_start[0] = 0;
+
+    center(descriptors1, count1, D, n, m_quantization.zero_point, m_centered1);
+    m_column_best.assign(count2, std::numeric_limits<int32_t>::min());
+    m_column_index.assign(count2, -1);
+    m_row_index.resize(count1);
+
+    // Rows go in index order, so the columns keep the lowest index on ties with strict
+    // comparisons. The candidates of a row don't, its ties compare the original indices
+    const float radius2 = m_radius * m_radius;
+    int32_t sims[4];
+    for (int i = 0; i < count1; ++i) {
+        const int16_t* a = m_centered1.data() + static_cast<size_t>(i) * n;
+        float px = predicted1[2 * i], py = predicted1[2 * i + 1];
+        int32_t row_best = std::numeric_limits<int32_t>::min();
+        int row_slot = -1;
+        if (!std::isfinite(px) || !std::isfinite(py)) {
+            // Nowhere to search, and the float to int conversions of cell_range() would be undefined
+            m_row_index[i] = -1;
+            continue;
+        }
+
+        auto update = [&](int s, int32_t sim) {
+            float dx = m_sorted_points[2 * s] - px;
+            float dy = m_sorted_points[2 * s + 1] - py;
+            if (dx * dx + dy * dy > radius2) {
+                return;
+            }
+            if (sim > row_best || (sim == row_best && m_sorted_index[s] < m_sorted_index[row_slot])) {
+                row_best = sim;
+                row_slot = s;
+            }
+            if (sim > m_column_best[s]) {
+                m_column_best[s] = sim;
+                m_column_index[s] = i;
+            }
+        };
+
+        int cx0, cx1, cy0, cy1;
+        cell_range(px - m_radius, px + m_radius, min_x, cell, grid_w, cx0, cx1);
+        cell_range(py - m_radius, py + m_radius, min_y, cell, grid_h, cy0, cy1);
+        for (int cy = cy0; cy <= cy1 && cx0 <= cx1; ++cy) {
+            // The cells of a grid row are contiguous in the sorted order
+            int s = m_cell_start[cy * grid_w + cx0];
+            int end = m_cell_start[cy * grid_w + cx1 + 1];
+            for (; s + 4 <= end; s += 4) {
+                dot4(a, m_sorted2.data() + static_cast<size_t>(s) * n, n, sims);
+                for (int c = 0; c < 4; ++c) {
+                    update(s + c, sims[c]);
+                }
+            }
+            for (; s < end; ++s) {
+                update(s, dot1(a, m_sorted2.data() + static_cast<size_t>(s) * n, n));
+            }
+        }
+        m_row_index[i] = row_best >= m_threshold ? row_slot : -1;
+    }
+
+    for (int i = 0; i < count1; ++i) {
+        int s = m_row_index[i];
+        if (s >= 0 && m_column_index[s] == i) {
+            matches.emplace_back(i, m_sorted_index[s]);
+        }
+    }
+
+    if (static_cast<int>(matches.size()) >= m_min_matches) {
+        return true;
+    }
+    m_brute_force.match(descriptors1, count1, descriptors2, count2, D, matches);
+    return false;
+}
+
+} // namespace dkd
@@ -0,0 +1,228 @@
+#include "triangulation.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if !defined(DKD_DISABLE_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define DKD_USE_NEON
+#elif !defined(DKD_DISABLE_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define DKD_USE_SSE2
+#endif
+
+namespace dkd {
+
+namespace {
+
+#if defined(DKD_USE_NEON)
+// ARMv7 NEON has no division: the 8 bit estimate and two Newton-Raphson steps get to
+// float precision within a couple of ulps
+inline float32x4_t reciprocal(float32x4_t x) {
+    float32x4_t r = vrecpeq_f32(x);
+    r = vmulq_f32(vrecpsq_f32(x, r), r);
+    return vmulq_f32(vrecpsq_f32(x, r), r);
+}
+
+inline float32x4_t reciprocal_sqrt(float32x4_t x) {
+    float32x4_t r = vrsqrteq_f32(x);
+    r = vmulq_f32(vrsqrtsq_f32(vmulq_f32(x, r), r), r);
+    return vmulq_f32(vrsqrtsq_f32(vmulq_f32(x, r), r), r);
+}
+#endif
+
+} // namespace
+
+void Triangulation::reserve(int count) {
+    X.reserve(count);
+    Y.reserve(count);
+    Z.reserve(count);
+    depth1.reserve(count);
+    depth2.reserve(count);
+    parallax.reserve(count);
+    error2.reserve(count);
+}
+
+void Triangulation::resize(int count) {
+    X.resize(count);
+    Y.resize(count);
+    Z.resize(count);
+    depth1.resize(count);
+    depth2.resize(count);
+    parallax.resize(count);
+    error2.resize(count);
+}
+
+void triangulate(const CameraPose& pose1, const CameraPose& pose2, const float* x1, const float* y1,
+                 const float* x2, const float* y2, int count, Triangulation& points) {
+    points.resize(count);
+    float* X = points.X.data();
+    float* Y = points.Y.data();
+    float* Z = points.Z.data();
+    float* depth1 = points.depth1.data();
+    float* depth2 = points.depth2.data();
+    float* parallax = points.parallax.data();
+    float* error2 = points.error2.data();
+
+    // Rays C + s A (x, y, 1) in the world, from the camera centers C = -R^T t. With the
+    // baseline b = C2 - C1 the closest points of the two rays are at
+    //   s1 = (|d2|^2 d1.b - d1.d2 d2.b) / |d1 x d2|^2
+    //   s2 = (d1.d2 d1.b - |d1|^2 d2.b) / |d1 x d2|^2
+    // and the world point halfway between them
+    const Eigen::Matrix3f R1 = pose1.leftCols<3>(), R2 = pose2.leftCols<3>();
+    const Eigen::Vector3f t1 = pose1.col(3), t2 = pose2.col(3);
+    const Eigen::Matrix3f A1 = R1.transpose(), A2 = R2.transpose();
+    const Eigen::Vector3f C1 = -A1 * t1, C2 = -A2 * t2;
+    const Eigen::Vector3f b = C2 - C1;
+    const Eigen::Vector3f m = 0.5f * (C1 + C2);
+
+    int i = 0;
+#if defined(DKD_USE_NEON)
+    float32x4_t a1[9], a2[9], r1[9], r2[9];
+    for (int k = 0; k < 9; ++k) {
+        a1[k] = vdupq_n_f32(A1(k / 3, k % 3));
+        a2[k] = vdupq_n_f32(A2(k / 3, k % 3));
+        r1[k] = vdupq_n_f32(R1(k / 3, k % 3));
+        r2[k] = vdupq_n_f32(R2(k / 3, k % 3));
+    }
+    float32x4_t bx = vdupq_n_f32(b.x()), by = vdupq_n_f32(b.y()), bz = vdupq_n_f32(b.z());
+    float32x4_t mx = vdupq_n_f32(m.x()), my = vdupq_n_f32(m.y()), mz = vdupq_n_f32(m.z());
+    float32x4_t t1x = vdupq_n_f32(t1.x()), t1y = vdupq_n_f32(t1.y()), t1z = vdupq_n_f32(t1.z());
+    float32x4_t t2x = vdupq_n_f32(t2.x()), t2y = vdupq_n_f32(t2.y()), t2z = vdupq_n_f32(t2.z());
+    float32x4_t half = vdupq_n_f32(0.5f);
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t u1 = vld1q_f32(x1 + i), v1 = vld1q_f32(y1 + i);
+        float32x4_t u2 = vld1q_f32(x2 + i), v2 = vld1q_f32(y2 + i);
+        float32x4_t d1x = vmlaq_f32(vmlaq_f32(a1[2], a1[0], u1), a1[1], v1);
+        float32x4_t d1y = vmlaq_f32(vmlaq_f32(a1[5], a1[3], u1), a1[4], v1);
+        float32x4_t d1z = vmlaq_f32(vmlaq_f32(a1[8], a1[6], u1), a1[7], v1);
+        float32x4_t d2x = vmlaq_f32(vmlaq_f32(a2[2], a2[0], u2), a2[1], v2);
+        float32x4_t d2y = vmlaq_f32(vmlaq_f32(a2[5], a2[3], u2), a2[4], v2);
+        float32x4_t d2z = vmlaq_f32(vmlaq_f32(a2[8], a2[6], u2), a2[7], v2);
+        float32x4_t aa = vmlaq_f32(vmlaq_f32(vmulq_f32(d1x, d1x), d1y, d1y), d1z, d1z);
+        float32x4_t ab = vmlaq_f32(vmlaq_f32(vmulq_f32(d1x, d2x), d1y, d2y), d1z, d2z);
+        float32x4_t bb = vmlaq_f32(vmlaq_f32(vmulq_f32(d2x, d2x), d2y, d2y), d2z, d2z);
+        float32x4_t d = vmlaq_f32(vmlaq_f32(vmulq_f32(d1x, bx), d1y, by), d1z, bz);
+        float32x4_t e = vmlaq_f32(vmlaq_f32(vmulq_f32(d2x, bx), d2y, by), d2z, bz);
+        // |d1 x d2|^2 rather than |d1|^2 |d2|^2 - (d1.d2)^2, which cancels at low parallax
+        float32x4_t nx = vmlsq_f32(vmulq_f32(d1y, d2z), d1z, d2y);
+        float32x4_t ny = vmlsq_f32(vmulq_f32(d1z, d2x), d1x, d2z);
+        float32x4_t nz = vmlsq_f32(vmulq_f32(d1x, d2y), d1y, d2x);
+        float32x4_t inverse = reciprocal(vmlaq_f32(vmlaq_f32(vmulq_f32(nx, nx), ny, ny), nz, nz));
+        float32x4_t s1 = vmulq_f32(vmulq_f32(vmlsq_f32(vmulq_f32(bb, d), ab, e), inverse), half);
+        float32x4_t s2 = vmulq_f32(vmulq_f32(vmlsq_f32(vmulq_f32(ab, d), aa, e), inverse), half);
+        float32x4_t px = vmlaq_f32(vmlaq_f32(mx, s1, d1x), s2, d2x);
+        float32x4_t py = vmlaq_f32(vmlaq_f32(my, s1, d1y), s2, d2y);
+        float32x4_t pz = vmlaq_f32(vmlaq_f32(mz, s1, d1z), s2, d2z);
+        vst1q_f32(X + i, px);
+        vst1q_f32(Y + i, py);
+        vst1q_f32(Z + i, pz);
+
+        // Back into both cameras for the depths and the reprojection errors
+        float32x4_t c1x = vmlaq_f32(vmlaq_f32(vmlaq_f32(t1x, r1[0], px), r1[1], py), r1[2], pz);
+        float32x4_t c1y = vmlaq_f32(vmlaq_f32(vmlaq_f32(t1y, r1[3], px), r1[4], py), r1[5], pz);
+        float32x4_t c1z = vmlaq_f32(vmlaq_f32(vmlaq_f32(t1z, r1[6], px), r1[7], py), r1[8], pz);
+        float32x4_t c2x = vmlaq_f32(vmlaq_f32(vmlaq_f32(t2x, r2[0], px), r2[1], py), r2[2], pz);
+        float32x4_t c2y = vmlaq_f32(vmlaq_f32(vmlaq_f32(t2y, r2[3], px), r2[4], py), r2[5], pz);
+        float32x4_t c2z = vmlaq_f32(vmlaq_f32(vmlaq_f32(t2z, r2[6], px), r2[7], py), r2[8], pz);
+        vst1q_f32(depth1 + i, c1z);
+        vst1q_f32(depth2 + i, c2z);
+        float32x4_t inverse1 = reciprocal(c1z), inverse2 = reciprocal(c2z);
+        float32x4_t e1x = vmlsq_f32(u1, c1x, inverse1), e1y = vmlsq_f32(v1, c1y, inverse1);
+        float32x4_t e2x = vmlsq_f32(u2, c2x, inverse2), e2y = vmlsq_f32(v2, c2y, inverse2);
+        float32x4_t squared1 = vmlaq_f32(vmulq_f32(e1x, e1x), e1y, e1y);
+        float32x4_t squared2 = vmlaq_f32(vmulq_f32(e2x, e2x), e2y, e2y);
+        vst1q_f32(error2 + i, vmaxq_f32(squared1, squared2));
+        // Cosine for now, the angle below
+        vst1q_f32(parallax + i, vmulq_f32(ab, reciprocal_sqrt(vmulq_f32(aa, bb))));
+    }
+#elif defined(DKD_USE_SSE2)
+    __m128 a1[9], a2[9], r1[9], r2[9];
+    for (int k = 0; k < 9; ++k) {
+        a1[k] = _mm_set1_ps(A1(k / 3, k % 3));
+        a2[k] = _mm_set1_ps(A2(k / 3, k % 3));
+        r1[k] = _mm_set1_ps(R1(k / 3, k % 3));
+        r2[k] = _mm_set1_ps(R2(k / 3, k % 3));
+    }
+    __m128 bx = _mm_set1_ps(b.x()), by = _mm_set1_ps(b.y()), bz = _mm_set1_ps(b.z());
+    __m128 mx = _mm_set1_ps(m.x()), my = _mm_set1_ps(m.y()), mz = _mm_set1_ps(m.z());
+    __m128 t1x = _mm_set1_ps(t1.x()), t1y = _mm_set1_ps(t1.y()), t1z = _mm_set1_ps(t1.z());
+    __m128 t2x = _mm_set1_ps(t2.x()), t2y = _mm_set1_ps(t2.y()), t2z = _mm_set1_ps(t2.z());
+    __m128 two = _mm_set1_ps(2.0f);
+    // a + b c, SSE2 has no fused multiply-add
+    auto mad = [](__m128 a, __m128 b, __m128 c) { return _mm_add_ps(a, _mm_mul_ps(b, c)); };
+    auto dot = [](__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz) {
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+    };
+    for (; i + 4 <= count; i += 4) {
+        __m128 u1 = _mm_loadu_ps(x1 + i), v1 = _mm_loadu_ps(y1 + i);
+        __m128 u2 = _mm_loadu_ps(x2 + i), v2 = _mm_loadu_ps(y2 + i);
+        __m128 d1x = mad(mad(a1[2], a1[0], u1), a1[1], v1);
+        __m128 d1y = mad(mad(a1[5], a1[3], u1), a1[4], v1);
+        __m128 d1z = mad(mad(a1[8], a1[6], u1), a1[7], v1);
+        __m128 d2x = mad(mad(a2[2], a2[0], u2), a2[1], v2);
+        __m128 d2y = mad(mad(a2[5], a2[3], u2), a2[4], v2);
+        __m128 d2z = mad(mad(a2[8], a2[6], u2), a2[7], v2);
+        __m128 aa = dot(d1x, d1y, d1z, d1x, d1y, d1z);
+        __m128 ab = dot(d1x, d1y, d1z, d2x, d2y, d2z);
+        __m128 bb = dot(d2x, d2y, d2z, d2x, d2y, d2z);
+        __m128 d = dot(d1x, d1y, d1z, bx, by, bz);
+        __m128 e = dot(d2x, d2y, d2z, bx, by, bz);
+        __m128 nx = _mm_sub_ps(_mm_mul_ps(d1y, d2z), _mm_mul_ps(d1z, d2y));
+        __m128 ny = _mm_sub_ps(_mm_mul_ps(d1z, d2x), _mm_mul_ps(d1x, d2z));
+        __m128 nz = _mm_sub_ps(_mm_mul_ps(d1x, d2y), _mm_mul_ps(d1y, d2x));
+        __m128 den = _mm_mul_ps(dot(nx, ny, nz, nx, ny, nz), two);
+        __m128 s1 = _mm_div_ps(_mm_sub_ps(_mm_mul_ps(bb, d), _mm_mul_ps(ab, e)), den);
+        __m128 s2 = _mm_div_ps(_mm_sub_ps(_mm_mul_ps(ab, d), _mm_mul_ps(aa, e)), den);
+        __m128 px = mad(mad(mx, s1, d1x), s2, d2x);
+        __m128 py = mad(mad(my, s1, d1y), s2, d2y);
+        __m128 pz = mad(mad(mz, s1, d1z), s2, d2z);
+        _mm_storeu_ps(X + i, px);
+        _mm_storeu_ps(Y + i, py);
+        _mm_storeu_ps(Z + i, pz);
+
+        __m128 c1x = mad(mad(mad(t1x, r1[0], px), r1[1], py), r1[2], pz);
+        __m128 c1y = mad(mad(mad(t1y, r1[3], px), r1[4], py), r1[5], pz);
+        __m128 c1z = mad(mad(mad(t1z, r1[6], px), r1[7], py), r1[8], pz);
+        __m128 c2x = mad(mad(mad(t2x, r2[0], px), r2[1], py), r2[2], pz);
+        __m128 c2y = mad(mad(mad(t2y, r2[3], px), r2[4], py), r2[5], pz);
+        __m128 c2z = mad(mad(mad(t2z, r2[6], px), r2[7], py), r2[8], pz);
+        _mm_storeu_ps(depth1 + i, c1z);
+        _mm_storeu_ps(depth2 + i, c2z);
+        __m128 e1x = _mm_sub_ps(u1, _mm_div_ps(c1x, c1z)), e1y = _mm_sub_ps(v1, _mm_div_ps(c1y, c1z));
+        __m128 e2x = _mm_sub_ps(u2, _mm_div_ps(c2x, c2z)), e2y = _mm_sub_ps(v2, _mm_div_ps(c2y, c2z));
+        __m128 squared1 = _mm_add_ps(_mm_mul_ps(e1x, e1x), _mm_mul_ps(e1y, e1y));
+        __m128 squared2 = _mm_add_ps(_mm_mul_ps(e2x, e2x), _mm_mul_ps(e2y, e2y));
+        _mm_storeu_ps(error2 + i, _mm_max_ps(squared1, squared2));
+        _mm_storeu_ps(parallax + i, _mm_div_ps(ab, _mm_sqrt_ps(_mm_mul_ps(aa, bb))));
+    }
+#endif
+    for (; i < count; ++i) {
+        Eigen::Vector3f d1 = A1 * Eigen::Vector3f(x1[i], y1[i], 1.0f);
+        Eigen::Vector3f d2 = A2 * Eigen::Vector3f(x2[i], y2[i], 1.0f);
+        float aa = d1.dot(d1), ab = d1.dot(d2), bb = d2.dot(d2);
+        float d = d1.dot(b), e = d2.dot(b);
+        float inverse = 0.5f / d1.cross(d2).squaredNorm();
+        float s1 = (bb * d - ab * e) * inverse;
+        float s2 = (ab * d - aa * e) * inverse;
+        Eigen::Vector3f P = m + s1 * d1 + s2 * d2;
+        X[i] = P.x();
+        Y[i] = P.y();
+        Z[i] = P.z();
+
+        Eigen::Vector3f c1 = R1 * P + t1, c2 = R2 * P + t2;
+        depth1[i] = c1.z();
+        depth2[i] = c2.z();
+        float e1x = x1[i] - c1.x() / c1.z(), e1y = y1[i] - c1.y() / c1.z();
+        float e2x = x2[i] - c2.x() / c2.z(), e2y = y2[i] - c2.y() / c2.z();
+        error2[i] = std::max(e1x * e1x + e1y * e1y, e2x * e2x + e2y * e2y);
+        parallax[i] = ab / std::sqrt(aa * bb);
+    }
+
+    // No vector arc cosine, a scalar pass over the cosines
+    for (i = 0; i < count; ++i) {
+        parallax[i] = std::acos(std::min(std::max(parallax[i], -1.0f), 1.0f));
+    }
+}
+
+} // namespace dkd
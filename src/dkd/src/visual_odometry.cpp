@@ -0,0 +1,288 @@
+#include "visual_odometry.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string.h>
+
+namespace dkd {
+
+namespace {
+
+const uint8_t SYNC[2] = {0xA5, 0x5A};
+
+// CRC-16/CCITT-FALSE, bitwise: 60 bytes a frame don't need a table
+uint16_t crc16(const uint8_t* data, size_t size) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= static_cast<uint16_t>(data[i]) << 8;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = crc & 0x8000 ? static_cast<uint16_t>(crc << 1 ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+        }
+    }
+    return crc;
+}
+
+// Little endian on the wire whatever the host, ARM and x86 both are already
+template<typename T>
+uint8_t* put(uint8_t* out, T value) {
+    memcpy(out, &value, sizeof(T));
+    return out + sizeof(T);
+}
+
+template<typename T>
+const uint8_t* get(const uint8_t* in, T& value) {
+    memcpy(&value, in, sizeof(T));
+    return in + sizeof(T);
+}
+
+// Rays closer than this are too parallel to triangulate, in radians
+const float MIN_PARALLAX = 0.005f;
+// A keyframe that has no depths is replaced once half the inliers see this much parallax,
+// about 2 degrees
+const float RESET_PARALLAX = 0.035f;
+// Triangulated points further than this from their keypoints in either frame are dropped
+const float MAX_ERROR_PX = 2.0f;
+
+inline float median(std::vector<float>& values) {
+    std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+    return values[values.size() / 2];
+}
+
+} // namespace
+
+void serialize(const PosePacket& packet, uint8_t* buffer) {
+    uint8_t* out = buffer;
+    *out++ = SYNC[0];
+    *out++ = SYNC[1];
+    out = put(out, packet.frame_id);
+    out = put(out, packet.flags);
+    out = put(out, packet.inliers);
+    for (float v : packet.q) out = put(out, v);
+    for (float v : packet.t) out = put(out, v);
+    for (float v : packet.covariance) out = put(out, v);
+    put(out, crc16(buffer + 2, out - buffer - 2));
+}
+
+bool deserialize(const uint8_t* buffer, PosePacket& packet) {
+    if (buffer[0] != SYNC[0] || buffer[1] != SYNC[1]) {
+        return false;
+    }
+    uint16_t crc;
+    get(buffer + POSE_PACKET_SIZE - 2, crc);
+    if (crc != crc16(buffer + 2, POSE_PACKET_SIZE - 4)) {
+        return false;
+    }
+    const uint8_t* in = buffer + 2;
+    in = get(in, packet.frame_id);
+    in = get(in, packet.flags);
+    in = get(in, packet.inliers);
+    for (float& v : packet.q) in = get(in, v);
+    for (float& v : packet.t) in = get(in, v);
+    for (float& v : packet.covariance) in = get(in, v);
+    return true;
+}
+
+VisualOdometry::VisualOdometry(const Intrinsics& intrinsics, const Quantization& quantization,
+                               const OdometrySettings& settings)
+    : m_intrinsics(intrinsics), m_settings(settings), m_ransac(intrinsics, settings.ransac) {
+    m_matcher.configure(quantization, settings.match_threshold, settings.match_ratio);
+}
+
+void VisualOdometry::reserve(int count, int D) {
+    m_matcher.reserve(count, D);
+    m_ransac.reserve(count);
+    m_points.reserve(2 * count);
+    m_descriptors.reserve(static_cast<size_t>(count) * D);
+    m_depths.reserve(count);
+    m_matches.reserve(count);
+    m_points1.reserve(2 * count);
+    m_points2.reserve(2 * count);
+    m_quality.reserve(count);
+    m_x1.reserve(count);
+    m_y1.reserve(count);
+    m_x2.reserve(count);
+    m_y2.reserve(count);
+    m_triangulation.reserve(count);
+    m_ratios.reserve(count);
+    m_next_depths.reserve(count);
+}
+
+void VisualOdometry::reset() {
+    m_has_keyframe = false;
+    m_rotation.setIdentity();
+    m_position.setZero();
+    m_step = 1.0f;
+}
+
+void VisualOdometry::keep(const float* points, const uint8_t* descriptors, int count, int D) {
+    m_points.assign(points, points + 2 * count);
+    m_descriptors.assign(descriptors, descriptors + static_cast<size_t>(count) * D);
+    m_depths.swap(m_next_depths);
+    m_count = count;
+    m_keyframe_rotation = m_rotation;
+    m_keyframe_position = m_position;
+    m_since_keyframe = 0;
+    m_has_keyframe = true;
+}
+
+void VisualOdometry::fill(PosePacket& packet, const float* covariance) const {
+    Eigen::Quaternionf q(m_rotation);
+    q.normalize();
+    packet.q[0] = q.w();
+    packet.q[1] = q.x();
+    packet.q[2] = q.y();
+    packet.q[3] = q.z();
+    for (int k = 0; k < 3; ++k) {
+        packet.t[k] = m_position(k);
+    }
+    for (int k = 0; k < 6; ++k) {
+        packet.covariance[k] = covariance[k];
+    }
+}
+
+bool VisualOdometry::track(uint32_t frame_id, const float* points, const uint8_t* descriptors, int count, int D,
+                           PosePacket& packet) {
+    packet.frame_id = frame_id;
+    packet.flags = 0;
+    packet.inliers = 0;
+    m_next_depths.assign(count, -1.0f);
+
+    if (!m_has_keyframe) {
+        // The first frame is the origin
+        std::fill(m_keyframe_covariance, m_keyframe_covariance + 6, 0.0f);
+        packet.flags = POSE_KEYFRAME;
+        fill(packet, m_keyframe_covariance);
+        keep(points, descriptors, count, D);
+        return true;
+    }
+
+    // Matches by the ranks of their keypoints, DKD writes the best first, and their similarity
+    m_matcher.match(m_descriptors.data(), m_count, descriptors, count, D, m_matches);
+    int matches = static_cast<int>(m_matches.size());
+    m_points1.resize(2 * matches);
+    m_points2.resize(2 * matches);
+    m_quality.resize(matches);
+    for (int k = 0; k < matches; ++k) {
+        int i = m_matches[k].index1, j = m_matches[k].index2;
+        m_points1[2 * k] = m_points[2 * i];
+        m_points1[2 * k + 1] = m_points[2 * i + 1];
+        m_points2[2 * k] = points[2 * j];
+        m_points2[2 * k + 1] = points[2 * j + 1];
+        float score1 = 1.0f - static_cast<float>(i) / m_count;
+        float score2 = 1.0f - static_cast<float>(j) / count;
+        m_quality[k] = score1 * score2 * m_matches[k].similarity;
+    }
+
+    RelativePose pose;
+    bool tracked = m_ransac.estimate(m_points1.data(), m_points2.data(), m_quality.data(), matches, pose) &&
+                   pose.inliers >= m_settings.min_inliers;
+    if (!tracked) {
+        // The pose stays where it was and the next frame starts a new scale from this one
+        float unknown[6];
+        std::fill(unknown, unknown + 6, std::numeric_limits<float>::infinity());
+        packet.flags = POSE_KEYFRAME | POSE_LOST;
+        fill(packet, unknown);
+        keep(points, descriptors, count, D);
+        return true;
+    }
+
+    // Inliers triangulated for a unit step from the keyframe, which is the world here
+    m_x1.resize(matches);
+    m_y1.resize(matches);
+    m_x2.resize(matches);
+    m_y2.resize(matches);
+    for (int k = 0; k < matches; ++k) {
+        m_x1[k] = (m_points1[2 * k] - m_intrinsics.cx) / m_intrinsics.fx;
+        m_y1[k] = (m_points1[2 * k + 1] - m_intrinsics.cy) / m_intrinsics.fy;
+        m_x2[k] = (m_points2[2 * k] - m_intrinsics.cx) / m_intrinsics.fx;
+        m_y2[k] = (m_points2[2 * k + 1] - m_intrinsics.cy) / m_intrinsics.fy;
+    }
+    CameraPose keyframe_pose = CameraPose::Zero(), frame_pose;
+    keyframe_pose.leftCols<3>().setIdentity();
+    frame_pose << pose.R, pose.t;
+    triangulate(keyframe_pose, frame_pose, m_x1.data(), m_y1.data(), m_x2.data(), m_y2.data(), matches,
+                m_triangulation);
+
+    const std::vector<uint8_t>& mask = m_ransac.inlier_mask();
+    Triangulation& triangulated = m_triangulation;
+    float max_error2 = MAX_ERROR_PX * MAX_ERROR_PX / (m_intrinsics.fx * m_intrinsics.fy);
+    m_ratios.clear();
+    int wide = 0;
+    for (int k = 0; k < matches; ++k) {
+        bool good = mask[k] && triangulated.parallax[k] >= MIN_PARALLAX && triangulated.depth1[k] > 0.0f &&
+                    triangulated.depth2[k] > 0.0f && triangulated.error2[k] < max_error2;
+        if (!good) {
+            // Not a depth for the next keyframe either
+            triangulated.depth2[k] = -1.0f;
+            continue;
+        }
+        wide += triangulated.parallax[k] >= RESET_PARALLAX;
+        float previous = m_depths[m_matches[k].index1];
+        if (previous > 0.0f) {
+            m_ratios.push_back(previous / triangulated.depth1[k]);
+        }
+    }
+
+    // Length of the motion since the keyframe from the depths it has for the same keypoints.
+    // Without them the speed is assumed to be the one of the last step, until the next
+    // keyframe triangulates them over more than a step
+    float scale = m_step * (m_since_keyframe + 1);
+    float scale_variance = scale * scale;
+    int tracks = static_cast<int>(m_ratios.size());
+    bool reset = tracks < MIN_SCALE_TRACKS;
+    if (!reset) {
+        scale = median(m_ratios);
+        for (float& ratio : m_ratios) {
+            ratio = std::fabs(ratio - scale);
+        }
+        // Normal sigma from the median absolute deviation, of the median
+        float sigma = 1.4826f * median(m_ratios);
+        scale_variance = sigma * sigma * 1.5708f / tracks;
+    } else {
+        packet.flags |= POSE_SCALE_RESET;
+    }
+
+    // X2 = R X1 + t, so the camera turned by R^T since the keyframe and sits at -R2 t from it
+    Eigen::Vector3f previous_position = m_position;
+    m_rotation = m_keyframe_rotation * pose.R.transpose();
+    m_position = m_keyframe_position - m_rotation * (scale * pose.t);
+    if (!reset) {
+        m_step = (m_position - previous_position).norm();
+    }
+    ++m_since_keyframe;
+
+    // Variances of the motion since the keyframe in world axes, on top of the keyframe's
+    Eigen::Matrix3f rotation_covariance =
+        m_keyframe_rotation * pose.rotation_covariance * m_keyframe_rotation.transpose();
+    Eigen::Matrix3f translation_covariance = scale * scale * pose.translation_covariance +
+                                             scale_variance * pose.t * pose.t.transpose();
+    translation_covariance = m_rotation * translation_covariance * m_rotation.transpose();
+    float covariance[6];
+    for (int k = 0; k < 3; ++k) {
+        covariance[k] = m_keyframe_covariance[k] + rotation_covariance(k, k);
+        covariance[3 + k] = m_keyframe_covariance[3 + k] + translation_covariance(k, k);
+    }
+
+    // A new keyframe where the matches thin out, periodically, on turns, and to measure the
+    // scale again once the baseline is long enough
+    float turned = Eigen::AngleAxisf(pose.R).angle();
+    bool keyframe = (reset && 2 * wide >= pose.inliers) || pose.inliers < m_settings.keyframe_inliers ||
+                    m_since_keyframe >= m_settings.keyframe_interval ||
+                    turned * 180.0f / static_cast<float>(M_PI) >= m_settings.keyframe_angle_deg;
+    packet.inliers = static_cast<uint8_t>(std::min(pose.inliers, 255));
+    fill(packet, covariance);
+    if (keyframe) {
+        for (int k = 0; k < matches; ++k) {
+            if (triangulated.depth2[k] > 0.0f) {
+                m_next_depths[m_matches[k].index2] = scale * triangulated.depth2[k];
+            }
+        }
+        std::copy(covariance, covariance + 6, m_keyframe_covariance);
+        packet.flags |= POSE_KEYFRAME;
+        keep(points, descriptors, count, D);
+    }
+    return keyframe;
+}
+
+} // namespace dkd
@@ -29,7 +29,8 @@
 #include <Eigen/Dense>
 #include "thread_safe_queue.h"
 
-#include "alike/dkd.h"
+#include "dkd.h"
+#include "matcher.h"
 
 /*
 0. Load RKNN model
@@ -425,27 +426,11 @@ void extract_scoremap_reordered(uint8_t* input, uint8_t* scoremap, int height, i
     }
 }
 
-// Isn't used on edge
+// Isn't used on edge. Tiled, so matching against a large map doesn't need the N1 x N2 similarities
 void perform_matching(const Eigen::MatrixXf& desc1, const Eigen::MatrixXf& desc2, std::vector<std::pair<int, int>>& matches, float threshold) {
-    Eigen::MatrixXf sim = desc1 * desc2.transpose();
-    sim = (sim.array() >= threshold).select(sim, Eigen::MatrixXf::Zero(sim.rows(), sim.cols()));
-
-    Eigen::VectorXi nn12 = Eigen::VectorXi::Zero(sim.rows());
-    Eigen::VectorXi nn21 = Eigen::VectorXi::Zero(sim.cols());
-
-    for (int i = 0; i < sim.rows(); ++i) {
-        sim.row(i).maxCoeff(&nn12(i));
-    }
-
-    for (int i = 0; i < sim.cols(); ++i) {
-        sim.col(i).maxCoeff(&nn21(i));
-    }
-
-    for (int i = 0; i < sim.rows(); ++i) {
-        if (i == nn21[nn12[i]] && sim.row(i)[nn12[i]]){
-        matches.emplace_back(i, nn12[i]);
-        }
-    }
+    dkd::BlockedMatcher matcher;
+    matcher.configure(threshold);
+    matcher.match(desc1, desc2, matches);
 }
 
 struct Frame {
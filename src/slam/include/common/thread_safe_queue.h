@@ -42,7 +42,8 @@ public:
         // Wait until the queue is not empty
         cond_.wait(lock, [this]{ return !queue_.empty(); });
         
-        T value = queue_.front();
+        // Move out, the element is dropped right after anyway
+        T value = std::move(queue_.front());
         queue_.pop();
         return value;
     }
@@ -55,7 +56,7 @@ public:
         if (cond_.wait_for(lock, 
             std::chrono::milliseconds(timeout_ms), 
             [this]{ return !queue_.empty(); })) {
-            value = queue_.front();
+            value = std::move(queue_.front());
             queue_.pop();
             return true;
         }
@@ -70,7 +71,7 @@ public:
             return false;
         }
         
-        value = queue_.front();
+        value = std::move(queue_.front());
         queue_.pop();
         return true;
     }
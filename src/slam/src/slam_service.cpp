@@ -15,6 +15,7 @@
 #include <thread>
 #include <atomic>
 #include <cstring>
+#include <chrono>
 
 #include <asio.hpp>
 
@@ -32,6 +33,9 @@
 #include "thread_safe_queue.h"
 
 #include "dkd.h"
+#include "budget_controller.h"
+#include "matcher.h"
+#include "visual_odometry.h"
 
 /*
 0. Load RKNN model
@@ -60,6 +64,9 @@ RK_S32 RGA_DEVICE_ID = 0;
 RK_U32 IMAGE_WIDTH = 1920;
 RK_U32 IMAGE_HEIGHT = 1080;
 
+// Calibration scripts/slam/app.py uses, in the pixels of the keypoints
+const dkd::Intrinsics CAMERA_INTRINSICS = {323.0422f, 321.7988f, 250.8429f, 141.8251f};
+
 
 typedef struct {
   char *filePath;
@@ -427,29 +434,31 @@ void extract_scoremap_reordered(uint8_t* input, uint8_t* scoremap, int height, i
     }
 }
 
-// Isn't used on edge
-void perform_matching(const Eigen::MatrixXf& desc1, const Eigen::MatrixXf& desc2, std::vector<std::pair<int, int>>& matches, float threshold) {
-    Eigen::MatrixXf sim = desc1 * desc2.transpose();
-    sim = (sim.array() >= threshold).select(sim, Eigen::MatrixXf::Zero(sim.rows(), sim.cols()));
-
-    Eigen::VectorXi nn12 = Eigen::VectorXi::Zero(sim.rows());
-    Eigen::VectorXi nn21 = Eigen::VectorXi::Zero(sim.cols());
-
-    for (int i = 0; i < sim.rows(); ++i) {
-        sim.row(i).maxCoeff(&nn12(i));
-    }
-
-    for (int i = 0; i < sim.cols(); ++i) {
-        sim.col(i).maxCoeff(&nn21(i));
-    }
-
-    for (int i = 0; i < sim.rows(); ++i) {
-        if (i == nn21[nn12[i]] && sim.row(i)[nn12[i]]){
-        matches.emplace_back(i, nn12[i]);
-        }
-    }
+// Isn't used on edge. Matches the uint8 descriptor rows of DKD without dequantizing them,
+// only the first count rows of each side are valid
+void perform_matching(dkd::MutualMatcher& matcher, const uint8_t* desc1, int count1, const uint8_t* desc2, int count2,
+                      int depth, std::vector<std::pair<int, int>>& matches) {
+    matcher.match(desc1, count1, desc2, count2, depth, matches);
 }
 
+// Output of DKD for a single frame, the buffers are recycled between frames
+struct Detections {
+    int32_t id;
+    // Number of valid keypoints, the rest of the rows is padding
+    int32_t count;
+    // Budget the frame was detected with, the buffers are sized for the largest one
+    KeypointBudget budget;
+    // top_k x 2 row-major (x, y)
+    std::vector<int32_t> keypoints;
+    // top_k x D row-major
+    std::vector<uint8_t> descriptors;
+    // Copy of the raw feature map with -d, empty otherwise
+    std::vector<uint8_t> feature_map;
+
+    std::chrono::steady_clock::time_point capture_time;
+    double extract_ms;
+};
+
 struct Frame {
     int32_t id;
     Eigen::MatrixXi keypoints;
@@ -590,20 +599,72 @@ private:
 
 int main(int argc, char **argv)
 {
-    if (argc < 2)
+    // Keypoint threshold, in dequantized score units (-s) or as a probability (-p).
+    // Converted to the quantization of the loaded model, so a new export needs no rebuild
+    bool score_threshold_set = false, probability_threshold_set = false;
+    float score_threshold = 0.0f, probability_threshold = 0.0f;
+    // Capture to sent latency the keypoint budget is tuned for (-l)
+    BudgetSettings budget_settings;
+    // Threads of the DKD candidate detection (-t). 1 by default, more ran slower on the
+    // host and are not measured on the RV1126 yet
+    int dkd_threads = 1;
+    // Dump the raw feature maps for replaying them through dkd_bench on the host (-d).
+    // Debug only: a ~4 MB copy per frame and its write on the writer thread skew the latencies
+    bool dump_feature_maps = false;
+    // Send 12 byte sign signatures instead of the 96 byte descriptors, for slow links (-b).
+    // dkd_bench recall measures what it costs in matches on recorded descriptors
+    bool binary_signatures = false;
+    // Track the pose on board and send it every frame in a 62 byte packet, the features
+    // only on keyframes (-v)
+    bool visual_odometry = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:p:l:t:dbv")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            score_threshold = std::stof(optarg);
+            score_threshold_set = true;
+            break;
+        case 'p':
+            probability_threshold = std::stof(optarg);
+            probability_threshold_set = true;
+            break;
+        case 'l':
+            budget_settings.target_latency_ms = std::stod(optarg);
+            break;
+        case 't':
+            dkd_threads = std::stoi(optarg);
+            break;
+        case 'd':
+            dump_feature_maps = true;
+            break;
+        case 'b':
+            binary_signatures = true;
+            break;
+        case 'v':
+            visual_odometry = true;
+            break;
+        default:
+            printf("Usage: %s [-s score_threshold | -p probability_threshold] [-l target_latency_ms] [-t dkd_threads] [-d] [-b] [-v] model_path [frame_count]\n", argv[0]);
+            return -1;
+        }
+    }
+
+    if (optind >= argc)
     {
-        printf("Usage: %s model_path", argv[0]);
+        printf("Usage: %s [-s score_threshold | -p probability_threshold] [-l target_latency_ms] [-t dkd_threads] [-d] [-b] [-v] model_path [frame_count]\n", argv[0]);
         return -1;
     }
     int desired_frame_count = 120;
-    if (argc > 2)
+    if (argc > optind + 1)
     {
-        desired_frame_count = std::stoi(argv[2]);
+        desired_frame_count = std::stoi(argv[optind + 1]);
     }
 
     signal(SIGINT, sigterm_handler);
 
-    const char *model_path = argv[1];
+    const char *model_path = argv[optind];
 
     Model model(model_path);
     model.map_io();
@@ -626,17 +687,64 @@ int main(int argc, char **argv)
     auto& odms = output_info[0].dims;
     size_t D = odms[2] - 1, H = odms[1], W = odms[0];
 
-    ThreadSafeQueue<std::vector<uint8_t>> feature_map_queue;
+    DKD dkd(200, 1, 4);
+    // Spread keypoints over the frame, 8x5 cells of ~32x32 px on the 256x160 map
+    dkd.set_grid_cells(8, 5);
+    // Keypoints are written in Q8, ~7.5 px per map pixel at 1920 wide is too coarse
+    dkd.set_subpixel_refinement(true);
+    dkd.set_bilinear_sampling(true);
+    dkd.set_threads(dkd_threads);
+    // The score map shares the output tensor and its quantization with the descriptors
+    dkd::Quantization quantization;
+    if (output_info[0].qnt_type == RKNN_TENSOR_QNT_AFFINE_ASYMMETRIC) {
+        quantization.zero_point = output_info[0].zp;
+        quantization.scale = output_info[0].scale;
+        dkd.set_score_quantization(quantization);
+    }
+    if (probability_threshold_set) {
+        dkd.set_probability_threshold(probability_threshold);
+    } else if (score_threshold_set) {
+        dkd.set_score_threshold(score_threshold);
+    }
+    printf("Keypoint threshold: %d (quantized), %f (probability)\n",
+           dkd.quantized_threshold(), dkd.score_probability(dkd.quantized_threshold()));
+    dkd.reserve(D, H, W);
+
+    dkd::VisualOdometry odometry(CAMERA_INTRINSICS, quantization);
+    if (visual_odometry) {
+        odometry.reserve(dkd.top_k(), D);
+    }
+
+    // Keypoint count and threshold are retuned every frame to hold the latency under the
+    // target when the link or the CPU fall behind, between these bounds
+    budget_settings.max_top_k = dkd.top_k();
+    budget_settings.min_top_k = dkd.top_k() / 4;
+    budget_settings.min_threshold = dkd.quantized_threshold();
+    budget_settings.max_threshold = std::max<int>(dkd.quantized_threshold(), 224);
+    BudgetController budget_controller(budget_settings);
+
+    // DKD runs in place on the mapped NPU output, before the next inference overwrites it.
+    // Only its results (~20 KB) travel between the threads instead of the whole ~4 MB
+    // feature map, unless -d dumps it, in a fixed set of buffers recycled through the free queue
+    const int DETECTION_BUFFERS = 4;
+    ThreadSafeQueue<Detections> free_detections;
+    ThreadSafeQueue<Detections> detections_queue;
+    for (int i = 0; i < DETECTION_BUFFERS; ++i) {
+        Detections detections;
+        detections.keypoints.resize(2 * dkd.top_k());
+        detections.descriptors.resize(dkd.top_k() * D);
+        free_detections.push(std::move(detections));
+    }
 
     auto feature_extractor_worker = [&]() {
         int frame_count = 0;
-        uint32_t output_tensor_size = (D + 1) * H * W;
         MEDIA_BUFFER media_buffer = NULL;
 
         while (!quit && frame_count++ < desired_frame_count) {
             media_buffer = RK_MPI_SYS_GetMediaBuffer(RK_ID_RGA, 0, -1);
             printf("[feature_extractor_worker INFO] Got media buffer\n");
             if (!media_buffer) break;
+            auto capture_time = std::chrono::steady_clock::now();
 
             uint8_t* input_data = reinterpret_cast<uint8_t*>(RK_MPI_MB_GetPtr(media_buffer));
             size_t input_size = RK_MPI_MB_GetSize(media_buffer);
@@ -657,28 +765,57 @@ int main(int argc, char **argv)
 
             model.run_mapped(input_data);
 
-            // Get the output
-            std::vector<uint8_t> feature_map(output_model_addr, output_model_addr + output_tensor_size);
-            std::cout << "[feature_extractor_worker] PUSHED FEATURE MAP" << std::endl;
-            feature_map_queue.push(std::move(feature_map));
+            // Split the feature map into keypoints and descriptors straight from the mapped output
+            //size_t D = 96, H = 160, W = 256;
+            size_t scoremap_offset = D * H * W;
+            Detections detections = free_detections.wait_and_pop();
+            detections.id = frame_count;
+            detections.budget = budget_controller.budget();
+            dkd.set_top_k(detections.budget.top_k);
+            dkd.set_quantized_threshold(detections.budget.threshold);
+            // The output is CHW uint8: the D descriptor planes of H x W, then the scoremap plane
+            detections.count = dkd.run_into(output_model_addr + scoremap_offset, output_model_addr,
+                                            detections.keypoints.data(), detections.descriptors.data(), D, H, W);
+            detections.capture_time = capture_time;
+            detections.extract_ms = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - capture_time).count();
+            if (dump_feature_maps) {
+                // The next inference overwrites the mapped output, the writer gets a copy
+                detections.feature_map.assign(output_model_addr, output_model_addr + (D + 1) * H * W);
+            }
+            std::cout << "[feature_extractor_worker] PUSHED DETECTIONS" << std::endl;
+            detections_queue.push(std::move(detections));
 
             RK_MPI_MB_ReleaseBuffer(media_buffer);
         }
 
         // Poison pill
-        feature_map_queue.push({}); 
+        Detections pill;
+        pill.id = -1;
+        detections_queue.push(std::move(pill));
     };
     
-    DKD dkd(200, 1, 4);
     ThreadSafeQueue<Frame> frame_queue;
 
 
     auto keypoint_detector_worker = [&](){
         uint32_t frame_count = 0;
+        // Column-major keypoints, the layout of the keypoints files
+        std::vector<int32_t> keypoints_columns(2 * budget_settings.max_top_k);
+        std::vector<uint8_t> signatures(budget_settings.max_top_k * dkd::signature_size(D));
+        // Keypoints in pixels for the odometry, and the pose packets of all the frames
+        std::vector<float> points(2 * budget_settings.max_top_k);
+        uint8_t pose_buffer[dkd::POSE_PACKET_SIZE];
+        std::ofstream poses_stream;
+        if (visual_odometry) {
+            poses_stream.open("data/poses.bin", std::ios::binary);
+        }
+        auto last_report = std::chrono::steady_clock::now();
         while (!quit) {
-            std::vector<uint8_t> feature_map = feature_map_queue.wait_and_pop();
+            Detections detections = detections_queue.wait_and_pop();
+            size_t queue_depth = detections_queue.size();
             // Took a poison pill
-            if (feature_map.empty()) {
+            if (detections.id < 0) {
                 // Pass the pill and die
                 Frame frame;
                 frame.id = -1;
@@ -686,27 +823,84 @@ int main(int argc, char **argv)
                 break;
             } 
 
-            // Splite the feature map into keypoints and descriptors
-            //size_t D = 96, H = 160, W = 256;
-            size_t descriptors_offset = H * W;
-            size_t scoremap_offset = D * H * W;
-            Eigen::MatrixXi keypoints;
-            Eigen::Matrix<uint8_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> descriptors;
-            // I hope the memory layout matches the one I expect here.... please....
-            dkd.run(feature_map.data() + scoremap_offset, feature_map.data(), keypoints, descriptors, D, H, W);
-            
+            if (!detections.feature_map.empty()) {
+                std::string feature_map_file = "data/feature_map_" + std::to_string(detections.id) + ".bin";
+                std::ofstream feature_map_stream(feature_map_file, std::ios::binary);
+                feature_map_stream.write(reinterpret_cast<const char*>(detections.feature_map.data()),
+                                         detections.feature_map.size());
+            }
+
             // Submit frame for sending
             
 
-            {// Save ketpoitns and descriptors to files
+            auto send_start = std::chrono::steady_clock::now();
+            size_t bytes_sent = 0;
+            // With -v the pose goes every frame and the features files only for keyframes
+            bool keyframe = true;
+            if (visual_odometry) {
+                int count = std::min(detections.count, detections.budget.top_k);
+                for (int i = 0; i < 2 * count; ++i) {
+                    points[i] = static_cast<float>(detections.keypoints[i]) / (1 << dkd::SUBPIXEL_BITS);
+                }
+                dkd::PosePacket packet;
+                keyframe = odometry.track(static_cast<uint32_t>(detections.id), points.data(),
+                                          detections.descriptors.data(), count, D, packet);
+                dkd::serialize(packet, pose_buffer);
+                poses_stream.write(reinterpret_cast<const char*>(pose_buffer), sizeof(pose_buffer));
+                poses_stream.flush();
+                bytes_sent += sizeof(pose_buffer);
+                printf("[keypoint_detector_worker INFO] Frame %d: pose (%.2f, %.2f, %.2f), %d inliers, flags %d\n",
+                       detections.id, packet.t[0], packet.t[1], packet.t[2], packet.inliers, packet.flags);
+            }
+            if (keyframe) {// Save ketpoitns and descriptors to files, as many rows as the budget of the frame.
+                // Numbered by keyframe with -v, the packets flagged POSE_KEYFRAME give their frames
+                int top_k = detections.budget.top_k;
+                for (int i = 0; i < top_k; ++i) {
+                    keypoints_columns[i] = detections.keypoints[2 * i];
+                    keypoints_columns[top_k + i] = detections.keypoints[2 * i + 1];
+                }
+                // The budget goes along, so the receiving side knows the sizes and the threshold
+                int32_t budget[3] = {top_k, detections.budget.threshold, detections.count};
+                std::string budget_file = "data/budget_" + std::to_string(frame_count) + ".bin";
                 std::string keypoints_file = "data/keypoints_" + std::to_string(frame_count) + ".bin";
-                std::string descriptors_file = "data/descriptors_" + std::to_string(frame_count++) + ".bin";
+                std::string descriptors_file = (binary_signatures ? "data/signatures_" : "data/descriptors_") +
+                                               std::to_string(frame_count++) + ".bin";
+                std::ofstream budget_stream(budget_file, std::ios::binary);
                 std::ofstream keypoints_stream(keypoints_file, std::ios::binary);
                 std::ofstream descriptors_stream(descriptors_file, std::ios::binary);
-                keypoints_stream.write(reinterpret_cast<const char*>(keypoints.data()), keypoints.size() * sizeof(Eigen::MatrixXi::Scalar));
-                descriptors_stream.write(reinterpret_cast<const char*>(descriptors.data()), descriptors.size());
+                size_t keypoints_size = 2 * top_k * sizeof(int32_t);
+                size_t descriptors_size = top_k * D;
+                const uint8_t* descriptors = detections.descriptors.data();
+                if (binary_signatures) {
+                    descriptors_size = top_k * dkd::signature_size(D);
+                    dkd::binarize(descriptors, top_k, D, quantization.zero_point, signatures.data());
+                    descriptors = signatures.data();
+                }
+                budget_stream.write(reinterpret_cast<const char*>(budget), sizeof(budget));
+                keypoints_stream.write(reinterpret_cast<const char*>(keypoints_columns.data()), keypoints_size);
+                descriptors_stream.write(reinterpret_cast<const char*>(descriptors), descriptors_size);
+                bytes_sent += sizeof(budget) + keypoints_size + descriptors_size;
+            }
+
+            {// Feed the frame back to the budget controller
+                auto now = std::chrono::steady_clock::now();
+                FrameStats stats;
+                stats.latency_ms = std::chrono::duration<double, std::milli>(now - detections.capture_time).count();
+                stats.extract_ms = detections.extract_ms;
+                stats.send_ms = std::chrono::duration<double, std::milli>(now - send_start).count();
+                stats.queue_depth = queue_depth;
+                stats.bytes_sent = bytes_sent;
+                stats.interval_ms = std::chrono::duration<double, std::milli>(now - last_report).count();
+                last_report = now;
+                budget_controller.report(stats);
+                printf("[keypoint_detector_worker INFO] Frame %d: top_k %d, threshold %d, %d keypoints, "
+                       "latency %.1f ms, extract %.1f ms, send %.1f ms, queue %zu, load %.2f\n",
+                       detections.id, detections.budget.top_k, detections.budget.threshold, detections.count,
+                       stats.latency_ms, stats.extract_ms, stats.send_ms, queue_depth, budget_controller.load());
             }
 
+            // Hand the buffers back to the extractor
+            free_detections.push(std::move(detections));
             continue;
             // Frame frame;
             // frame.id = static_cast<int32_t>(frame_count++);